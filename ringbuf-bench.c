@@ -0,0 +1,567 @@
+/*
+ * ringbuf-bench.c - benchmarks for the C ring buffer implementation.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Usage: ringbuf-bench [-t seconds] [benchmark ...]
+ *
+ * Runs each benchmark (or only the named ones) for about the given
+ * number of seconds (default 0.25), and prints one line of
+ * comma-separated values per configuration to standard output, after
+ * a header line:
+ *
+ * benchmark: memcpy, findchr, pipe, socket, spsc_pingpong or
+ * mpmc_pingpong.
+ *
+ * mode: the ring buffer mode (default, pow2, mirrored or spsc), or
+ * for pipes and sockets, the functions used; "+wrap" means that the
+ * ring buffer's contents are positioned so that half of the
+ * operations are split by the end of the buffer.
+ *
+ * size: the number of bytes moved per operation (for findchr, the
+ * average line length).
+ *
+ * ops, seconds, mb_per_sec, ns_per_op: the number of operations
+ * timed, the time they took, and the resulting throughput and mean
+ * latency.
+ *
+ * p50_ns, p90_ns, p99_ns, p999_ns, max_ns: latency percentiles. Each
+ * sample times a batch of operations (64 for the in-memory
+ * benchmarks, 1 for the others), so that the clock's overhead doesn't
+ * swamp the cheapest operations; the percentiles are of the mean
+ * latency per batch. A ping-pong operation is a round trip between
+ * two threads, pinned to different CPUs if possible.
+ *
+ * Build it with "make bench", which links it with the release build
+ * of ringbuf.c.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for pthread_setaffinity_np */
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "ringbuf.h"
+
+#define BENCH_MAX_SAMPLES (1 << 20)
+#define BENCH_BATCH 64
+
+static double bench_seconds = 0.25;
+static double *samples;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentile(size_t nsamples, double p)
+{
+    return samples[(size_t) (p * (nsamples - 1))];
+}
+
+/*
+ * Time op(ctx), in batches of batch calls, until bench_seconds have
+ * passed, and print the results. Each call of op moves size bytes.
+ */
+static void
+bench_run(const char *name, const char *mode, size_t size,
+          void (*op)(void *), void *ctx, size_t batch)
+{
+    uint64_t deadline = now_ns() + (uint64_t) (bench_seconds * 1e9);
+    uint64_t total_ns = 0;
+    size_t nsamples = 0;
+    size_t i;
+
+    do {
+        uint64_t start = now_ns();
+        for (i = 0; i != batch; ++i)
+            op(ctx);
+        uint64_t elapsed = now_ns() - start;
+        total_ns += elapsed;
+        samples[nsamples++] = (double) elapsed / batch;
+    } while (nsamples != BENCH_MAX_SAMPLES && now_ns() < deadline);
+
+    qsort(samples, nsamples, sizeof(*samples), compare_doubles);
+    uint64_t ops = (uint64_t) nsamples * batch;
+    double seconds = total_ns / 1e9;
+    printf("%s,%s,%zu,%llu,%.6f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+           name, mode, size, (unsigned long long) ops, seconds,
+           (double) ops * size / seconds / 1e6, total_ns / (double) ops,
+           percentile(nsamples, 0.5), percentile(nsamples, 0.9),
+           percentile(nsamples, 0.99), percentile(nsamples, 0.999),
+           samples[nsamples - 1]);
+    fflush(stdout);
+}
+
+struct mode
+{
+    const char *name;
+    int flags;
+};
+
+static const struct mode modes[] = {
+    {"default", 0},
+    {"pow2", RINGBUF_POW2},
+    {"mirrored", RINGBUF_MIRRORED},
+    {"spsc", RINGBUF_SPSC},
+};
+
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+/*
+ * Move rb's (empty) head and tail to offset bytes into the buffer.
+ */
+static void
+position(ringbuf_t rb, size_t offset, uint8_t *scratch)
+{
+    ringbuf_reset(rb);
+    ringbuf_memset(rb, 0, offset);
+    ringbuf_memcpy_from(scratch, rb, offset);
+}
+
+struct memcpy_ctx
+{
+    ringbuf_t rb;
+    uint8_t *src;
+    uint8_t *dst;
+    size_t size;
+};
+
+static void
+memcpy_op(void *arg)
+{
+    struct memcpy_ctx *c = arg;
+    ringbuf_memcpy_into(c->rb, c->src, c->size);
+    ringbuf_memcpy_from(c->dst, c->rb, c->size);
+}
+
+/*
+ * ringbuf_memcpy_into followed by ringbuf_memcpy_from, in a ring
+ * buffer twice the size of the copies.
+ */
+static void
+bench_memcpy(void)
+{
+    static const size_t sizes[] = {16, 64, 256, 1024, 4096, 16384};
+    uint8_t *src = calloc(1, 16384);
+    uint8_t *dst = malloc(16384);
+    size_t i, m;
+    int wrap;
+
+    for (m = 0; m != NMODES; ++m)
+        for (wrap = 0; wrap != 2; ++wrap)
+            for (i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i) {
+                struct memcpy_ctx c = {0, src, dst, sizes[i]};
+                c.rb = ringbuf_new_ex(2 * sizes[i], modes[m].flags);
+                if (!c.rb)
+                    continue;
+                if (wrap)
+                    position(c.rb, sizes[i] / 2, dst);
+                char mode[32];
+                snprintf(mode, sizeof(mode), "%s%s", modes[m].name,
+                         wrap ? "+wrap" : "");
+                bench_run("memcpy", mode, sizes[i], memcpy_op, &c,
+                          BENCH_BATCH);
+                ringbuf_free(&c.rb);
+            }
+    free(src);
+    free(dst);
+}
+
+/*
+ * Fill buf with newline-terminated lines of printable text, between
+ * 20 and 200 bytes long (like log lines or HTTP headers), and return
+ * the number of lines.
+ */
+static size_t
+make_lines(uint8_t *buf, size_t len)
+{
+    uint32_t seed = 12345;
+    size_t nlines = 0;
+    size_t i = 0;
+    while (i < len) {
+        seed = seed * 1103515245 + 12345;
+        size_t linelen = 20 + (seed >> 16) % 181;
+        size_t j;
+        for (j = 0; j + 1 < linelen && i < len; ++j, ++i)
+            buf[i] = ' ' + (i * 7 + j) % 95;
+        if (i < len) {
+            buf[i++] = '\n';
+            ++nlines;
+        }
+    }
+    return nlines;
+}
+
+struct findchr_ctx
+{
+    ringbuf_t rb;
+    size_t offset;
+    size_t used;
+};
+
+static void
+findchr_op(void *arg)
+{
+    struct findchr_ctx *c = arg;
+    c->offset = ringbuf_findchr(c->rb, '\n', c->offset) + 1;
+    if (c->offset >= c->used)
+        c->offset = 0;
+}
+
+/*
+ * Find each line in a ring buffer full of lines, in turn.
+ */
+static void
+bench_findchr(void)
+{
+    size_t capacity = 65536;
+    uint8_t *lines = malloc(capacity);
+    uint8_t *scratch = malloc(capacity);
+    size_t nlines = make_lines(lines, capacity / 2);
+    size_t m;
+    int wrap;
+
+    for (m = 0; m != NMODES; ++m)
+        for (wrap = 0; wrap != 2; ++wrap) {
+            struct findchr_ctx c = {0, 0, capacity / 2};
+            c.rb = ringbuf_new_ex(capacity, modes[m].flags);
+            if (!c.rb)
+                continue;
+            if (wrap)
+                position(c.rb, capacity * 3 / 4, scratch);
+            ringbuf_memcpy_into(c.rb, lines, capacity / 2);
+            char mode[32];
+            snprintf(mode, sizeof(mode), "%s%s", modes[m].name,
+                     wrap ? "+wrap" : "");
+            bench_run("findchr", mode, capacity / 2 / nlines, findchr_op, &c,
+                      BENCH_BATCH);
+            ringbuf_free(&c.rb);
+        }
+    free(lines);
+    free(scratch);
+}
+
+struct io_ctx
+{
+    ringbuf_t rb;
+    int rdfd;
+    int wrfd;
+    size_t size;
+    int vectored;
+};
+
+/*
+ * Write size bytes from the ring buffer to one end of a pipe or
+ * socket pair, and read them back in from the other.
+ */
+static void
+io_op(void *arg)
+{
+    struct io_ctx *c = arg;
+    size_t done = 0;
+    while (done != c->size) {
+        size_t n = MIN(c->size - done, ringbuf_bytes_used(c->rb));
+        ssize_t r = c->vectored ? ringbuf_writev(c->wrfd, c->rb, n) :
+            ringbuf_write(c->wrfd, c->rb, n);
+        if (r < 0) {
+            perror("write");
+            exit(1);
+        }
+        done += r;
+    }
+    for (done = 0; done != c->size; ) {
+        ssize_t r = c->vectored ?
+            ringbuf_readv(c->rdfd, c->rb, c->size - done) :
+            ringbuf_read(c->rdfd, c->rb, c->size - done);
+        if (r < 0) {
+            perror("read");
+            exit(1);
+        }
+        done += r;
+    }
+}
+
+static void
+bench_io(const char *name, int fds[2])
+{
+    static const size_t sizes[] = {256, 4096, 32768};
+    size_t i;
+    int vectored;
+
+    uint8_t *scratch = malloc(32768);
+
+    for (vectored = 0; vectored != 2; ++vectored)
+        for (i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            struct io_ctx c = {0, fds[0], fds[1], sizes[i], vectored};
+            c.rb = ringbuf_new_ex(2 * sizes[i], RINGBUF_POW2);
+            if (!c.rb)
+                continue;
+            position(c.rb, sizes[i] / 2, scratch);
+            ringbuf_memset(c.rb, 'x', sizes[i]);
+            bench_run(name, vectored ? "writev+readv" : "write+read",
+                      sizes[i], io_op, &c, 1);
+            ringbuf_free(&c.rb);
+        }
+    free(scratch);
+}
+
+static void
+bench_pipe(void)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    bench_io("pipe", fds);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void
+bench_socket(void)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    bench_io("socket", fds);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/*
+ * Pin the calling thread to the cpu'th CPU it may run on, if there
+ * is one (Linux only).
+ */
+static void
+pin_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t allowed, set;
+    int i, n = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+    for (i = 0; i != CPU_SETSIZE; ++i)
+        if (CPU_ISSET(i, &allowed) && n++ == cpu) {
+            CPU_ZERO(&set);
+            CPU_SET(i, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            return;
+        }
+#else
+    (void) cpu;
+#endif
+}
+
+/*
+ * Spin, yielding the CPU now and then, in case the other thread has
+ * to run on this one.
+ */
+static void
+relax(unsigned *spins)
+{
+    if (++*spins % 128 == 0)
+        sched_yield();
+}
+
+struct pingpong_ctx
+{
+    ringbuf_t ping;
+    ringbuf_t pong;
+    ringbuf_mpmc_t mping;
+    ringbuf_mpmc_t mpong;
+    uint64_t seq;
+};
+
+#define PINGPONG_STOP UINT64_MAX
+
+static void *
+spsc_echo(void *arg)
+{
+    struct pingpong_ctx *c = arg;
+    uint64_t v = 0;
+    unsigned spins = 0;
+    pin_thread(1);
+    while (v != PINGPONG_STOP) {
+        while (!ringbuf_memcpy_from(&v, c->ping, sizeof(v)))
+            relax(&spins);
+        while (!ringbuf_memcpy_into_nooverwrite(c->pong, &v, sizeof(v)))
+            relax(&spins);
+    }
+    return 0;
+}
+
+static void
+spsc_pingpong_op(void *arg)
+{
+    struct pingpong_ctx *c = arg;
+    uint64_t v = ++c->seq;
+    unsigned spins = 0;
+    ringbuf_memcpy_into_nooverwrite(c->ping, &v, sizeof(v));
+    while (!ringbuf_memcpy_from(&v, c->pong, sizeof(v)))
+        relax(&spins);
+}
+
+static void *
+mpmc_echo(void *arg)
+{
+    struct pingpong_ctx *c = arg;
+    uint64_t v = 0;
+    size_t len;
+    unsigned spins = 0;
+    pin_thread(1);
+    while (v != PINGPONG_STOP) {
+        while (!ringbuf_mpmc_try_pop(&v, c->mping, &len))
+            relax(&spins);
+        while (!ringbuf_mpmc_try_push(c->mpong, &v, sizeof(v)))
+            relax(&spins);
+    }
+    return 0;
+}
+
+static void
+mpmc_pingpong_op(void *arg)
+{
+    struct pingpong_ctx *c = arg;
+    uint64_t v = ++c->seq;
+    size_t len;
+    unsigned spins = 0;
+    ringbuf_mpmc_try_push(c->mping, &v, sizeof(v));
+    while (!ringbuf_mpmc_try_pop(&v, c->mpong, &len))
+        relax(&spins);
+}
+
+/*
+ * Bounce an 8-byte message between this thread and another, through
+ * a pair of SPSC ring buffers, or a pair of MPMC queues.
+ */
+static void
+bench_pingpong(int mpmc)
+{
+    struct pingpong_ctx c;
+    memset(&c, 0, sizeof(c));
+    if (mpmc) {
+        c.mping = ringbuf_mpmc_new(1024, sizeof(uint64_t));
+        c.mpong = ringbuf_mpmc_new(1024, sizeof(uint64_t));
+    } else {
+        c.ping = ringbuf_new_spsc(4096);
+        c.pong = ringbuf_new_spsc(4096);
+    }
+
+    pthread_t echo;
+    pin_thread(0);
+    pthread_create(&echo, 0, mpmc ? mpmc_echo : spsc_echo, &c);
+    bench_run(mpmc ? "mpmc_pingpong" : "spsc_pingpong",
+              mpmc ? "mpmc" : "spsc", sizeof(uint64_t),
+              mpmc ? mpmc_pingpong_op : spsc_pingpong_op, &c, 1);
+
+    uint64_t stop = PINGPONG_STOP;
+    if (mpmc) {
+        ringbuf_mpmc_try_push(c.mping, &stop, sizeof(stop));
+        pthread_join(echo, 0);
+        ringbuf_mpmc_free(&c.mping);
+        ringbuf_mpmc_free(&c.mpong);
+    } else {
+        ringbuf_memcpy_into_nooverwrite(c.ping, &stop, sizeof(stop));
+        pthread_join(echo, 0);
+        ringbuf_free(&c.ping);
+        ringbuf_free(&c.pong);
+    }
+}
+
+static void
+bench_spsc_pingpong(void)
+{
+    bench_pingpong(0);
+}
+
+static void
+bench_mpmc_pingpong(void)
+{
+    bench_pingpong(1);
+}
+
+static const struct
+{
+    const char *name;
+    void (*run)(void);
+} benchmarks[] = {
+    {"memcpy", bench_memcpy},
+    {"findchr", bench_findchr},
+    {"pipe", bench_pipe},
+    {"socket", bench_socket},
+    {"spsc_pingpong", bench_spsc_pingpong},
+    {"mpmc_pingpong", bench_mpmc_pingpong},
+};
+
+#define NBENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+int
+main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't' && atof(optarg) > 0)
+            bench_seconds = atof(optarg);
+        else {
+            fprintf(stderr, "usage: %s [-t seconds] [benchmark ...]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    samples = malloc(BENCH_MAX_SAMPLES * sizeof(*samples));
+    if (!samples) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("benchmark,mode,size,ops,seconds,mb_per_sec,ns_per_op,"
+           "p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+    size_t i;
+    int j;
+    for (i = 0; i != NBENCHMARKS; ++i) {
+        int selected = optind == argc;
+        for (j = optind; j < argc; ++j)
+            if (strcmp(argv[j], benchmarks[i].name) == 0)
+                selected = 1;
+        if (selected)
+            benchmarks[i].run();
+    }
+
+    free(samples);
+    return 0;
+}
@@ -20,6 +20,28 @@
 #include <stdint.h>
 #include <signal.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/param.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+#include <stdatomic.h>
 #include "ringbuf.h"
 
 /*
@@ -73,6 +95,271 @@ sigabort(int unused)
 /* Default size for these tests. */
 #define RINGBUF_SIZE 4096
 
+/*
+ * Reference implementation of ringbuf_findmem: a naive search over a
+ * linearized copy of the ring buffer's contents.
+ */
+size_t
+naive_findmem(const uint8_t *hay, size_t haylen, const void *needle,
+              size_t len, size_t offset)
+{
+    size_t i;
+    if (offset >= haylen || len > haylen - offset)
+        return haylen;
+    for (i = offset; i + len <= haylen; ++i)
+        if (memcmp(hay + i, needle, len) == 0)
+            return i;
+    return haylen;
+}
+
+/* Number of bytes to push through an SPSC ring buffer in threaded tests. */
+#define SPSC_TEST_BYTES (1 << 22)
+
+/*
+ * SPSC producer thread: write SPSC_TEST_BYTES bytes of a known
+ * sequence into the ring buffer, in chunks of varying size.
+ */
+void *
+spsc_producer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t chunk[251];
+    size_t nsent = 0;
+    while (nsent != SPSC_TEST_BYTES) {
+        size_t n = MIN(sizeof(chunk), SPSC_TEST_BYTES - nsent);
+        n = MIN(n, ringbuf_bytes_free(rb));
+        if (n == 0)
+            sched_yield();
+        size_t i;
+        for (i = 0; i != n; ++i)
+            chunk[i] = (uint8_t) (nsent + i);
+        const uint8_t *head = ringbuf_head(rb);
+        assert(ringbuf_memcpy_into(rb, chunk, n) == ringbuf_head(rb));
+        assert(n != 0 || ringbuf_head(rb) == head);
+        nsent += n;
+    }
+    return 0;
+}
+
+/* Number of records to push through an SPSC ring buffer in threaded tests. */
+#define SPSC_TEST_RECORDS (1 << 16)
+
+/*
+ * SPSC record producer thread: push SPSC_TEST_RECORDS records of
+ * varying length, each filled with its sequence number.
+ */
+void *
+spsc_record_producer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t record[97];
+    size_t nsent = 0;
+    while (nsent != SPSC_TEST_RECORDS) {
+        size_t len = nsent % sizeof(record);
+        memset(record, (uint8_t) nsent, len);
+        if (ringbuf_record_push(rb, record, len))
+            ++nsent;
+        else
+            sched_yield();
+    }
+    return 0;
+}
+
+#if defined(__linux__)
+/*
+ * The number of bytes of memory this process has locked, from
+ * /proc/self/status, or -1 if it can't be read.
+ */
+long
+locked_bytes(void)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f)
+        return -1;
+    char line[128];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmLck: %ld kB", &kb) == 1)
+            break;
+    fclose(f);
+    return kb < 0 ? -1 : kb * 1024;
+}
+#endif
+
+/*
+ * Blocking SPSC producer thread: like spsc_producer, but wait until
+ * there's room rather than spinning.
+ */
+void *
+blocking_producer(void *arg)
+{
+    ringbuf_t rb = arg;
+    uint8_t chunk[251];
+    size_t nsent = 0;
+    while (nsent != SPSC_TEST_BYTES) {
+        assert(ringbuf_wait_writable(rb, 1, -1));
+        size_t n = MIN(sizeof(chunk), SPSC_TEST_BYTES - nsent);
+        n = MIN(n, ringbuf_bytes_free(rb));
+        assert(n != 0);
+        size_t i;
+        for (i = 0; i != n; ++i)
+            chunk[i] = (uint8_t) (nsent + i);
+        ringbuf_memcpy_into(rb, chunk, n);
+        nsent += n;
+    }
+    return 0;
+}
+
+#if defined(HAVE_IO_URING)
+/*
+ * A minimal io_uring, driven with raw system calls, for the io_uring
+ * tests.
+ */
+struct test_uring
+{
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+/*
+ * Set up u with room for 8 SQEs. Returns 0 on success, or -1 if
+ * io_uring isn't available.
+ */
+int
+test_uring_init(struct test_uring *u)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, 8, &p);
+    if (u->fd < 0)
+        return -1;
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    uint8_t *sq = mmap(0, MAX(sq_size, cq_size), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    assert(sq != MAP_FAILED);
+    assert(p.features & IORING_FEAT_SINGLE_MMAP);
+    uint8_t *cq = sq;
+    u->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) (sq + p.sq_off.array);
+    u->cq_head = (unsigned *) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    u->sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                   IORING_OFF_SQES);
+    assert(u->sqes != MAP_FAILED);
+    return 0;
+}
+
+/*
+ * Submit u->sqes[0] through u->sqes[n - 1], wait for their n
+ * completions, and store their results, in completion order, in res.
+ */
+void
+test_uring_run(struct test_uring *u, unsigned n, int *res)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned i;
+    for (i = 0; i != n; ++i)
+        u->sq_array[(tail + i) & *u->sq_mask] = i;
+    __atomic_store_n(u->sq_tail, tail + n, __ATOMIC_RELEASE);
+    assert(syscall(__NR_io_uring_enter, u->fd, n, n,
+                   IORING_ENTER_GETEVENTS, 0, 0) == n);
+
+    unsigned head = *u->cq_head;
+    assert(__atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - head == n);
+    for (i = 0; i != n; ++i)
+        res[i] = u->cqes[(head + i) & *u->cq_mask].res;
+    __atomic_store_n(u->cq_head, head + n, __ATOMIC_RELEASE);
+}
+#endif
+
+/* Threaded MPMC tests. */
+#define MPMC_TEST_THREADS 3
+#define MPMC_TEST_MESSAGES (1 << 15)
+
+atomic_size_t mpmc_popped;
+atomic_size_t mpmc_sum[MPMC_TEST_THREADS];
+
+/*
+ * MPMC producer thread: push MPMC_TEST_MESSAGES messages, each
+ * consisting of the producer's id and a sequence number.
+ */
+void *
+mpmc_producer(void *arg)
+{
+    ringbuf_mpmc_t q = ((void **) arg)[0];
+    size_t id = (size_t) ((void **) arg)[1];
+    size_t seq;
+    for (seq = 0; seq != MPMC_TEST_MESSAGES; ) {
+        size_t msg[2] = { id, seq };
+        if (ringbuf_mpmc_try_push(q, msg, sizeof(msg)))
+            ++seq;
+        else
+            sched_yield();
+    }
+    return 0;
+}
+
+/*
+ * MPMC consumer thread: pop messages until all producers' messages
+ * have been popped, checking that each producer's messages arrive in
+ * order, and summing the sequence numbers per producer.
+ */
+void *
+mpmc_consumer(void *arg)
+{
+    ringbuf_mpmc_t q = arg;
+    size_t last[MPMC_TEST_THREADS];
+    size_t i;
+    for (i = 0; i != MPMC_TEST_THREADS; ++i)
+        last[i] = SIZE_MAX;
+    while (atomic_load(&mpmc_popped) !=
+           MPMC_TEST_THREADS * MPMC_TEST_MESSAGES) {
+        size_t msg[2], len;
+        if (!ringbuf_mpmc_try_pop(msg, q, &len)) {
+            sched_yield();
+            continue;
+        }
+        assert(len == sizeof(msg));
+        assert(msg[0] < MPMC_TEST_THREADS);
+        assert(last[msg[0]] == SIZE_MAX || msg[1] > last[msg[0]]);
+        last[msg[0]] = msg[1];
+        atomic_fetch_add(&mpmc_sum[msg[0]], msg[1]);
+        atomic_fetch_add(&mpmc_popped, 1);
+    }
+    return 0;
+}
+
+/*
+ * Return the POOL_TEST_RINGS ring buffers in the array arg to their
+ * pool from a thread other than the pool's owner.
+ */
+#define POOL_TEST_RINGS 8
+
+void *
+pool_remote_free(void *arg)
+{
+    ringbuf_t *rbs = arg;
+    size_t i;
+    for (i = 0; i != POOL_TEST_RINGS; ++i) {
+        ringbuf_free(&rbs[i]);
+        assert(!rbs[i]);
+    }
+    return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -2197,6 +2484,2113 @@ main(int argc, char **argv)
     
     ringbuf_free(&rb1);
     ringbuf_free(&rb2);
+
+    /* SPSC ring buffers */
+    rb1 = ringbuf_new_spsc(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+
+    START_NEW_TEST(test_num);
+    assert(ringbuf_is_spsc(rb1));
+    assert(ringbuf_buffer_size(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE - 1);
+    assert(ringbuf_bytes_free(rb1) == ringbuf_capacity(rb1));
+    assert(ringbuf_bytes_used(rb1) == 0);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    END_TEST(test_num);
+
+    /* SPSC memcpy_into never overflows */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE) == ringbuf_head(rb1));
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + RINGBUF_SIZE - 1);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(memcmp(ringbuf_tail(rb1), buf, RINGBUF_SIZE - 1) == 0);
+    assert(ringbuf_memcpy_into(rb1, buf, 1) == ringbuf_head(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + RINGBUF_SIZE - 1);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    END_TEST(test_num);
+
+    /* SPSC memset never overflows */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, 10) == ringbuf_head(rb1));
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE) == RINGBUF_SIZE - 11);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_memset(rb1, 1, 1) == 0);
+    END_TEST(test_num);
+
+    /* SPSC read never overflows */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_memcpy_into(rb1, buf, 16) == ringbuf_head(rb1));
+    assert(ringbuf_memcpy_from(dst, rb1, 8) == ringbuf_tail(rb1));
+    assert(ringbuf_read(rdfd, rb1, RINGBUF_SIZE) == RINGBUF_SIZE - 16);
+    assert(ringbuf_head(rb1) == rb1_base);
+    assert(ringbuf_read(rdfd, rb1, RINGBUF_SIZE) == 7);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + 8);
+    assert(lseek(rdfd, 0, SEEK_CUR) == RINGBUF_SIZE - 9);
+    END_TEST(test_num);
+
+    /* SPSC copy never overflows dst */
+    START_NEW_TEST(test_num);
+    rb2 = ringbuf_new(RINGBUF_SIZE - 1);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE - 9) == ringbuf_head(rb1));
+    assert(ringbuf_memcpy_into(rb2, buf2, 16) == ringbuf_head(rb2));
+    assert(ringbuf_copy(rb1, rb2, 16) == ringbuf_head(rb1));
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_bytes_used(rb2) == 8);
+    assert(memcmp(rb1_base + RINGBUF_SIZE - 9, buf2, 8) == 0);
+    ringbuf_free(&rb2);
+    END_TEST(test_num);
+
+    /* SPSC with concurrent producer and consumer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    pthread_t producer;
+    assert(pthread_create(&producer, 0, spsc_producer, rb1) == 0);
+    size_t nreceived = 0;
+    while (nreceived != SPSC_TEST_BYTES) {
+        size_t n = MIN(ringbuf_bytes_used(rb1), 509);
+        if (n == 0)
+            sched_yield();
+        assert(ringbuf_memcpy_from(dst, rb1, n) == ringbuf_tail(rb1));
+        size_t i;
+        for (i = 0; i != n; ++i)
+            assert(dst[i] == (uint8_t) (nreceived + i));
+        nreceived += n;
+    }
+    assert(pthread_join(producer, 0) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* Power-of-two ring buffers */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(24, RINGBUF_POW2);
+    assert(ringbuf_buffer_size(rb1) == 32);
+    assert(ringbuf_capacity(rb1) == 32);
+    assert(ringbuf_is_empty(rb1));
+    assert(((uintptr_t) ringbuf_head(rb1)) % 64 == 0);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_POW2);
+    rb1_base = ringbuf_head(rb1);
+
+    START_NEW_TEST(test_num);
+    assert(!ringbuf_is_spsc(rb1));
+    assert(ringbuf_buffer_size(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_bytes_free(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_bytes_used(rb1) == 0);
+    assert(ringbuf_is_empty(rb1));
+    assert(((uintptr_t) rb1_base) % 4096 == 0);
+    END_TEST(test_num);
+
+    /* power-of-two ring buffers use every byte of the buffer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE) == ringbuf_head(rb1));
+    assert(ringbuf_is_full(rb1));
+    assert(!ringbuf_is_empty(rb1));
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_head(rb1) == rb1_base);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE) == ringbuf_tail(rb1));
+    assert(memcmp(dst, buf, RINGBUF_SIZE) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    /* power-of-two overflow */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, 8) == ringbuf_head(rb1));
+    assert(ringbuf_memcpy_into(rb1, buf2, RINGBUF_SIZE - 4) == ringbuf_head(rb1));
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + 4);
+    assert(ringbuf_tail(rb1) == rb1_base + 4);
+    assert(memcmp(ringbuf_tail(rb1), buf + 4, 4) == 0);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE) == ringbuf_tail(rb1));
+    assert(memcmp(dst, buf + 4, 4) == 0);
+    assert(memcmp(dst + 4, buf2, RINGBUF_SIZE - 4) == 0);
+    assert(ringbuf_memset(rb1, 3, RINGBUF_SIZE * 2) == RINGBUF_SIZE);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + 4);
+    END_TEST(test_num);
+
+    /* power-of-two wrap, findchr and copy */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    rb2 = ringbuf_new_ex(RINGBUF_SIZE / 2, RINGBUF_POW2);
+    assert(ringbuf_memset(rb1, 'x', RINGBUF_SIZE - 2) == RINGBUF_SIZE - 2);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 2) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_into(rb1, "abcdefgh", 8) == rb1_base + 6);
+    assert(ringbuf_bytes_used(rb1) == 8);
+    assert(ringbuf_findchr(rb1, 'b', 0) == 1);
+    assert(ringbuf_findchr(rb1, 'c', 0) == 2);
+    assert(ringbuf_findchr(rb1, 'h', 3) == 7);
+    assert(ringbuf_findchr(rb1, 'x', 0) == 8);
+    assert(ringbuf_memcpy_into(rb2, "0123", 4) == ringbuf_head(rb2));
+    assert(ringbuf_copy(rb2, rb1, 8) == ringbuf_head(rb2));
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_bytes_used(rb2) == 12);
+    assert(ringbuf_memcpy_from(dst, rb2, 12) == ringbuf_tail(rb2));
+    assert(memcmp(dst, "0123abcdefgh", 12) == 0);
+    ringbuf_free(&rb2);
+    END_TEST(test_num);
+
+    /* power-of-two ringbuf_read and ringbuf_write across the wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 16) == RINGBUF_SIZE - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 16) == ringbuf_tail(rb1));
+    assert(ringbuf_read(rdfd, rb1, 32) == 16); /* short count */
+    assert(ringbuf_read(rdfd, rb1, 16) == 16);
+    assert(ringbuf_bytes_used(rb1) == 32);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(ftruncate(wrfd, 0) == 0);
+    assert(ringbuf_write(wrfd, rb1, 32) == 16); /* short count */
+    assert(ringbuf_write(wrfd, rb1, 16) == 16);
+    assert(ringbuf_is_empty(rb1));
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(read(wrfd, dst, 32) == 32);
+    assert(memcmp(dst, buf, 32) == 0);
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* power-of-two SPSC with concurrent producer and consumer */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_SPSC | RINGBUF_POW2);
+    assert(ringbuf_is_spsc(rb1));
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE);
+    assert(pthread_create(&producer, 0, spsc_producer, rb1) == 0);
+    nreceived = 0;
+    while (nreceived != SPSC_TEST_BYTES) {
+        size_t n = MIN(ringbuf_bytes_used(rb1), 509);
+        if (n == 0)
+            sched_yield();
+        assert(ringbuf_memcpy_from(dst, rb1, n) == ringbuf_tail(rb1));
+        size_t i;
+        for (i = 0; i != n; ++i)
+            assert(dst[i] == (uint8_t) (nreceived + i));
+        nreceived += n;
+    }
+    assert(pthread_join(producer, 0) == 0);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* Mirrored ring buffers */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(24, RINGBUF_MIRRORED);
+    assert(ringbuf_is_mirrored(rb1));
+    assert(ringbuf_buffer_size(rb1) == (size_t) sysconf(_SC_PAGESIZE));
+    assert(ringbuf_capacity(rb1) == ringbuf_buffer_size(rb1));
+    assert(((uintptr_t) ringbuf_head(rb1)) % sysconf(_SC_PAGESIZE) == 0);
+    ringbuf_free(&rb1);
+    assert(!rb1);
+    END_TEST(test_num);
+
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_MIRRORED);
+    rb1_base = ringbuf_head(rb1);
+    size_t mirrored_size = ringbuf_buffer_size(rb1);
+    assert(mirrored_size >= RINGBUF_SIZE);
+
+    /* the used region is contiguous across the wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, mirrored_size - 3) == mirrored_size - 3);
+    assert(ringbuf_memcpy_from(dst, rb1, mirrored_size - 3) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_into(rb1, "abcdefgh", 8) == rb1_base + 5);
+    assert(ringbuf_tail(rb1) == rb1_base + mirrored_size - 3);
+    assert(memcmp(ringbuf_tail(rb1), "abcdefgh", 8) == 0);
+    assert(memcmp(rb1_base, "defgh", 5) == 0);
+    assert(ringbuf_findchr(rb1, 'g', 0) == 6);
+    assert(ringbuf_memcpy_from(dst, rb1, 8) == rb1_base + 5);
+    assert(memcmp(dst, "abcdefgh", 8) == 0);
+    END_TEST(test_num);
+
+    /* mirrored ringbuf_read and ringbuf_write don't stop at the wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_memset(rb1, 1, mirrored_size - 16) == mirrored_size - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, mirrored_size - 16) == ringbuf_tail(rb1));
+    assert(ringbuf_read(rdfd, rb1, 64) == 64);
+    assert(ringbuf_head(rb1) == rb1_base + 48);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(ftruncate(wrfd, 0) == 0);
+    assert(ringbuf_write(wrfd, rb1, 64) == 64);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + 48);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(read(wrfd, dst, 64) == 64);
+    assert(memcmp(dst, buf, 64) == 0);
+    END_TEST(test_num);
+
+    /* mirrored overflow */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, 8) == ringbuf_head(rb1));
+    assert(ringbuf_memset(rb1, 2, mirrored_size) == mirrored_size);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + 8);
+    assert(ringbuf_tail(rb1) == rb1_base + 8);
+    END_TEST(test_num);
+
+    /*
+     * mirrored overflow by more than the buffer size, which must not
+     * write any byte through both mappings at once
+     */
+    START_NEW_TEST(test_num);
+    uint8_t *big = malloc(mirrored_size * 3);
+    for (size_t i = 0; i != mirrored_size * 3; ++i)
+        big[i] = (uint8_t) (i * 7 + i / 251);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, 8) == ringbuf_head(rb1));
+    assert(ringbuf_memcpy_into(rb1, big, mirrored_size * 3) == rb1_base + 8);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + 8);
+    assert(memcmp(ringbuf_tail(rb1), big + mirrored_size * 2,
+                  mirrored_size) == 0);
+    rb2 = ringbuf_new(mirrored_size * 3);
+    ringbuf_memcpy_into(rb2, big, mirrored_size * 3);
+    ringbuf_reset(rb1);
+    ringbuf_memcpy_into(rb1, buf, 8);
+    assert(ringbuf_copy(rb1, rb2, mirrored_size * 3) == rb1_base + 8);
+    assert(ringbuf_is_full(rb1) && ringbuf_is_empty(rb2));
+    assert(memcmp(ringbuf_tail(rb1), big + mirrored_size * 2,
+                  mirrored_size) == 0);
+    ringbuf_free(&rb2);
+    free(big);
+
+    /* ringbuf_read reads no more than the buffer size at once */
+    ringbuf_reset(rb1);
+    ringbuf_memcpy_into(rb1, buf, 8);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    ssize_t nread = ringbuf_read(rdfd, rb1, mirrored_size * 2);
+    assert(nread > 0 && (size_t) nread <= mirrored_size);
+    if ((size_t) nread + 8 < mirrored_size)
+        assert(ringbuf_bytes_used(rb1) == (size_t) nread + 8);
+    else
+        assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + (8 + nread) % mirrored_size);
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+
+    /* ringbuf_readv with zero count */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_readv(rdfd, rb1, 0) == 0);
+    assert(ringbuf_is_empty(rb1));
+    assert(lseek(rdfd, 0, SEEK_CUR) == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_readv across the wrap, in one call */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 16) == RINGBUF_SIZE - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 16) == ringbuf_tail(rb1));
+    assert(ringbuf_readv(rdfd, rb1, 64) == 64);
+    assert(ringbuf_bytes_used(rb1) == 64);
+    assert(ringbuf_head(rb1) == rb1_base + 48);
+    assert(ringbuf_tail(rb1) == rb1_base + RINGBUF_SIZE - 16);
+    assert(memcmp(ringbuf_tail(rb1), buf, 16) == 0);
+    assert(memcmp(rb1_base, buf + 16, 48) == 0);
+    assert(lseek(rdfd, 0, SEEK_CUR) == 64);
+    END_TEST(test_num);
+
+    /* ringbuf_readv, overflow */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_memset(rb1, 1, 8) == 8);
+    assert(ringbuf_readv(rdfd, rb1, RINGBUF_SIZE * 2) == RINGBUF_SIZE);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_head(rb1) == rb1_base + 8);
+    assert(ringbuf_tail(rb1) == rb1_base + 9);
+    assert(memcmp(ringbuf_tail(rb1), buf + 1, RINGBUF_SIZE - 9) == 0);
+    assert(lseek(rdfd, 0, SEEK_CUR) == RINGBUF_SIZE);
+    END_TEST(test_num);
+
+    /* ringbuf_writev across the wrap, in one call */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(ftruncate(wrfd, 0) == 0);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 16) == RINGBUF_SIZE - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 16) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_into(rb1, buf, 64) == ringbuf_head(rb1));
+    assert(ringbuf_writev(wrfd, rb1, 65) == 0); /* no underflow */
+    assert(ringbuf_writev(wrfd, rb1, 64) == 64);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + 48);
+    assert(lseek(wrfd, 0, SEEK_SET) == 0);
+    assert(read(wrfd, dst, 64) == 64);
+    assert(memcmp(dst, buf, 64) == 0);
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* SPSC ringbuf_readv never overflows */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_spsc(RINGBUF_SIZE - 1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 16) == RINGBUF_SIZE - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, 8) == ringbuf_tail(rb1));
+    assert(ringbuf_readv(rdfd, rb1, RINGBUF_SIZE) == 23);
+    assert(ringbuf_is_full(rb1));
+    assert(lseek(rdfd, 0, SEEK_CUR) == 23);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+    size_t span;
+
+    /* ringbuf_reserve/ringbuf_peek on an empty buffer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_reserve(rb1, &span) == rb1_base);
+    assert(span == RINGBUF_SIZE - 1);
+    assert(ringbuf_peek(rb1, &span) == rb1_base);
+    assert(span == 0);
+    assert(ringbuf_consume(rb1, 1) == 0);
+    assert(ringbuf_consume(rb1, 0) == rb1_base);
+    END_TEST(test_num);
+
+    /* ringbuf_reserve and ringbuf_commit */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    uint8_t *wp = ringbuf_reserve(rb1, &span);
+    memcpy(wp, buf, 10);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_commit(rb1, 10) == rb1_base + 10);
+    assert(ringbuf_bytes_used(rb1) == 10);
+    assert(ringbuf_commit(rb1, RINGBUF_SIZE - 10) == 0); /* no overflow */
+    assert(ringbuf_bytes_used(rb1) == 10);
+    assert(ringbuf_reserve(rb1, &span) == rb1_base + 10);
+    assert(span == RINGBUF_SIZE - 11);
+    assert(ringbuf_memcpy_from(dst, rb1, 10) == ringbuf_tail(rb1));
+    assert(memcmp(dst, buf, 10) == 0);
+    END_TEST(test_num);
+
+    /* reserve is limited to the contiguous free region */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 16) == RINGBUF_SIZE - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, 100) == ringbuf_tail(rb1));
+    assert(ringbuf_reserve(rb1, &span) == rb1_base + RINGBUF_SIZE - 16);
+    assert(span == 16);
+    assert(ringbuf_commit(rb1, 16) == rb1_base);
+    assert(ringbuf_reserve(rb1, &span) == rb1_base);
+    assert(span == 99);
+    assert(ringbuf_commit(rb1, 99) == rb1_base + 99);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_reserve(rb1, &span) == rb1_base + 99);
+    assert(span == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_peek and ringbuf_consume across the wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 16) == RINGBUF_SIZE - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 16) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_into(rb1, buf, 64) == ringbuf_head(rb1));
+    assert(ringbuf_peek(rb1, &span) == rb1_base + RINGBUF_SIZE - 16);
+    assert(span == 16);
+    assert(memcmp(ringbuf_peek(rb1, &span), buf, span) == 0);
+    assert(ringbuf_consume(rb1, 65) == 0); /* no underflow */
+    assert(ringbuf_consume(rb1, 16) == rb1_base);
+    assert(ringbuf_peek(rb1, &span) == rb1_base);
+    assert(span == 48);
+    assert(memcmp(ringbuf_peek(rb1, &span), buf + 16, span) == 0);
+    assert(ringbuf_consume(rb1, 48) == rb1_base + 48);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* mirrored reserve and peek span the wrap */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_MIRRORED);
+    rb1_base = ringbuf_head(rb1);
+    mirrored_size = ringbuf_buffer_size(rb1);
+    assert(ringbuf_memset(rb1, 1, mirrored_size - 16) == mirrored_size - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, mirrored_size - 32) == ringbuf_tail(rb1));
+    wp = ringbuf_reserve(rb1, &span);
+    assert(wp == rb1_base + mirrored_size - 16);
+    assert(span == mirrored_size - 16);
+    memcpy(wp, buf, 64);
+    assert(ringbuf_commit(rb1, 64) == rb1_base + 48);
+    assert(ringbuf_consume(rb1, 16) == rb1_base + mirrored_size - 16);
+    assert(ringbuf_peek(rb1, &span) == rb1_base + mirrored_size - 16);
+    assert(span == 64);
+    assert(memcmp(ringbuf_peek(rb1, &span), buf, 64) == 0);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+
+    /* ringbuf_memcpy_peek doesn't modify the ring buffer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memcpy_into(rb1, buf, 32) == ringbuf_head(rb1));
+    memset(dst, 0, 32);
+    assert(ringbuf_memcpy_peek(dst, rb1, 0, 32) == dst);
+    assert(memcmp(dst, buf, 32) == 0);
+    assert(ringbuf_memcpy_peek(dst, rb1, 5, 7) == dst);
+    assert(memcmp(dst, buf + 5, 7) == 0);
+    assert(ringbuf_memcpy_peek(dst, rb1, 32, 0) == dst);
+    assert(ringbuf_bytes_used(rb1) == 32);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_head(rb1) == rb1_base + 32);
+    END_TEST(test_num);
+
+    /* ringbuf_memcpy_peek won't read beyond the used bytes */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_memcpy_peek(dst, rb1, 0, 33) == 0);
+    assert(ringbuf_memcpy_peek(dst, rb1, 30, 3) == 0);
+    assert(ringbuf_memcpy_peek(dst, rb1, 33, 0) == 0);
+    assert(ringbuf_memcpy_peek(dst, rb1, 1, SIZE_MAX) == 0);
+    assert(ringbuf_bytes_used(rb1) == 32);
+    END_TEST(test_num);
+
+    /* ringbuf_memcpy_peek across the wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 16) == RINGBUF_SIZE - 16);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 16) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_into(rb1, buf, 64) == ringbuf_head(rb1));
+    assert(ringbuf_memcpy_peek(dst, rb1, 8, 32) == dst);
+    assert(memcmp(dst, buf + 8, 32) == 0);
+    assert(ringbuf_memcpy_peek(dst, rb1, 20, 44) == dst);
+    assert(memcmp(dst, buf + 20, 44) == 0);
+    assert(ringbuf_bytes_used(rb1) == 64);
+    assert(ringbuf_tail(rb1) == rb1_base + RINGBUF_SIZE - 16);
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+
+    /* ringbuf_findmem on an empty buffer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_findmem(rb1, "\r\n", 2, 0) == 0);
+    assert(ringbuf_findmem(rb1, "", 0, 0) == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_findmem, no wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    const char *http = "GET / HTTP/1.1\r\nHost: x\r\n\r\nbody";
+    assert(ringbuf_memcpy_into(rb1, http, strlen(http)) == ringbuf_head(rb1));
+    assert(ringbuf_findmem(rb1, "\r\n", 2, 0) == 14);
+    assert(ringbuf_findmem(rb1, "\r\n", 2, 14) == 14);
+    assert(ringbuf_findmem(rb1, "\r\n", 2, 15) == 23);
+    assert(ringbuf_findmem(rb1, "\r\n\r\n", 4, 0) == 23);
+    assert(ringbuf_findmem(rb1, "body", 4, 0) == 27);
+    assert(ringbuf_findmem(rb1, "body!", 5, 0) == strlen(http));
+    assert(ringbuf_findmem(rb1, "G", 1, 0) == 0);
+    assert(ringbuf_findmem(rb1, "G", 1, 1) == strlen(http));
+    assert(ringbuf_findmem(rb1, "", 0, 5) == 5);
+    assert(ringbuf_findmem(rb1, http, strlen(http), 0) == 0);
+    assert(ringbuf_findmem(rb1, http, strlen(http), 1) == strlen(http));
+    END_TEST(test_num);
+
+    /* ringbuf_findmem finds matches that straddle the wrap */
+    START_NEW_TEST(test_num);
+    size_t wrap_at;
+    for (wrap_at = 0; wrap_at <= 4; ++wrap_at) {
+        ringbuf_reset(rb1);
+        assert(ringbuf_memset(rb1, 'x', RINGBUF_SIZE - 8) == RINGBUF_SIZE - 8);
+        assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 8) == ringbuf_tail(rb1));
+        /* put "\r\n\r\n" wrap_at bytes before the end of the buffer */
+        assert(ringbuf_memset(rb1, 'y', 8 - wrap_at) == 8 - wrap_at);
+        assert(ringbuf_memcpy_into(rb1, "\r\n\r\n", 4) == ringbuf_head(rb1));
+        assert(ringbuf_memset(rb1, 'z', 8) == 8);
+        assert(ringbuf_findmem(rb1, "\r\n\r\n", 4, 0) == 8 - wrap_at);
+        assert(ringbuf_findmem(rb1, "\n\r\nz", 4, 0) == 9 - wrap_at);
+        assert(ringbuf_findmem(rb1, "\r\n\r\n", 4, 9 - wrap_at) == ringbuf_bytes_used(rb1));
+        assert(ringbuf_findmem(rb1, "yy\r", 3, 0) == 6 - wrap_at);
+        assert(ringbuf_findmem(rb1, "zzzzzzzz", 8, 0) == 12 - wrap_at);
+    }
+    END_TEST(test_num);
+
+    /* ringbuf_findmem agrees with a naive search */
+    START_NEW_TEST(test_num);
+    srand(1);
+    int trial;
+    for (trial = 0; trial != 2000; ++trial) {
+        size_t start = rand() % RINGBUF_SIZE;
+        size_t used = rand() % RINGBUF_SIZE;
+        size_t i;
+        ringbuf_reset(rb1);
+        assert(ringbuf_memset(rb1, 0, start) == start);
+        assert(ringbuf_memcpy_from(dst, rb1, start) == ringbuf_tail(rb1));
+        for (i = 0; i != used; ++i)
+            buf2[i] = "ab\r\n"[rand() % 4];
+        assert(ringbuf_memcpy_into(rb1, buf2, used) == ringbuf_head(rb1));
+        uint8_t needle[8];
+        size_t len = 1 + rand() % sizeof(needle);
+        for (i = 0; i != len; ++i)
+            needle[i] = "ab\r\n"[rand() % 4];
+        size_t offset = used ? rand() % used : 0;
+        assert(ringbuf_findmem(rb1, needle, len, offset) ==
+               naive_findmem(buf2, used, needle, len, offset));
+    }
+    fill_buffer(buf2, RINGBUF_SIZE * 2, test_pattern2);
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* ringbuf_findmem on a mirrored buffer */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_MIRRORED);
+    mirrored_size = ringbuf_buffer_size(rb1);
+    assert(ringbuf_memset(rb1, 'x', mirrored_size - 2) == mirrored_size - 2);
+    assert(ringbuf_memcpy_from(dst, rb1, mirrored_size - 4) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_into(rb1, "\r\n\r\n", 4) == ringbuf_head(rb1));
+    assert(ringbuf_findmem(rb1, "\r\n\r\n", 4, 0) == 2);
+    assert(ringbuf_findmem(rb1, "x\r\n\r\n", 5, 0) == 1);
+    assert(ringbuf_findmem(rb1, "x\r\n\r\n", 5, 2) == 6);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    rb1 = ringbuf_new(63);
+    rb1_base = ringbuf_head(rb1);
+    size_t reclen;
+
+    /* records: empty buffer */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_record_peek(rb1, &reclen) == 0);
+    assert(ringbuf_record_consume(rb1) == 0);
+    reclen = 64;
+    assert(ringbuf_record_pop(dst, rb1, &reclen) == 0);
+    assert(reclen == 0);
+    END_TEST(test_num);
+
+    /* records: push, peek and pop */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_record_push(rb1, "hello", 5) == rb1_base + 9);
+    assert(ringbuf_record_push(rb1, "", 0) == rb1_base + 13);
+    assert(ringbuf_record_push(rb1, "world!", 6) == rb1_base + 23);
+    assert(ringbuf_bytes_used(rb1) == 23);
+    const char *rec = ringbuf_record_peek(rb1, &reclen);
+    assert(reclen == 5);
+    assert(rec == (const char *) rb1_base + 4);
+    assert(memcmp(rec, "hello", 5) == 0);
+    assert(ringbuf_record_consume(rb1) == rb1_base + 9);
+    reclen = 64;
+    assert(ringbuf_record_pop(dst, rb1, &reclen) == rb1_base + 13);
+    assert(reclen == 0);
+    reclen = 5; /* too short */
+    assert(ringbuf_record_pop(dst, rb1, &reclen) == 0);
+    assert(reclen == 6);
+    assert(ringbuf_bytes_used(rb1) == 10);
+    assert(ringbuf_record_pop(dst, rb1, &reclen) == rb1_base + 23);
+    assert(reclen == 6);
+    assert(memcmp(dst, "world!", 6) == 0);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    /* records: no overflow, and too-large records are refused */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_record_push(rb1, buf, 60) == 0);
+    assert(ringbuf_record_push(rb1, buf, 59) == rb1_base + 63);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_record_push(rb1, buf, 0) == 0);
+    reclen = 64;
+    assert(ringbuf_record_pop(dst, rb1, &reclen) == rb1_base + 63);
+    assert(reclen == 59);
+    assert(memcmp(dst, buf, 59) == 0);
+    assert(ringbuf_record_push(rb1, buf, SIZE_MAX) == 0);
+    END_TEST(test_num);
+
+    /* records: explicit padding at the end of the buffer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_record_push(rb1, buf, 40) == rb1_base + 44);
+    assert(ringbuf_record_consume(rb1) == rb1_base + 44);
+    /* 20 bytes to the end of the buffer; this record needs 24 */
+    assert(ringbuf_record_push(rb1, buf2, 20) == rb1_base + 24);
+    assert(ringbuf_bytes_used(rb1) == 44);
+    rec = ringbuf_record_peek(rb1, &reclen);
+    assert(rec == (const char *) rb1_base + 4);
+    assert(reclen == 20);
+    assert(memcmp(rec, buf2, 20) == 0);
+    assert(ringbuf_record_consume(rb1) == rb1_base + 24);
+    assert(ringbuf_is_empty(rb1));
+    END_TEST(test_num);
+
+    /* records: implicit padding at the end of the buffer */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_record_push(rb1, buf, 57) == rb1_base + 61);
+    assert(ringbuf_record_consume(rb1) == rb1_base + 61);
+    /* 3 bytes to the end of the buffer, not enough for a header */
+    assert(ringbuf_record_push(rb1, buf2, 0) == rb1_base + 4);
+    assert(ringbuf_record_push(rb1, buf2, 6) == rb1_base + 14);
+    assert(ringbuf_record_peek(rb1, &reclen) == rb1_base + 4);
+    assert(reclen == 0);
+    assert(ringbuf_record_consume(rb1) == rb1_base + 4);
+    reclen = 64;
+    assert(ringbuf_record_pop(dst, rb1, &reclen) == rb1_base + 14);
+    assert(reclen == 6);
+    assert(memcmp(dst, buf2, 6) == 0);
+    END_TEST(test_num);
+
+    /* records: padding counts against free space */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_record_push(rb1, buf, 36) == rb1_base + 40);
+    assert(ringbuf_record_consume(rb1) == rb1_base + 40);
+    assert(ringbuf_record_push(rb1, buf, 38) == 0);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_record_push(rb1, buf, 30) == rb1_base + 34);
+    assert(ringbuf_bytes_used(rb1) == 58);
+    assert(ringbuf_record_push(rb1, buf2, 1) == rb1_base + 39);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_record_peek(rb1, &reclen) == rb1_base + 4);
+    assert(reclen == 30);
+    assert(ringbuf_record_consume(rb1) == rb1_base + 34);
+    assert(ringbuf_record_peek(rb1, &reclen) == rb1_base + 38);
+    assert(reclen == 1);
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* records on a mirrored buffer don't need padding */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_MIRRORED);
+    rb1_base = ringbuf_head(rb1);
+    mirrored_size = ringbuf_buffer_size(rb1);
+    assert(ringbuf_memset(rb1, 0, mirrored_size - 8) == mirrored_size - 8);
+    assert(ringbuf_memcpy_from(dst, rb1, mirrored_size - 8) == ringbuf_tail(rb1));
+    assert(ringbuf_record_push(rb1, buf, 16) == rb1_base + 12);
+    assert(ringbuf_record_peek(rb1, &reclen) == rb1_base + mirrored_size - 4);
+    assert(reclen == 16);
+    assert(memcmp(ringbuf_record_peek(rb1, &reclen), buf, 16) == 0);
+    assert(ringbuf_record_consume(rb1) == rb1_base + 12);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* fixed-size elements */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    uint32_t elems[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    uint32_t elems_out[8];
+    assert(ringbuf_elems_push(rb1, elems, 8, sizeof(uint32_t)) == 8);
+    assert(ringbuf_bytes_used(rb1) == 32);
+    assert(ringbuf_elems_pop(elems_out, rb1, 3, sizeof(uint32_t)) == 3);
+    assert(memcmp(elems_out, elems, 3 * sizeof(uint32_t)) == 0);
+    assert(ringbuf_elems_pop(elems_out, rb1, 8, sizeof(uint32_t)) == 5);
+    assert(memcmp(elems_out, elems + 3, 5 * sizeof(uint32_t)) == 0);
+    assert(ringbuf_elems_pop(elems_out, rb1, 8, sizeof(uint32_t)) == 0);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_memset(rb1, 1, 3);
+    assert(ringbuf_elems_pop(elems_out, rb1, 1, sizeof(uint32_t)) == 0);
+    assert(ringbuf_bytes_used(rb1) == 3);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* fixed-size elements never overflow */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new(30);
+    assert(ringbuf_elems_push(rb1, elems, 8, sizeof(uint32_t)) == 7);
+    assert(ringbuf_bytes_used(rb1) == 28);
+    assert(ringbuf_elems_push(rb1, elems, 8, sizeof(uint32_t)) == 0);
+    assert(ringbuf_elems_pop(elems_out, rb1, 2, sizeof(uint32_t)) == 2);
+    /* these wrap around the end of the buffer */
+    assert(ringbuf_elems_push(rb1, elems, 2, sizeof(uint32_t)) == 2);
+    assert(ringbuf_elems_pop(elems_out, rb1, 8, sizeof(uint32_t)) == 7);
+    assert(memcmp(elems_out, elems + 2, 5 * sizeof(uint32_t)) == 0);
+    assert(memcmp(elems_out + 5, elems, 2 * sizeof(uint32_t)) == 0);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* fixed-size elements in a power-of-two buffer are never split */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(32, RINGBUF_POW2);
+    assert(ringbuf_elems_push(rb1, elems, 8, sizeof(uint32_t)) == 8);
+    assert(ringbuf_elems_pop(elems_out, rb1, 3, sizeof(uint32_t)) == 3);
+    assert(ringbuf_elems_push(rb1, elems, 8, sizeof(uint32_t)) == 3);
+    assert(ringbuf_peek(rb1, &span) == (const uint8_t *) ringbuf_tail(rb1));
+    assert(span == 20);
+    assert(span % sizeof(uint32_t) == 0);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    rb1 = ringbuf_new(RINGBUF_SIZE - 1);
+    rb1_base = ringbuf_head(rb1);
+    struct iovec batch[4];
+
+    /* ringbuf_memcpy_into_batch */
+    START_NEW_TEST(test_num);
+    batch[0].iov_base = "abc";
+    batch[0].iov_len = 3;
+    batch[1].iov_base = "";
+    batch[1].iov_len = 0;
+    batch[2].iov_base = "defgh";
+    batch[2].iov_len = 5;
+    assert(ringbuf_memcpy_into_batch(rb1, batch, 0) == 0);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_memcpy_into_batch(rb1, batch, 3) == 3);
+    assert(ringbuf_bytes_used(rb1) == 8);
+    assert(ringbuf_head(rb1) == rb1_base + 8);
+    assert(memcmp(ringbuf_tail(rb1), "abcdefgh", 8) == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_memcpy_into_batch copies only whole buffers, across the wrap */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 4) == RINGBUF_SIZE - 4);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 14) == ringbuf_tail(rb1));
+    /* 10 bytes used, 4085 free */
+    batch[0].iov_base = buf;
+    batch[0].iov_len = 4000;
+    batch[1].iov_base = buf2;
+    batch[1].iov_len = 100;
+    batch[2].iov_base = "x";
+    batch[2].iov_len = 1;
+    assert(ringbuf_memcpy_into_batch(rb1, batch, 3) == 1);
+    assert(ringbuf_bytes_used(rb1) == 4010);
+    assert(ringbuf_memcpy_into_batch(rb1, batch + 2, 1) == 1);
+    assert(ringbuf_memcpy_from(dst, rb1, 10) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_from(dst, rb1, 4001) == ringbuf_tail(rb1));
+    assert(memcmp(dst, buf, 4000) == 0);
+    assert(dst[4000] == 'x');
+    END_TEST(test_num);
+
+    /* ringbuf_memcpy_from_batch */
+    START_NEW_TEST(test_num);
+    ringbuf_reset(rb1);
+    assert(ringbuf_memset(rb1, 1, RINGBUF_SIZE - 4) == RINGBUF_SIZE - 4);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 4) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_into(rb1, "0123456789", 10) == rb1_base + 6);
+    batch[0].iov_base = dst;
+    batch[0].iov_len = 3;
+    batch[1].iov_base = dst + 3;
+    batch[1].iov_len = 4;
+    batch[2].iov_base = dst + 7;
+    batch[2].iov_len = 4;
+    assert(ringbuf_memcpy_from_batch(batch, 0, rb1) == 0);
+    assert(ringbuf_bytes_used(rb1) == 10);
+    assert(ringbuf_memcpy_from_batch(batch, 3, rb1) == 2);
+    assert(memcmp(dst, "0123456", 7) == 0);
+    assert(ringbuf_bytes_used(rb1) == 3);
+    assert(ringbuf_tail(rb1) == rb1_base + 3);
+    assert(ringbuf_memcpy_from_batch(batch + 2, 1, rb1) == 0);
+    assert(ringbuf_bytes_used(rb1) == 3);
+    END_TEST(test_num);
+
+    ringbuf_free(&rb1);
+
+    /* SPSC records with concurrent producer and consumer */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_spsc(1000);
+    assert(pthread_create(&producer, 0, spsc_record_producer, rb1) == 0);
+    nreceived = 0;
+    while (nreceived != SPSC_TEST_RECORDS) {
+        const uint8_t *record = ringbuf_record_peek(rb1, &reclen);
+        if (!record) {
+            sched_yield();
+            continue;
+        }
+        assert(reclen == nreceived % 97);
+        size_t i;
+        for (i = 0; i != reclen; ++i)
+            assert(record[i] == (uint8_t) nreceived);
+        assert(ringbuf_record_consume(rb1));
+        ++nreceived;
+    }
+    assert(pthread_join(producer, 0) == 0);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* No-overwrite mode */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(16, RINGBUF_NOOVERWRITE);
+    rb1_base = ringbuf_head(rb1);
+    assert(!ringbuf_is_spsc(rb1));
+    assert(ringbuf_memcpy_into(rb1, buf, 10) == rb1_base + 10);
+    assert(ringbuf_memcpy_into(rb1, buf + 10, 10) == rb1_base + 16);
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_memset(rb1, 1, 10) == 0);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_read(rdfd, rb1, 10) == -1 && errno == ENOBUFS);
+    assert(ringbuf_readv(rdfd, rb1, 10) == -1 && errno == ENOBUFS);
+    assert(ringbuf_memcpy_from(dst, rb1, 16) == rb1_base + 16);
+    assert(memcmp(dst, buf, 16) == 0);
+    assert(ringbuf_memset(rb1, 1, 10) == 10);
+    assert(ringbuf_memset(rb1, 2, 10) == 6);
+    assert(ringbuf_tail(rb1) == rb1_base + 16);
+    rb2 = ringbuf_new(16);
+    ringbuf_memcpy_into(rb2, buf, 16);
+    assert(ringbuf_copy(rb1, rb2, 4) == ringbuf_head(rb1));
+    assert(ringbuf_bytes_used(rb2) == 16);
+    ringbuf_memcpy_from(dst, rb1, 4);
+    assert(ringbuf_copy(rb1, rb2, 8) == ringbuf_head(rb1));
+    assert(ringbuf_bytes_used(rb2) == 12);
+    assert(ringbuf_is_full(rb1));
+    ringbuf_free(&rb2);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* _nooverwrite variants on an ordinary ring buffer */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new(16);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_memcpy_into_nooverwrite(rb1, buf, 10) == 10);
+    assert(ringbuf_memcpy_into_nooverwrite(rb1, buf + 10, 10) == 6);
+    assert(ringbuf_memcpy_into_nooverwrite(rb1, buf, 10) == 0);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_memcpy_from(dst, rb1, 16) == rb1_base + 16);
+    assert(memcmp(dst, buf, 16) == 0);
+    assert(ringbuf_memset_nooverwrite(rb1, 1, 100) == 16);
+    assert(ringbuf_memset_nooverwrite(rb1, 1, 100) == 0);
+    ringbuf_reset(rb1);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_read_nooverwrite(rdfd, rb1, 12) == 12);
+    assert(ringbuf_read_nooverwrite(rdfd, rb1, 12) == 4);
+    errno = 0;
+    assert(ringbuf_read_nooverwrite(rdfd, rb1, 12) == -1 && errno == ENOBUFS);
+    assert(ringbuf_read_nooverwrite(rdfd, rb1, 0) == 0);
+    assert(ringbuf_tail(rb1) == rb1_base);
+    assert(ringbuf_memcpy_from(dst, rb1, 16) == rb1_base + 16);
+    assert(memcmp(dst, buf, 16) == 0);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_readv_nooverwrite(rdfd, rb1, 20) == 16);
+    assert(ringbuf_is_full(rb1));
+    errno = 0;
+    assert(ringbuf_readv_nooverwrite(rdfd, rb1, 20) == -1 && errno == ENOBUFS);
+    assert(ringbuf_memcpy_from(dst, rb1, 16));
+    assert(memcmp(dst, buf, 16) == 0);
+    /* Overwriting still works as before. */
+    assert(ringbuf_memcpy_into(rb1, buf, 20));
+    assert(ringbuf_is_full(rb1));
+    rb2 = ringbuf_new(16);
+    ringbuf_memcpy_into(rb2, buf, 8);
+    assert(ringbuf_copy_nooverwrite(rb1, rb2, 9) == 0);
+    assert(ringbuf_bytes_used(rb2) == 8);
+    assert(ringbuf_copy_nooverwrite(rb1, rb2, 8) == 0);
+    ringbuf_memcpy_from(dst, rb1, 5);
+    assert(ringbuf_copy_nooverwrite(rb1, rb2, 8) == 5);
+    assert(ringbuf_bytes_used(rb2) == 3);
+    assert(ringbuf_is_full(rb1));
+    ringbuf_memcpy_from(dst, rb1, 16);
+    assert(memcmp(dst + 11, buf, 5) == 0);
+    ringbuf_free(&rb2);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* ringbuf_recv */
+    START_NEW_TEST(test_num);
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    rb1 = ringbuf_new(16);
+    rb1_base = ringbuf_head(rb1);
+    assert(ringbuf_recv(sv[0], rb1, 16, MSG_DONTWAIT) == -1);
+    assert(errno == EAGAIN || errno == EWOULDBLOCK);
+    assert(write(sv[1], buf, 10) == 10);
+    assert(ringbuf_recv(sv[0], rb1, 8, MSG_PEEK) == 8);
+    assert(ringbuf_head(rb1) == rb1_base);
+    assert(ringbuf_is_empty(rb1));
+    assert(memcmp(rb1_base, buf, 8) == 0);
+    assert(ringbuf_recv(sv[0], rb1, 16, 0) == 10);
+    assert(ringbuf_head(rb1) == rb1_base + 10);
+    assert(ringbuf_memcpy_from(dst, rb1, 10) == rb1_base + 10);
+    assert(memcmp(dst, buf, 10) == 0);
+    /* Wraps the end of the buffer. */
+    assert(write(sv[1], buf + 10, 12) == 12);
+    assert(ringbuf_recv(sv[0], rb1, 12, MSG_DONTWAIT) == 12);
+    assert(ringbuf_head(rb1) == rb1_base + 5);
+    assert(ringbuf_memcpy_from(dst, rb1, 12) == rb1_base + 5);
+    assert(memcmp(dst, buf + 10, 12) == 0);
+    END_TEST(test_num);
+
+    /* ringbuf_send */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_send_pending(rb1) == 0);
+    assert(ringbuf_send(sv[0], rb1, 1, 0) == 0);
+    ringbuf_memcpy_into(rb1, buf, 14);
+    assert(ringbuf_send(sv[0], rb1, 15, 0) == 0);
+    assert(ringbuf_send(sv[0], rb1, 14, MSG_DONTWAIT) == 14);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_tail(rb1) == rb1_base + 2);
+    assert(read(sv[1], dst, 14) == 14);
+    assert(memcmp(dst, buf, 14) == 0);
+    assert(ringbuf_send_complete(sv[0], rb1) == 0);
+    ringbuf_free(&rb1);
+    close(sv[0]);
+    close(sv[1]);
+    END_TEST(test_num);
+
+    /* A full SPSC ring buffer can't be mistaken for end-of-file */
+    START_NEW_TEST(test_num);
+    int full_pipe[2];
+    assert(pipe(full_pipe) == 0);
+    assert(write(full_pipe[1], buf, 24) == 24);
+    rb1 = ringbuf_new_spsc(16);
+    assert(ringbuf_read(full_pipe[0], rb1, 24) == 16);
+    assert(ringbuf_is_full(rb1));
+    errno = 0;
+    assert(ringbuf_read(full_pipe[0], rb1, 8) == -1 && errno == ENOBUFS);
+    errno = 0;
+    assert(ringbuf_readv(full_pipe[0], rb1, 8) == -1 && errno == ENOBUFS);
+    assert(ringbuf_read(full_pipe[0], rb1, 0) == 0);
+    assert(ringbuf_memcpy_from(dst, rb1, 4));
+    assert(ringbuf_readv(full_pipe[0], rb1, 8) == 4);
+    assert(ringbuf_memcpy_from(dst + 4, rb1, 16));
+    assert(memcmp(dst, buf, 20) == 0);
+    ringbuf_free(&rb1);
+    close(full_pipe[0]);
+    close(full_pipe[1]);
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    assert(write(sv[1], buf, 24) == 24);
+    rb1 = ringbuf_new(16);
+    assert(ringbuf_memcpy_into(rb1, buf, 16));
+    errno = 0;
+    assert(ringbuf_recv(sv[0], rb1, 8, MSG_PEEK) == -1 && errno == ENOBUFS);
+    ringbuf_free(&rb1);
+    close(sv[0]);
+    close(sv[1]);
+    END_TEST(test_num);
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    /* ringbuf_send with MSG_ZEROCOPY */
+    START_NEW_TEST(test_num);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(lfd != -1);
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(lfd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+    assert(listen(lfd, 1) == 0);
+    assert(getsockname(lfd, (struct sockaddr *) &sin, &sinlen) == 0);
+    int cfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(connect(cfd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+    int afd = accept(lfd, 0, 0);
+    assert(afd != -1);
+    int one = 1;
+    if (setsockopt(cfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+        rb1 = ringbuf_new_ex(4096, RINGBUF_POW2);
+        ringbuf_memcpy_into(rb1, buf, 1000);
+        assert(ringbuf_send(cfd, rb1, 600, MSG_ZEROCOPY) == 600);
+        assert(ringbuf_bytes_used(rb1) == 1000);
+        assert(ringbuf_send_pending(rb1) == 600);
+
+        /* Ordinary sends queue up behind zero-copy sends. */
+        assert(ringbuf_send(cfd, rb1, 401, 0) == 0);
+        assert(ringbuf_send(cfd, rb1, 400, 0) == 400);
+        assert(ringbuf_bytes_used(rb1) == 1000);
+        assert(ringbuf_send_pending(rb1) == 1000);
+        assert(ringbuf_send(cfd, rb1, 1, 0) == 0);
+
+        size_t nread = 0;
+        while (nread != 1000) {
+            ssize_t n = read(afd, dst + nread, 1000 - nread);
+            assert(n > 0);
+            nread += n;
+        }
+        assert(memcmp(dst, buf, 1000) == 0);
+
+        size_t nreleased = 0;
+        while (nreleased != 1000) {
+            struct pollfd zpfd = { cfd, 0, 0 };
+            assert(poll(&zpfd, 1, 5000) == 1);
+            ssize_t n = ringbuf_send_complete(cfd, rb1);
+            assert(n >= 0);
+            nreleased += n;
+        }
+        assert(ringbuf_is_empty(rb1));
+        assert(ringbuf_send_pending(rb1) == 0);
+
+        /* Back to ordinary sends. */
+        ringbuf_memcpy_into(rb1, buf, 10);
+        assert(ringbuf_send(cfd, rb1, 10, 0) == 10);
+        assert(ringbuf_is_empty(rb1));
+        assert(read(afd, dst, 10) == 10);
+        assert(memcmp(dst, buf, 10) == 0);
+        ringbuf_free(&rb1);
+    }
+    close(afd);
+    close(cfd);
+    close(lfd);
+    END_TEST(test_num);
+#endif
+
+#if defined(__linux__)
+    /* Pass-through (splice) ring buffers */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(65536, RINGBUF_SPLICE);
+    assert(rb1);
+    assert(ringbuf_capacity(rb1) == 65536);
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    assert(lseek(rdfd, 0, SEEK_SET) == 0);
+    assert(ringbuf_splice_in(rdfd, rb1, RINGBUF_SIZE) == RINGBUF_SIZE);
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_splice_in(rdfd, rb1, RINGBUF_SIZE) == RINGBUF_SIZE);
+    assert(ringbuf_bytes_used(rb1) == 2 * RINGBUF_SIZE);
+    assert(ringbuf_splice_out(sv[0], rb1, 2 * RINGBUF_SIZE + 1) == 0);
+    assert(ringbuf_splice_out(sv[0], rb1, 100) == 100);
+    assert(ringbuf_bytes_used(rb1) == 2 * RINGBUF_SIZE - 100);
+    assert(ringbuf_splice_out(sv[0], rb1, 2 * RINGBUF_SIZE - 100) ==
+           2 * RINGBUF_SIZE - 100);
+    assert(ringbuf_is_empty(rb1));
+    nreceived = 0;
+    while (nreceived != 2 * RINGBUF_SIZE) {
+        ssize_t n = read(sv[1], dst + nreceived, 2 * RINGBUF_SIZE - nreceived);
+        assert(n > 0);
+        nreceived += n;
+    }
+    assert(memcmp(dst, buf, 2 * RINGBUF_SIZE) == 0);
+
+    /* Accounts bytes against the capacity: never overflows. */
+    int pfd2[2];
+    assert(pipe(pfd2) == 0);
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_ex(4096, RINGBUF_SPLICE);
+    assert(write(pfd2[1], buf, 4000) == 4000);
+    assert(write(pfd2[1], buf, 4000) == 4000);
+    nreceived = 0;
+    while (!ringbuf_is_full(rb1)) {
+        ssize_t n = ringbuf_splice_in(pfd2[0], rb1, 8000);
+        assert(n > 0);
+        nreceived += n;
+    }
+    assert(nreceived == 4096);
+    errno = 0;
+    assert(ringbuf_splice_in(pfd2[0], rb1, 8000) == -1 && errno == ENOBUFS);
+    ringbuf_reset(rb1);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_splice_in(pfd2[0], rb1, 8000) == 8000 - 4096);
+    assert(ringbuf_splice_out(sv[0], rb1, 8000 - 4096) == 8000 - 4096);
+    assert(read(sv[1], dst, 8000 - 4096) == 8000 - 4096);
+    assert(memcmp(dst, buf + 96, 8000 - 4096) == 0);
+    close(pfd2[0]);
+    close(pfd2[1]);
+    close(sv[0]);
+    close(sv[1]);
+    ringbuf_free(&rb1);
+
+    /* Only pass-through ring buffers support splicing. */
+    rb1 = ringbuf_new(16);
+    assert(ringbuf_splice_in(rdfd, rb1, 1) == -1 && errno == EINVAL);
+    assert(ringbuf_splice_out(wrfd, rb1, 0) == -1 && errno == EINVAL);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+#endif
+
+#if defined(HAVE_IO_URING)
+    /* io_uring SQE preparation */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new(16);
+    rb1_base = ringbuf_head(rb1);
+    struct io_uring_sqe sqes[2];
+    struct iovec rb_iov;
+    ringbuf_buffer_iovec(rb1, &rb_iov);
+    assert(rb_iov.iov_base == rb1_base && rb_iov.iov_len == 17);
+    assert(ringbuf_uring_prep_write(sqes, 2, 3, rb1, 10, -1) == 0);
+    assert(ringbuf_uring_prep_read(sqes, 2, 3, rb1, 0, -1) == 0);
+    assert(ringbuf_uring_prep_read(sqes, 2, 3, rb1, 100, -1) == 1);
+    assert(sqes[0].opcode == IORING_OP_READV && sqes[0].fd == 3);
+    assert(sqes[0].len == 1);
+    assert(((struct iovec *) (uintptr_t) sqes[0].addr)->iov_len == 16);
+    ringbuf_memcpy_into(rb1, buf, 10);
+    ringbuf_memcpy_from(dst, rb1, 10);
+    assert(ringbuf_uring_prep_read(sqes, 2, 3, rb1, 12, -1) == 1);
+    assert(sqes[0].len == 2);
+    assert(ringbuf_uring_prep_read(sqes, 2, 3, rb1, 12, 5) == 2);
+    assert(sqes[0].opcode == IORING_OP_READ_FIXED && sqes[0].buf_index == 5);
+    assert(sqes[0].addr == (uintptr_t) (rb1_base + 10) && sqes[0].len == 7);
+    assert(sqes[0].flags & IOSQE_IO_LINK);
+    assert(sqes[1].addr == (uintptr_t) rb1_base && sqes[1].len == 5);
+    assert(!(sqes[1].flags & IOSQE_IO_LINK));
+    assert(ringbuf_uring_prep_read(sqes, 1, 3, rb1, 12, 5) == 1);
+    assert(sqes[0].len == 7 && !(sqes[0].flags & IOSQE_IO_LINK));
+    assert(ringbuf_uring_complete_read(rb1, -EAGAIN) == -EAGAIN);
+    assert(ringbuf_is_empty(rb1));
+    assert(ringbuf_uring_complete_read(rb1, 7) == 7);
+    assert(ringbuf_bytes_used(rb1) == 7);
+    assert(ringbuf_uring_prep_write(sqes, 2, 4, rb1, 100, 5) == 1);
+    assert(sqes[0].opcode == IORING_OP_WRITE_FIXED && sqes[0].len == 7);
+    assert(ringbuf_uring_complete_write(rb1, 7) == 7);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* io_uring reads and writes */
+    START_NEW_TEST(test_num);
+    struct test_uring uring;
+    if (test_uring_init(&uring) == 0) {
+        int res[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        rb1 = ringbuf_new(16);
+        rb1_base = ringbuf_head(rb1);
+        ringbuf_buffer_iovec(rb1, &rb_iov);
+        assert(syscall(__NR_io_uring_register, uring.fd,
+                       IORING_REGISTER_BUFFERS, &rb_iov, 1) == 0);
+
+        /* readv across the end of the buffer */
+        ringbuf_memcpy_into(rb1, buf, 10);
+        ringbuf_memcpy_from(dst, rb1, 10);
+        assert(write(sv[1], buf, 12) == 12);
+        assert(ringbuf_uring_prep_read(uring.sqes, 2, sv[0], rb1, 12, -1) == 1);
+        test_uring_run(&uring, 1, res);
+        assert(ringbuf_uring_complete_read(rb1, res[0]) == 12);
+        assert(ringbuf_head(rb1) == rb1_base + 5);
+
+        /* fixed-buffer writes across the end of the buffer */
+        assert(ringbuf_uring_prep_write(uring.sqes, 2, sv[0], rb1, 12, 0) == 2);
+        test_uring_run(&uring, 2, res);
+        assert(ringbuf_uring_complete_write(rb1, res[0]) == 7);
+        assert(ringbuf_uring_complete_write(rb1, res[1]) == 5);
+        assert(ringbuf_is_empty(rb1));
+        assert(read(sv[1], dst, 12) == 12);
+        assert(memcmp(dst, buf, 12) == 0);
+
+        /* fixed-buffer reads across the end of the buffer */
+        assert(write(sv[1], buf + 100, 16) == 16);
+        assert(ringbuf_uring_prep_read(uring.sqes, 2, sv[0], rb1, 16, 0) == 2);
+        test_uring_run(&uring, 2, res);
+        assert(ringbuf_uring_complete_read(rb1, res[0]) == 12);
+        assert(ringbuf_uring_complete_read(rb1, res[1]) == 4);
+        assert(ringbuf_is_full(rb1));
+        assert(ringbuf_memcpy_from(dst, rb1, 16) == rb1_base + 4);
+        assert(memcmp(dst, buf + 100, 16) == 0);
+
+        ringbuf_free(&rb1);
+        close(sv[0]);
+        close(sv[1]);
+        close(uring.fd);
+    }
+    END_TEST(test_num);
+#endif
+
+    /* Shared ring buffers, attached by name */
+    START_NEW_TEST(test_num);
+    char shm_name[64];
+    snprintf(shm_name, sizeof(shm_name), "/ringbuf-test-%ld", (long) getpid());
+    rb1 = ringbuf_new_shm(shm_name, 3000, 0);
+    assert(rb1);
+    assert(ringbuf_is_spsc(rb1));
+    assert(ringbuf_capacity(rb1) == 4096);
+    assert(ringbuf_shm_fd(rb1) >= 0);
+    assert(!ringbuf_new_shm(shm_name, 3000, 0));
+    rb2 = ringbuf_attach_shm(shm_name);
+    assert(rb2);
+    assert(shm_unlink(shm_name) == 0);
+    assert(ringbuf_capacity(rb2) == 4096);
+    assert(ringbuf_is_spsc(rb2));
+    assert(ringbuf_head(rb2) != ringbuf_head(rb1));
+    ringbuf_memcpy_into(rb1, buf, 4000);
+    assert(ringbuf_bytes_used(rb2) == 4000);
+    assert(ringbuf_memcpy_from(dst, rb2, 3000) == ringbuf_tail(rb2));
+    assert(memcmp(dst, buf, 3000) == 0);
+    assert(ringbuf_bytes_free(rb1) == 3096);
+    ringbuf_memcpy_into(rb1, buf + 4000, 1000);
+    ringbuf_memcpy_from(dst, rb2, 2000);
+    assert(memcmp(dst, buf + 3000, 2000) == 0);
+    assert(ringbuf_is_empty(rb1) && ringbuf_is_empty(rb2));
+    ringbuf_free(&rb2);
+    ringbuf_free(&rb1);
+    assert(!ringbuf_attach_shm(shm_name));
+    assert(!ringbuf_attach_fd(rdfd));
+    assert(!ringbuf_new_shm(0, 100, RINGBUF_BLOCKING));
+    rb1 = ringbuf_new(10);
+    assert(ringbuf_shm_fd(rb1) == -1);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* Attaching to a shared ring buffer that already holds data */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_shm(0, 4096, 0);
+    assert(rb1);
+    ringbuf_memcpy_into(rb1, buf, 3000);
+    assert(ringbuf_memcpy_from(dst, rb1, 2900));
+    rb2 = ringbuf_attach_fd(ringbuf_shm_fd(rb1));
+    assert(rb2);
+    assert(ringbuf_bytes_used(rb2) == 100);
+    assert(ringbuf_memcpy_from(dst, rb2, 200) == 0);
+    assert(ringbuf_bytes_used(rb2) == 100);
+    assert(ringbuf_memcpy_from(dst, rb2, 50) == ringbuf_tail(rb2));
+    assert(memcmp(dst, buf + 2900, 50) == 0);
+    rb3 = ringbuf_attach_fd(ringbuf_shm_fd(rb1));
+    assert(rb3);
+    assert(ringbuf_bytes_free(rb3) == 4096 - 50);
+    assert(ringbuf_memcpy_into_nooverwrite(rb3, buf, 2 * RINGBUF_SIZE) ==
+           4096 - 50);
+    assert(ringbuf_is_full(rb1) && ringbuf_bytes_used(rb2) == 4096);
+    assert(ringbuf_memcpy_from(dst, rb2, 4096));
+    assert(memcmp(dst, buf + 2950, 50) == 0);
+    assert(memcmp(dst + 50, buf, 4096 - 50) == 0);
+    ringbuf_free(&rb3);
+    ringbuf_free(&rb2);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* Anonymous, mirrored shared ring buffer, with the producer in a
+       child process */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_shm(0, 1, RINGBUF_MIRRORED);
+    assert(rb1);
+    assert(ringbuf_is_mirrored(rb1));
+    pid_t child = fork();
+    assert(child != -1);
+    if (child == 0) {
+        ringbuf_t child_rb = ringbuf_attach_fd(ringbuf_shm_fd(rb1));
+        if (!child_rb || !ringbuf_is_mirrored(child_rb))
+            _exit(1);
+        spsc_producer(child_rb);
+        _exit(0);
+    }
+    nreceived = 0;
+    while (nreceived != SPSC_TEST_BYTES) {
+        size_t n = MIN(ringbuf_bytes_used(rb1), 509);
+        if (n == 0)
+            sched_yield();
+        const uint8_t *tail = ringbuf_tail(rb1);
+        size_t i;
+        for (i = 0; i != n; ++i)
+            assert(tail[i] == (uint8_t) (nreceived + i));
+        ringbuf_consume(rb1, n);
+        nreceived += n;
+    }
+    int status;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* Allocation options */
+    START_NEW_TEST(test_num);
+    struct ringbuf_opts opts;
+    ringbuf_opts_init(&opts);
+    assert(opts.flags == 0 && opts.hugepages == RINGBUF_HUGEPAGES_NONE);
+    assert(opts.numa_node == -1 && !opts.lock && !opts.prefault && !opts.mem);
+    rb1 = ringbuf_new_opts(100, &opts);
+    assert(ringbuf_capacity(rb1) == 100 && ringbuf_buffer_size(rb1) == 101);
+    ringbuf_free(&rb1);
+
+    /* External memory */
+    uint8_t ext[64];
+    opts.mem = ext;
+    opts.mem_size = 16;
+    assert(!ringbuf_new_opts(16, &opts));
+    opts.mem_size = 17;
+    rb1 = ringbuf_new_opts(16, &opts);
+    assert(ringbuf_head(rb1) == ext);
+    ringbuf_memcpy_into(rb1, buf, 16);
+    assert(memcmp(ext, buf, 16) == 0);
+    ringbuf_free(&rb1);
+    opts.flags = RINGBUF_POW2;
+    opts.mem_size = 16;
+    rb1 = ringbuf_new_opts(16, &opts);
+    assert(ringbuf_head(rb1) == ext && ringbuf_capacity(rb1) == 16);
+    ringbuf_free(&rb1);
+    opts.lock = 1;
+    opts.prefault = 1;
+    rb1 = ringbuf_new_opts(16, &opts);
+    assert(ringbuf_head(rb1) == ext);
+    ringbuf_free(&rb1);
+
+    /* Inconsistent options */
+    opts.lock = opts.prefault = 0;
+    opts.flags = RINGBUF_MIRRORED;
+    assert(!ringbuf_new_opts(16, &opts));
+    opts.flags = 0;
+    opts.numa_node = 0;
+    assert(!ringbuf_new_opts(16, &opts));
+    opts.numa_node = -1;
+    opts.hugepages = RINGBUF_HUGEPAGES_THP;
+    assert(!ringbuf_new_opts(16, &opts));
+    ringbuf_opts_init(&opts);
+    opts.flags = RINGBUF_MIRRORED;
+    opts.hugepages = RINGBUF_HUGEPAGES_2M;
+    errno = 0;
+    assert(!ringbuf_new_opts(16, &opts) && errno == EINVAL);
+    opts.hugepages = RINGBUF_HUGEPAGES_THP;
+    errno = 0;
+    assert(!ringbuf_new_opts(1 << 21, &opts) && errno == EINVAL);
+    END_TEST(test_num);
+
+    /* Transparent huge pages, locked and prefaulted memory */
+    START_NEW_TEST(test_num);
+    ringbuf_opts_init(&opts);
+    opts.flags = RINGBUF_POW2;
+    opts.hugepages = RINGBUF_HUGEPAGES_THP;
+    opts.prefault = 1;
+    rb1 = ringbuf_new_opts(1 << 22, &opts);
+    assert(rb1);
+    assert(((uintptr_t) ringbuf_head(rb1)) % (1 << 21) == 0);
+    assert(ringbuf_capacity(rb1) == 1 << 22);
+    ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE));
+    assert(memcmp(dst, buf, RINGBUF_SIZE) == 0);
+    ringbuf_free(&rb1);
+    ringbuf_opts_init(&opts);
+    opts.lock = 1;
+    rb1 = ringbuf_new_opts(RINGBUF_SIZE - 1, &opts);
+    assert(rb1);
+    assert(ringbuf_buffer_size(rb1) == RINGBUF_SIZE);
+    ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE - 1);
+    assert(ringbuf_is_full(rb1));
+    ringbuf_free(&rb1);
+    opts.flags = RINGBUF_MIRRORED;
+    rb1 = ringbuf_new_opts(RINGBUF_SIZE, &opts);
+    assert(rb1 && ringbuf_is_mirrored(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* NUMA binding and explicit huge pages, where the system supports
+       them */
+    START_NEW_TEST(test_num);
+    ringbuf_opts_init(&opts);
+    opts.numa_node = 0;
+    opts.prefault = 1;
+    rb1 = ringbuf_new_opts(RINGBUF_SIZE, &opts);
+    if (rb1) {
+        ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE);
+        assert(ringbuf_is_full(rb1));
+        ringbuf_free(&rb1);
+    }
+    opts.numa_node = RINGBUF_SIZE;
+    assert(!ringbuf_new_opts(RINGBUF_SIZE, &opts));
+    ringbuf_opts_init(&opts);
+    opts.hugepages = RINGBUF_HUGEPAGES_2M;
+    rb1 = ringbuf_new_opts(RINGBUF_SIZE, &opts);
+    if (rb1) {
+        assert(((uintptr_t) ringbuf_head(rb1)) % (1 << 21) == 0);
+        ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE);
+        assert(ringbuf_is_full(rb1));
+        ringbuf_free(&rb1);
+    }
+    END_TEST(test_num);
+
+    /* Caller-provided storage */
+    START_NEW_TEST(test_num);
+    assert(ringbuf_sizeof(100, 0) >= 101);
+    assert(ringbuf_sizeof(100, RINGBUF_POW2) >= 128);
+    assert(ringbuf_sizeof(100, RINGBUF_MIRRORED) == 0);
+    assert(ringbuf_sizeof(SIZE_MAX, 0) == 0);
+    assert(ringbuf_sizeof(SIZE_MAX - 16, RINGBUF_POW2) == 0);
+    size_t storage_size = ringbuf_sizeof(100, 0);
+    uint8_t *storage = malloc(storage_size + 1);
+    assert(!ringbuf_init(storage, storage_size - 1, 100, 0));
+    assert(!ringbuf_init(storage, storage_size, 100, RINGBUF_MIRRORED));
+    assert(!ringbuf_init(0, storage_size, 100, 0));
+
+    /* Deliberately misaligned storage */
+    rb1 = ringbuf_init(storage + 1, storage_size, 100, 0);
+    assert(rb1);
+    assert((uint8_t *) rb1 >= storage + 1);
+    assert((uintptr_t) rb1 % 64 == 0);
+    assert(ringbuf_capacity(rb1) == 100 && ringbuf_is_empty(rb1));
+    assert((const uint8_t *) ringbuf_head(rb1) > (uint8_t *) rb1);
+    assert((const uint8_t *) ringbuf_head(rb1) + ringbuf_buffer_size(rb1) <=
+           storage + 1 + storage_size);
+    fill_buffer(buf, RINGBUF_SIZE * 2, test_pattern);
+    assert(ringbuf_memcpy_into(rb1, buf, 150) == ringbuf_head(rb1));
+    assert(ringbuf_is_full(rb1));
+    assert(ringbuf_memcpy_from(dst, rb1, 100) == ringbuf_tail(rb1));
+    assert(memcmp(dst, buf + 50, 100) == 0);
+    ringbuf_free(&rb1);
+    assert(!rb1);
+    free(storage);
+
+    /* On the stack, with flags */
+    uint8_t stack_storage[1024];
+    assert(ringbuf_sizeof(256, RINGBUF_POW2 | RINGBUF_SPSC) <=
+           sizeof(stack_storage));
+    rb1 = ringbuf_init(stack_storage, sizeof(stack_storage), 256,
+                       RINGBUF_POW2 | RINGBUF_SPSC);
+    assert(rb1 && ringbuf_capacity(rb1) == 256);
+    assert(ringbuf_buffer_size(rb1) == 256 && ringbuf_is_spsc(rb1));
+    assert((uint8_t *) rb1 >= stack_storage &&
+           (const uint8_t *) ringbuf_head(rb1) + 256 <= stack_storage + sizeof(stack_storage));
+    assert(ringbuf_memcpy_into_nooverwrite(rb1, buf, 300) == 256);
+    assert(ringbuf_memcpy_into_nooverwrite(rb1, buf, 1) == 0);
+    assert(ringbuf_memcpy_from(dst, rb1, 256));
+    assert(memcmp(dst, buf, 256) == 0);
+    ringbuf_free(&rb1);
+#if defined(__linux__)
+    rb1 = ringbuf_init(stack_storage, sizeof(stack_storage), 256,
+                       RINGBUF_EVENTFD);
+    assert(rb1 && ringbuf_is_spsc(rb1) && ringbuf_eventfd(rb1) >= 0);
+    ringbuf_free(&rb1);
+#endif
+
+    /* ringbuf_new puts small buffers right after the ring buffer object */
+    rb1 = ringbuf_new(100);
+    assert((const uint8_t *) ringbuf_head(rb1) > (uint8_t *) rb1);
+    assert((const uint8_t *) ringbuf_head(rb1) <= (uint8_t *) rb1 + ringbuf_sizeof(100, 0));
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_ex(1 << 16, RINGBUF_POW2);
+    assert((uintptr_t) ringbuf_head(rb1) % sysconf(_SC_PAGESIZE) == 0);
+    ringbuf_free(&rb1);
+
+    /* Power-of-two buffers of a page or more are page-aligned here, too */
+    size_t page = sysconf(_SC_PAGESIZE);
+    storage_size = ringbuf_sizeof(2 * page, RINGBUF_POW2);
+    assert(storage_size >= 2 * page + page - 1);
+    storage = malloc(storage_size + 1);
+    rb1 = ringbuf_init(storage + 1, storage_size, 2 * page, RINGBUF_POW2);
+    assert(rb1 && (uintptr_t) rb1 % 64 == 0);
+    assert((uintptr_t) ringbuf_head(rb1) % page == 0);
+    assert((const uint8_t *) ringbuf_head(rb1) + ringbuf_buffer_size(rb1) <=
+           storage + 1 + storage_size);
+    assert(ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE) == ringbuf_head(rb1));
+    assert(ringbuf_bytes_used(rb1) == RINGBUF_SIZE);
+    assert(ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE));
+    assert(memcmp(dst, buf, RINGBUF_SIZE) == 0);
+    ringbuf_free(&rb1);
+    free(storage);
+    END_TEST(test_num);
+
+    /* Ring buffer pools */
+    START_NEW_TEST(test_num);
+    size_t pool_caps[] = { 1024, 64, 256 };
+    size_t pool_counts[] = { 1, POOL_TEST_RINGS, 2 };
+    assert(!ringbuf_pool_new(pool_caps, pool_counts, 0, 0, 0));
+    assert(!ringbuf_pool_new(pool_caps, pool_counts, 3, RINGBUF_MIRRORED, 0));
+    ringbuf_pool_t pool = ringbuf_pool_new(pool_caps, pool_counts, 3, 0, 0);
+    assert(pool);
+    ringbuf_t pooled[POOL_TEST_RINGS];
+    size_t k;
+    for (k = 0; k != POOL_TEST_RINGS; ++k) {
+        pooled[k] = ringbuf_pool_get(pool, 10);
+        assert(pooled[k] && ringbuf_capacity(pooled[k]) == 64);
+        assert(ringbuf_is_empty(pooled[k]));
+        assert(k == 0 || pooled[k] > pooled[k - 1]);
+    }
+
+    /* The smallest class is exhausted, so the next one up is used. */
+    rb1 = ringbuf_pool_get(pool, 10);
+    assert(rb1 && ringbuf_capacity(rb1) == 256);
+    rb2 = ringbuf_pool_get(pool, 200);
+    assert(rb2 && ringbuf_capacity(rb2) == 256);
+    rb3 = ringbuf_pool_get(pool, 256);
+    assert(rb3 && ringbuf_capacity(rb3) == 1024);
+    assert(!ringbuf_pool_get(pool, 1));
+    assert(!ringbuf_pool_get(pool, 2048));
+
+    /* A ring buffer is reset when it's returned... */
+    fill_buffer(buf, RINGBUF_SIZE * 2, test_pattern);
+    ringbuf_memcpy_into(rb3, buf, 100);
+    ringbuf_t rb3_again = rb3;
+    ringbuf_free(&rb3);
+    assert(!rb3);
+    rb3 = ringbuf_pool_get(pool, 1000);
+    assert(rb3 == rb3_again && ringbuf_is_empty(rb3));
+    ringbuf_memcpy_into(rb3, buf, 1024);
+    assert(ringbuf_is_full(rb3));
+    ringbuf_memcpy_from(dst, rb3, 1024);
+    assert(memcmp(dst, buf, 1024) == 0);
+
+    /* ...and may be returned from another thread. */
+    for (k = 0; k != POOL_TEST_RINGS; ++k)
+        ringbuf_memcpy_into(pooled[k], buf, k + 1);
+    pthread_t pool_thread;
+    assert(pthread_create(&pool_thread, 0, pool_remote_free, pooled) == 0);
+    assert(pthread_join(pool_thread, 0) == 0);
+    ringbuf_t pooled_again[POOL_TEST_RINGS];
+    for (k = 0; k != POOL_TEST_RINGS; ++k) {
+        pooled_again[k] = ringbuf_pool_get(pool, 64);
+        assert(pooled_again[k] && ringbuf_capacity(pooled_again[k]) == 64);
+        assert(ringbuf_is_empty(pooled_again[k]));
+    }
+    assert(ringbuf_pool_get(pool, 64) == 0);
+    for (k = 0; k != POOL_TEST_RINGS; ++k)
+        ringbuf_free(&pooled_again[k]);
+    ringbuf_free(&rb1);
+    ringbuf_free(&rb2);
+    ringbuf_free(&rb3);
+    ringbuf_pool_free(&pool);
+    assert(!pool);
+
+    /* Lazy reset, and flags */
+    pool = ringbuf_pool_new(pool_caps, pool_counts, 1,
+                            RINGBUF_SPSC | RINGBUF_POW2, 1);
+    rb1 = ringbuf_pool_get(pool, 1);
+    assert(rb1 && ringbuf_is_spsc(rb1) && ringbuf_buffer_size(rb1) == 1024);
+    assert(!ringbuf_pool_get(pool, 1));
+    ringbuf_memcpy_into(rb1, buf, 10);
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_pool_get(pool, 1);
+    assert(rb1 && ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    ringbuf_pool_free(&pool);
+
+    /* Pooled power-of-two buffers of a page or more are page-aligned */
+    size_t aligned_caps[3] = {100, 2 * page, page};
+    size_t aligned_counts[3] = {3, 2, 3};
+    pool = ringbuf_pool_new(aligned_caps, aligned_counts, 3, RINGBUF_POW2, 0);
+    assert(pool);
+    for (k = 0; k != 8; ++k) {
+        pooled[k] = ringbuf_pool_get(pool, k < 3 ? 100 : page);
+        assert(pooled[k]);
+        size_t align = k < 3 ? 64 : page;
+        assert((uintptr_t) pooled[k] % 64 == 0);
+        assert((uintptr_t) ringbuf_head(pooled[k]) % align == 0);
+        assert(ringbuf_memcpy_into(pooled[k], buf, 100));
+    }
+    assert(!ringbuf_pool_get(pool, 1));
+    for (k = 0; k != 8; ++k) {
+        assert(ringbuf_memcpy_from(dst, pooled[k], 100));
+        assert(memcmp(dst, buf, 100) == 0);
+        ringbuf_free(&pooled[k]);
+    }
+    ringbuf_pool_free(&pool);
+#if defined(__linux__)
+    pool = ringbuf_pool_new(pool_caps, pool_counts, 3, RINGBUF_EVENTFD, 0);
+    rb1 = ringbuf_pool_get(pool, 100);
+    assert(rb1 && ringbuf_eventfd(rb1) >= 0);
+    ringbuf_free(&rb1);
+    ringbuf_pool_free(&pool);
+#endif
+    END_TEST(test_num);
+
+    /* Resizing, with wrapped contents */
+    START_NEW_TEST(test_num);
+    fill_buffer(buf, RINGBUF_SIZE * 2, test_pattern);
+    rb1 = ringbuf_new(100);
+    ringbuf_memcpy_into(rb1, buf, 80);
+    ringbuf_memcpy_from(dst, rb1, 60);
+    ringbuf_memcpy_into(rb1, buf + 80, 70);
+    assert(ringbuf_bytes_used(rb1) == 90);
+    assert(!ringbuf_resize(rb1, 89));
+    assert(ringbuf_capacity(rb1) == 100 && ringbuf_bytes_used(rb1) == 90);
+    assert(ringbuf_resize(rb1, 1000));
+    assert(ringbuf_capacity(rb1) == 1000 && ringbuf_bytes_used(rb1) == 90);
+    assert(ringbuf_tail(rb1) == (const uint8_t *) ringbuf_head(rb1) - 90);
+    ringbuf_memcpy_into(rb1, buf + 150, 900);
+    assert(ringbuf_bytes_used(rb1) == 990);
+    ringbuf_memcpy_from(dst, rb1, 990);
+    assert(memcmp(dst, buf + 60, 990) == 0);
+    ringbuf_memcpy_into(rb1, buf, 50);
+    assert(ringbuf_resize(rb1, 50));
+    assert(ringbuf_is_full(rb1));
+    ringbuf_memcpy_from(dst, rb1, 50);
+    assert(memcmp(dst, buf, 50) == 0);
+    ringbuf_free(&rb1);
+
+    rb1 = ringbuf_new_ex(64, RINGBUF_POW2);
+    ringbuf_memcpy_into(rb1, buf, 60);
+    ringbuf_memcpy_from(dst, rb1, 50);
+    ringbuf_memcpy_into(rb1, buf + 60, 40);
+    assert(ringbuf_resize(rb1, 100));
+    assert(ringbuf_capacity(rb1) == 128 && ringbuf_bytes_used(rb1) == 50);
+    ringbuf_memcpy_from(dst, rb1, 50);
+    assert(memcmp(dst, buf + 50, 50) == 0);
+    ringbuf_free(&rb1);
+
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_MIRRORED);
+    ringbuf_memcpy_into(rb1, buf, RINGBUF_SIZE);
+    ringbuf_memcpy_from(dst, rb1, 100);
+    ringbuf_memcpy_into(rb1, buf, 50);
+    assert(ringbuf_resize(rb1, RINGBUF_SIZE * 2));
+    assert(ringbuf_capacity(rb1) == RINGBUF_SIZE * 2 && ringbuf_is_mirrored(rb1));
+    ringbuf_memcpy_from(dst, rb1, RINGBUF_SIZE - 50);
+    assert(memcmp(dst, buf + 100, RINGBUF_SIZE - 100) == 0);
+    assert(memcmp(dst + RINGBUF_SIZE - 100, buf, 50) == 0);
+    ringbuf_free(&rb1);
+
+    /* A locked, mirrored ring buffer is still locked after resizing */
+    ringbuf_opts_init(&opts);
+    opts.flags = RINGBUF_MIRRORED;
+    opts.lock = 1;
+    rb1 = ringbuf_new_opts(RINGBUF_SIZE, &opts);
+    assert(rb1);
+    ringbuf_memcpy_into(rb1, buf, 100);
+    if (ringbuf_resize(rb1, RINGBUF_SIZE * 4)) {
+        assert(ringbuf_is_mirrored(rb1) && ringbuf_bytes_used(rb1) == 100);
+#if defined(__linux__)
+        long locked = locked_bytes();
+        assert(locked == -1 ||
+               (size_t) locked >= 2 * ringbuf_buffer_size(rb1));
+#endif
+        assert(ringbuf_memcpy_from(dst, rb1, 100));
+        assert(memcmp(dst, buf, 100) == 0);
+    }
+    ringbuf_free(&rb1);
+
+    /* Ring buffers that can't be resized */
+    opts.flags = 0;
+    opts.mem = ext;
+    opts.mem_size = sizeof(ext);
+    opts.lock = opts.prefault = 0;
+    opts.hugepages = RINGBUF_HUGEPAGES_NONE;
+    opts.numa_node = -1;
+    rb1 = ringbuf_new_opts(16, &opts);
+    assert(!ringbuf_resize(rb1, 32) && !ringbuf_set_autogrow(rb1, 64));
+    ringbuf_free(&rb1);
+    rb1 = ringbuf_new_spsc(16);
+    assert(ringbuf_resize(rb1, 32) && ringbuf_capacity(rb1) == 32);
+    assert(!ringbuf_set_autogrow(rb1, 64));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* Automatic growth and shrinking */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new(16);
+    assert(!ringbuf_shrink(rb1));
+    assert(ringbuf_set_autogrow(rb1, 100));
+    assert(ringbuf_memcpy_into_nooverwrite(rb1, buf, 20) == 20);
+    assert(ringbuf_capacity(rb1) == 32);
+    ringbuf_memcpy_into(rb1, buf + 20, 20);
+    assert(ringbuf_capacity(rb1) == 64 && ringbuf_bytes_used(rb1) == 40);
+    assert(ringbuf_memset(rb1, 'x', 40) == 40);
+    assert(ringbuf_capacity(rb1) == 80 && ringbuf_is_full(rb1));
+    ringbuf_memcpy_into(rb1, buf + 40, 10);
+    assert(ringbuf_capacity(rb1) == 90 && ringbuf_is_full(rb1));
+
+    /* At the cap, the ring buffer overflows as usual. */
+    ringbuf_memcpy_into(rb1, buf + 50, 20);
+    assert(ringbuf_capacity(rb1) == 100 && ringbuf_is_full(rb1));
+    ringbuf_memcpy_from(dst, rb1, 100);
+    assert(memcmp(dst, buf + 10, 30) == 0);
+    assert(dst[30] == 'x' && dst[69] == 'x');
+    assert(memcmp(dst + 70, buf + 40, 30) == 0);
+
+    /* Shrink when idle, but never below the contents. */
+    ringbuf_memcpy_into(rb1, buf, 30);
+    assert(ringbuf_shrink(rb1));
+    assert(ringbuf_capacity(rb1) == 30 && ringbuf_is_full(rb1));
+    ringbuf_memcpy_from(dst, rb1, 20);
+    assert(ringbuf_shrink(rb1) && ringbuf_capacity(rb1) == 16);
+    assert(!ringbuf_shrink(rb1));
+    ringbuf_memcpy_from(dst, rb1, 10);
+    assert(memcmp(dst, buf + 20, 10) == 0);
+
+    /* Other producers grow the ring buffer too. */
+    int grow_pipe[2];
+    assert(pipe(grow_pipe) == 0);
+    assert(write(grow_pipe[1], buf, 100) == 100);
+    assert(ringbuf_read(grow_pipe[0], rb1, 200) == 100);
+    assert(ringbuf_capacity(rb1) == 100);
+    close(grow_pipe[0]);
+    close(grow_pipe[1]);
+    assert(ringbuf_set_autogrow(rb1, 0));
+    ringbuf_memcpy_into(rb1, buf, 10);
+    assert(ringbuf_capacity(rb1) == 100 && !ringbuf_shrink(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* Chained ring buffers */
+    START_NEW_TEST(test_num);
+    assert(!ringbuf_chain_new(0));
+    ringbuf_chain_t chain = ringbuf_chain_new(100);
+    assert(chain && ringbuf_chain_segment_size(chain) == 100);
+    assert(ringbuf_chain_is_empty(chain));
+    fill_buffer(buf, RINGBUF_SIZE * 2, test_pattern);
+    assert(ringbuf_chain_memcpy_into(chain, buf, 250) == 250);
+    assert(ringbuf_chain_bytes_used(chain) == 250);
+    assert(ringbuf_chain_memcpy_into(chain, buf + 250, 1000) == 1000);
+    assert(ringbuf_chain_bytes_used(chain) == 1250);
+    assert(!ringbuf_chain_memcpy_from(dst, chain, 1251));
+    assert(ringbuf_chain_memcpy_from(dst, chain, 150));
+    assert(memcmp(dst, buf, 150) == 0);
+    assert(ringbuf_chain_bytes_used(chain) == 1100);
+    assert(ringbuf_chain_memcpy_from(dst, chain, 1100));
+    assert(memcmp(dst, buf + 150, 1100) == 0);
+    assert(ringbuf_chain_is_empty(chain));
+
+    /* findchr across segment boundaries */
+    memset(dst, 'a', 300);
+    dst[99] = 'x';
+    dst[100] = 'y';
+    dst[250] = 'x';
+    ringbuf_chain_memcpy_into(chain, dst, 300);
+    assert(ringbuf_chain_findchr(chain, 'x', 0) == 99);
+    assert(ringbuf_chain_findchr(chain, 'y', 0) == 100);
+    assert(ringbuf_chain_findchr(chain, 'x', 100) == 250);
+    assert(ringbuf_chain_findchr(chain, 'x', 251) == 300);
+    assert(ringbuf_chain_findchr(chain, 'z', 0) == 300);
+    assert(ringbuf_chain_consume(chain, 250) == 250);
+    assert(ringbuf_chain_findchr(chain, 'x', 0) == 0);
+    assert(ringbuf_chain_consume(chain, 51) == 0);
+    ringbuf_chain_reset(chain);
+    assert(ringbuf_chain_is_empty(chain));
+
+    /* read and write */
+    int chain_pipe[2];
+    assert(pipe(chain_pipe) == 0);
+    assert(write(chain_pipe[1], buf, 1234) == 1234);
+    ringbuf_chain_memcpy_into(chain, buf, 30);
+    assert(ringbuf_chain_read(chain_pipe[0], chain, 2000) == 1234);
+    assert(ringbuf_chain_bytes_used(chain) == 1264);
+    assert(ringbuf_chain_write(chain_pipe[1], chain, 5000) == 1264);
+    assert(ringbuf_chain_is_empty(chain));
+    assert(read(chain_pipe[0], dst, 2000) == 1264);
+    assert(memcmp(dst, buf, 30) == 0);
+    assert(memcmp(dst + 30, buf, 1234) == 0);
+    close(chain_pipe[0]);
+    close(chain_pipe[1]);
+
+    /* Moving segments between chains */
+    ringbuf_chain_t chain2 = ringbuf_chain_new(100);
+    ringbuf_chain_memcpy_into(chain, buf, 50);
+    ringbuf_chain_consume(chain, 20);
+    ringbuf_chain_memcpy_into(chain, buf + 50, 400);
+    ringbuf_chain_memcpy_into(chain2, buf, 10);
+    assert(ringbuf_chain_copy(chain2, chain, 431) == 0);
+    assert(ringbuf_chain_copy(chain2, chain, 330) == 330);
+    assert(ringbuf_chain_bytes_used(chain) == 100);
+    assert(ringbuf_chain_bytes_used(chain2) == 340);
+    ringbuf_chain_memcpy_into(chain2, buf + 450, 5);
+    assert(ringbuf_chain_copy(chain2, chain, 100) == 100);
+    assert(ringbuf_chain_is_empty(chain));
+    assert(ringbuf_chain_memcpy_from(dst, chain2, 445));
+    assert(memcmp(dst, buf, 10) == 0);
+    assert(memcmp(dst + 10, buf + 20, 330) == 0);
+    assert(memcmp(dst + 340, buf + 450, 5) == 0);
+    assert(memcmp(dst + 345, buf + 350, 100) == 0);
+    ringbuf_chain_free(&chain2);
+
+    /* Different segment sizes fall back to copying */
+    chain2 = ringbuf_chain_new(64);
+    ringbuf_chain_memcpy_into(chain, buf, 500);
+    assert(ringbuf_chain_copy(chain2, chain, 500) == 500);
+    assert(ringbuf_chain_memcpy_from(dst, chain2, 500));
+    assert(memcmp(dst, buf, 500) == 0);
+    ringbuf_chain_free(&chain2);
+    ringbuf_chain_free(&chain);
+    assert(!chain);
+    END_TEST(test_num);
+
+    /* Transfers that trade buffers */
+    START_NEW_TEST(test_num);
+    fill_buffer(buf, RINGBUF_SIZE * 2, test_pattern);
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_POW2);
+    rb2 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_POW2);
+    ringbuf_memcpy_into(rb1, buf, 3000);
+    ringbuf_memcpy_from(dst, rb1, 2000);
+    ringbuf_memcpy_into(rb1, buf + 3000, 2000);
+    const uint8_t *rb1_buf = (const uint8_t *) ringbuf_head(rb1) - 904;
+    const uint8_t *rb2_buf = ringbuf_head(rb2);
+    assert(!ringbuf_transfer(rb2, rb1, 3001));
+
+    /* Everything, into an empty ring buffer */
+    assert(ringbuf_transfer(rb2, rb1, 3000) == ringbuf_head(rb2));
+    assert(ringbuf_is_empty(rb1) && ringbuf_bytes_used(rb2) == 3000);
+    assert(ringbuf_tail(rb2) == rb1_buf + 2000);
+    ringbuf_memcpy_from(dst, rb2, 3000);
+    assert(memcmp(dst, buf + 2000, 3000) == 0);
+
+    /* Most of it, with the rest copied back */
+    ringbuf_memcpy_into(rb1, buf, 1000);
+    assert(ringbuf_transfer(rb2, rb1, 900));
+    assert(ringbuf_bytes_used(rb1) == 100 && ringbuf_bytes_used(rb2) == 900);
+    assert(ringbuf_tail(rb2) == rb2_buf && ringbuf_tail(rb1) == rb1_buf);
+    ringbuf_memcpy_from(dst, rb1, 100);
+    assert(memcmp(dst, buf + 900, 100) == 0);
+
+    /* Everything, behind a little */
+    ringbuf_memcpy_into(rb1, buf + 1000, 3000);
+    assert(ringbuf_transfer(rb2, rb1, 3000));
+    assert(ringbuf_is_empty(rb1) && ringbuf_bytes_used(rb2) == 3900);
+    ringbuf_memcpy_from(dst, rb2, 3900);
+    assert(memcmp(dst, buf, 900) == 0);
+    assert(memcmp(dst + 900, buf + 1000, 3000) == 0);
+
+    /* Otherwise, it's a copy */
+    ringbuf_memcpy_into(rb1, buf, 100);
+    ringbuf_memcpy_into(rb2, buf + 100, 100);
+    assert(ringbuf_transfer(rb2, rb1, 50));
+    assert(ringbuf_bytes_used(rb1) == 50 && ringbuf_bytes_used(rb2) == 150);
+    ringbuf_memcpy_from(dst, rb2, 150);
+    assert(memcmp(dst, buf + 100, 100) == 0);
+    assert(memcmp(dst + 100, buf, 50) == 0);
+    ringbuf_free(&rb1);
+    ringbuf_free(&rb2);
+
+    rb1 = ringbuf_new(100);
+    rb2 = ringbuf_new(100);
+    ringbuf_memcpy_into(rb1, buf, 80);
+    assert(ringbuf_transfer(rb2, rb1, 80) == ringbuf_head(rb2));
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_memcpy_from(dst, rb2, 80);
+    assert(memcmp(dst, buf, 80) == 0);
+    ringbuf_free(&rb1);
+    ringbuf_free(&rb2);
+    END_TEST(test_num);
+
+    /* Statistics (only counted if ringbuf.c has RINGBUF_STATS) */
+    START_NEW_TEST(test_num);
+    struct ringbuf_stats stats;
+    int stats_pipe[2];
+    rb1 = ringbuf_new(100);
+    if (!ringbuf_stats_snapshot(rb1, &stats)) {
+        ringbuf_memcpy_into(rb1, buf, 200);
+        assert(!ringbuf_stats_snapshot(rb1, &stats));
+        assert(stats.bytes_in == 0 && stats.overflows == 0);
+        assert(stats.max_used == 0 && stats.wrap_splits == 0);
+    } else {
+        assert(stats.bytes_in == 0 && stats.bytes_out == 0);
+        assert(stats.max_used == 0);
+        ringbuf_memcpy_into(rb1, buf, 60);
+        ringbuf_memcpy_from(dst, rb1, 50);
+        ringbuf_memcpy_into(rb1, buf, 70);
+        ringbuf_stats_snapshot(rb1, &stats);
+        assert(stats.bytes_in == 130 && stats.bytes_out == 50);
+        assert(stats.max_used == 80 && stats.wrap_splits == 1);
+        assert(stats.overflows == 0 && stats.bytes_lost == 0);
+
+        /* Overflow, then a consumer read that wraps */
+        ringbuf_memcpy_into(rb1, buf, 30);
+        ringbuf_memcpy_from(dst, rb1, 100);
+        ringbuf_stats_snapshot(rb1, &stats);
+        assert(stats.bytes_in == 160 && stats.bytes_out == 150);
+        assert(stats.overflows == 1 && stats.bytes_lost == 10);
+        assert(stats.max_used == 100 && stats.wrap_splits == 2);
+
+        /* System calls, and reads and writes clamped by the wrap */
+        assert(pipe(stats_pipe) == 0);
+        assert(write(stats_pipe[1], buf, 30) == 30);
+        assert(ringbuf_read(stats_pipe[0], rb1, 60) == 30);
+        assert(ringbuf_write(stats_pipe[1], rb1, 30) == 30);
+        ringbuf_memcpy_into(rb1, buf, 20);
+        assert(ringbuf_write(stats_pipe[1], rb1, 20) == 12);
+        assert(ringbuf_writev(stats_pipe[1], rb1, 8) == 8);
+        ringbuf_stats_snapshot(rb1, &stats);
+        assert(stats.bytes_in == 210 && stats.bytes_out == 200);
+        assert(stats.wrap_splits == 3 && stats.syscalls == 4);
+        assert(stats.short_reads == 1 && stats.short_writes == 1);
+        close(stats_pipe[0]);
+        close(stats_pipe[1]);
+
+        ringbuf_stats_reset(rb1);
+        ringbuf_stats_snapshot(rb1, &stats);
+        assert(stats.bytes_in == 0 && stats.max_used == 0);
+        assert(stats.syscalls == 0 && stats.overflows == 0);
+    }
+    ringbuf_free(&rb1);
+
+    /* Nothing is ever lost in SPSC mode */
+    rb1 = ringbuf_new_spsc(100);
+    ringbuf_memcpy_into(rb1, buf, 200);
+    ringbuf_memcpy_into(rb1, buf, 200);
+    ringbuf_stats_snapshot(rb1, &stats);
+    assert(stats.overflows == 0 && stats.bytes_lost == 0);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* CRC32C, fused with copies in and out, and over ranges */
+    START_NEW_TEST(test_num);
+    uint32_t crc = 0;
+    assert(ringbuf_crc32c_update(0, "123456789", 9) == 0xe3069283);
+    assert(ringbuf_crc32c_update(ringbuf_crc32c_update(0, "1234", 4),
+                                 "56789", 5) == 0xe3069283);
+    assert(ringbuf_crc32c_update(0, "", 0) == 0);
+    rb1 = ringbuf_new(100);
+    ringbuf_memcpy_into(rb1, buf, 70);
+    ringbuf_memcpy_from(dst, rb1, 70);
+
+    /* Copy in across the wrap */
+    assert(ringbuf_memcpy_into_crc(rb1, buf, 60, &crc) == ringbuf_head(rb1));
+    assert(crc == ringbuf_crc32c_update(0, buf, 60));
+    assert(ringbuf_bytes_used(rb1) == 60);
+
+    /* Ranges, at logical offsets, and across the wrap */
+    crc = 0;
+    assert(ringbuf_crc32c(rb1, 0, 60, &crc));
+    assert(crc == ringbuf_crc32c_update(0, buf, 60));
+    crc = 0;
+    assert(ringbuf_crc32c(rb1, 17, 25, &crc));
+    assert(crc == ringbuf_crc32c_update(0, buf + 17, 25));
+    crc = 0;
+    assert(ringbuf_crc32c(rb1, 60, 0, &crc) && crc == 0);
+    assert(!ringbuf_crc32c(rb1, 50, 11, &crc) && crc == 0);
+    assert(!ringbuf_crc32c(rb1, 61, 0, &crc) && crc == 0);
+    assert(ringbuf_bytes_used(rb1) == 60);
+
+    /* Copy out in pieces, across the wrap */
+    crc = 0;
+    assert(ringbuf_memcpy_from_crc(dst, rb1, 25, &crc) == ringbuf_tail(rb1));
+    assert(ringbuf_memcpy_from_crc(dst + 25, rb1, 35, &crc) ==
+           ringbuf_tail(rb1));
+    assert(memcmp(dst, buf, 60) == 0);
+    assert(crc == ringbuf_crc32c_update(0, buf, 60));
+    assert(ringbuf_is_empty(rb1));
+
+    /* Underflow */
+    ringbuf_memcpy_into(rb1, buf, 10);
+    assert(ringbuf_memcpy_from_crc(dst, rb1, 11, &crc) == 0);
+    assert(crc == ringbuf_crc32c_update(0, buf, 60));
+    assert(ringbuf_bytes_used(rb1) == 10);
+
+    /* Overflow, which loses the oldest bytes but not the checksum */
+    crc = 0;
+    ringbuf_memcpy_into_crc(rb1, buf, 100, &crc);
+    assert(crc == ringbuf_crc32c_update(0, buf, 100));
+    crc = 0;
+    assert(ringbuf_bytes_used(rb1) == 100);
+    assert(ringbuf_crc32c(rb1, 1, 99, &crc));
+    assert(crc == ringbuf_crc32c_update(0, buf + 1, 99));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* Blocking ring buffers */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_BLOCKING);
+    assert(ringbuf_is_spsc(rb1));
+    assert(ringbuf_eventfd(rb1) == -1);
+    assert(!ringbuf_wait_readable(rb1, 1, 0));
+    assert(ringbuf_wait_readable(rb1, 0, 0));
+    assert(ringbuf_wait_writable(rb1, RINGBUF_SIZE, 0));
+    assert(!ringbuf_wait_writable(rb1, RINGBUF_SIZE + 1, -1));
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    assert(!ringbuf_wait_readable(rb1, 1, 20));
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    assert((t1.tv_sec - t0.tv_sec) * 1000 +
+           (t1.tv_nsec - t0.tv_nsec) / 1000000 >= 19);
+    ringbuf_memcpy_into(rb1, buf, 10);
+    assert(ringbuf_wait_readable(rb1, 10, -1));
+    assert(!ringbuf_wait_readable(rb1, 11, 1));
+    assert(!ringbuf_wait_writable(rb1, RINGBUF_SIZE - 9, 1));
+    ringbuf_free(&rb1);
+
+    /* Waiting on a non-blocking ring buffer fails, rather than hangs */
+    rb1 = ringbuf_new_spsc(RINGBUF_SIZE);
+    errno = 0;
+    assert(!ringbuf_wait_readable(rb1, 1, -1) && errno == EINVAL);
+    errno = 0;
+    assert(!ringbuf_wait_writable(rb1, 1, -1) && errno == EINVAL);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+    /* Blocking SPSC with concurrent producer and consumer */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_BLOCKING);
+    assert(pthread_create(&producer, 0, blocking_producer, rb1) == 0);
+    nreceived = 0;
+    while (nreceived != SPSC_TEST_BYTES) {
+        assert(ringbuf_wait_readable(rb1, 1, -1));
+        size_t n = MIN(ringbuf_bytes_used(rb1), 509);
+        assert(n != 0);
+        ringbuf_memcpy_from(dst, rb1, n);
+        size_t i;
+        for (i = 0; i != n; ++i)
+            assert(dst[i] == (uint8_t) (nreceived + i));
+        nreceived += n;
+    }
+    assert(pthread_join(producer, 0) == 0);
+    assert(ringbuf_is_empty(rb1));
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+
+#if defined(__linux__)
+    /* eventfd notification */
+    START_NEW_TEST(test_num);
+    rb1 = ringbuf_new_ex(RINGBUF_SIZE, RINGBUF_EVENTFD);
+    assert(ringbuf_is_spsc(rb1));
+    int efd = ringbuf_eventfd(rb1);
+    assert(efd >= 0);
+    eventfd_t events;
+    assert(eventfd_read(efd, &events) == -1 && errno == EAGAIN);
+    ringbuf_memcpy_into(rb1, buf, 5);
+    struct pollfd pfd = { efd, POLLIN, 0 };
+    assert(poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN));
+    assert(eventfd_read(efd, &events) == 0 && events == 1);
+    /* Not signalled when adding data to a non-empty ring buffer. */
+    ringbuf_memcpy_into(rb1, buf, 5);
+    assert(eventfd_read(efd, &events) == -1 && errno == EAGAIN);
+    ringbuf_memcpy_into(rb1, buf, 0);
+    assert(eventfd_read(efd, &events) == -1 && errno == EAGAIN);
+    ringbuf_memcpy_from(dst, rb1, 10);
+    ringbuf_memcpy_into(rb1, buf, 1);
+    assert(eventfd_read(efd, &events) == 0 && events == 1);
+    ringbuf_free(&rb1);
+    END_TEST(test_num);
+#endif
+
+    /* MPMC queue basics */
+    START_NEW_TEST(test_num);
+    ringbuf_mpmc_t q = ringbuf_mpmc_new(3, 16);
+    assert(ringbuf_mpmc_capacity(q) == 4);
+    assert(ringbuf_mpmc_slot_size(q) == 16);
+    assert(ringbuf_mpmc_size(q) == 0);
+    assert(!ringbuf_mpmc_try_pop(dst, q, &reclen));
+    assert(!ringbuf_mpmc_try_push(q, buf, 17));
+    assert(ringbuf_mpmc_try_push(q, "one", 3));
+    assert(ringbuf_mpmc_try_push(q, "", 0));
+    assert(ringbuf_mpmc_try_push(q, buf, 16));
+    assert(ringbuf_mpmc_try_push(q, "four", 4));
+    assert(ringbuf_mpmc_size(q) == 4);
+    assert(!ringbuf_mpmc_try_push(q, "five", 4));
+    assert(ringbuf_mpmc_try_pop(dst, q, &reclen));
+    assert(reclen == 3 && memcmp(dst, "one", 3) == 0);
+    assert(ringbuf_mpmc_try_push(q, "five", 4));
+    assert(ringbuf_mpmc_try_pop(dst, q, &reclen));
+    assert(reclen == 0);
+    assert(ringbuf_mpmc_try_pop(dst, q, &reclen));
+    assert(reclen == 16 && memcmp(dst, buf, 16) == 0);
+    assert(ringbuf_mpmc_try_pop(dst, q, &reclen));
+    assert(reclen == 4 && memcmp(dst, "four", 4) == 0);
+    assert(ringbuf_mpmc_try_pop(dst, q, &reclen));
+    assert(reclen == 4 && memcmp(dst, "five", 4) == 0);
+    assert(!ringbuf_mpmc_try_pop(dst, q, &reclen));
+    assert(ringbuf_mpmc_size(q) == 0);
+    ringbuf_mpmc_reset(q);
+    assert(ringbuf_mpmc_try_push(q, "x", 1));
+    ringbuf_mpmc_reset(q);
+    assert(!ringbuf_mpmc_try_pop(dst, q, &reclen));
+    ringbuf_mpmc_free(&q);
+    assert(!q);
+    END_TEST(test_num);
+
+    /* MPMC queue with concurrent producers and consumers */
+    START_NEW_TEST(test_num);
+    q = ringbuf_mpmc_new(64, 2 * sizeof(size_t));
+    pthread_t producers[MPMC_TEST_THREADS], consumers[MPMC_TEST_THREADS];
+    void *producer_args[MPMC_TEST_THREADS][2];
+    size_t t;
+    for (t = 0; t != MPMC_TEST_THREADS; ++t) {
+        producer_args[t][0] = q;
+        producer_args[t][1] = (void *) t;
+        assert(pthread_create(&producers[t], 0, mpmc_producer, producer_args[t]) == 0);
+        assert(pthread_create(&consumers[t], 0, mpmc_consumer, q) == 0);
+    }
+    for (t = 0; t != MPMC_TEST_THREADS; ++t) {
+        assert(pthread_join(producers[t], 0) == 0);
+        assert(pthread_join(consumers[t], 0) == 0);
+    }
+    for (t = 0; t != MPMC_TEST_THREADS; ++t)
+        assert(atomic_load(&mpmc_sum[t]) ==
+               (size_t) MPMC_TEST_MESSAGES * (MPMC_TEST_MESSAGES - 1) / 2);
+    assert(ringbuf_mpmc_size(q) == 0);
+    ringbuf_mpmc_free(&q);
+    END_TEST(test_num);
+
     free(buf);
     free(buf2);
     free(dst);
@@ -0,0 +1,387 @@
+/*
+ * ringbuf-test.cpp - unit tests for the C++ ring buffer templates.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "ringbuf.hpp"
+
+#define START_NEW_TEST(test_num) \
+    fprintf(stderr, "Test %d...", (++test_num));
+
+#define END_TEST(test_num) \
+    fprintf(stderr, "pass.\n");
+
+struct point
+{
+    int32_t x;
+    int32_t y;
+};
+
+template <typename T, std::size_t N>
+concept ring_buffer_ok = requires { typename ringbuf::RingBuffer<T, N>; };
+
+static_assert(ring_buffer_ok<point, 8>);
+static_assert(!ring_buffer_ok<point, 6>);
+static_assert(!ring_buffer_ok<std::string, 8>);
+static_assert(!std::is_copy_constructible_v<ringbuf::RingBuffer<int, 8>>);
+static_assert(std::is_nothrow_move_constructible_v<ringbuf::RingBuffer<int, 8>>);
+static_assert(ringbuf::RingBuffer<int, 8>::capacity() == 8);
+
+/*
+ * Counts live instances, to check that a Queue constructs and
+ * destroys its elements exactly once each.
+ */
+struct counted
+{
+    static inline int live = 0;
+    int value;
+
+    explicit counted(int v) noexcept : value(v)
+    {
+        ++live;
+    }
+
+    counted(counted &&other) noexcept : value(other.value)
+    {
+        ++live;
+    }
+
+    counted &operator=(counted &&other) noexcept = default;
+
+    ~counted()
+    {
+        --live;
+    }
+};
+
+template <typename T, std::size_t N>
+concept queue_ok = requires { typename ringbuf::Queue<T, N>; };
+
+static_assert(queue_ok<std::unique_ptr<int>, 8>);
+static_assert(queue_ok<std::string, 8>);
+static_assert(!queue_ok<std::string, 7>);
+static_assert(!std::is_move_constructible_v<ringbuf::Queue<std::string, 8>>);
+
+/*
+ * A coroutine that starts immediately and frees itself when it
+ * finishes, which is all the tests need to drive awaitable ring
+ * buffers.
+ */
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/* A single-threaded event loop. */
+struct event_loop
+{
+    std::deque<std::coroutine_handle<>> ready;
+    int posted = 0;
+
+    void
+    post(std::coroutine_handle<> h)
+    {
+        ready.push_back(h);
+        ++posted;
+    }
+
+    void
+    run()
+    {
+        while (!ready.empty()) {
+            std::coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+    }
+};
+
+static_assert(ringbuf::Executor<event_loop>);
+static_assert(!ringbuf::Executor<int>);
+
+using async_ints = ringbuf::RingBuffer<int, 4, true>;
+
+static task
+produce_ints(async_ints &ring, int rounds, bool &done)
+{
+    int next = 0;
+    for (int r = 0; r != rounds; ++r) {
+        co_await ring.writable(3);
+        int chunk[3] = {next, next + 1, next + 2};
+        assert(ring.push(chunk, 3) == 3);
+        next += 3;
+    }
+    done = true;
+}
+
+static task
+consume_ints(async_ints &ring, int rounds, int *out, bool &done)
+{
+    for (int r = 0; r != rounds; ++r) {
+        assert(co_await ring.readable(2));
+        assert(ring.pop(out + 2 * r, 2) == 2);
+    }
+    done = true;
+}
+
+using async_strings = ringbuf::Queue<std::string, 2, true>;
+
+static task
+produce_strings(async_strings &q, event_loop &loop, int count)
+{
+    for (int i = 0; i != count; ++i) {
+        co_await q.writable(1, loop);
+        assert(q.push(std::to_string(i)));
+    }
+}
+
+static task
+consume_strings(async_strings &q, event_loop &loop, int count, bool &done)
+{
+    assert(!co_await q.readable(3, loop));
+    for (int i = 0; i != count; ++i) {
+        co_await q.readable(1, loop);
+        assert(*q.pop() == std::to_string(i));
+    }
+    done = true;
+}
+
+#define SPSC_TEST_ELEMS (1 << 20)
+
+static ringbuf::RingBuffer<uint64_t, 64, true> async_q;
+static std::atomic<bool> async_done{false};
+
+static task
+consume_async(uint64_t count)
+{
+    uint64_t expected = 0;
+    while (expected != count) {
+        co_await async_q.readable(1);
+        uint64_t v;
+        while (async_q.pop(v))
+            assert(v == expected++);
+    }
+    async_done.store(true, std::memory_order_release);
+}
+
+int
+main()
+{
+    int test_num = 0;
+
+    START_NEW_TEST(test_num);
+    ringbuf::RingBuffer<point, 4> rb;
+    assert(rb.empty() && rb.size() == 0 && rb.free_space() == 4);
+    point p;
+    assert(!rb.pop(p) && !rb.peek(p));
+    for (int i = 0; i != 4; ++i)
+        assert(rb.push(point{i, -i}));
+    assert(rb.full() && !rb.push(point{9, 9}));
+    assert(rb.peek(p) && p.x == 0 && rb.size() == 4);
+    for (int i = 0; i != 3; ++i)
+        assert(rb.pop(p) && p.x == i && p.y == -i);
+    assert(rb.size() == 1);
+    END_TEST(test_num);
+
+    /* Bulk push and pop across the wrap point */
+    START_NEW_TEST(test_num);
+    point ps[6] = {{10, 0}, {11, 0}, {12, 0}, {13, 0}, {14, 0}, {15, 0}};
+    assert(rb.push(ps, 6) == 3 && rb.full());
+    point out[6];
+    assert(rb.pop(out, 6) == 4);
+    assert(out[0].x == 3 && out[1].x == 10 && out[3].x == 12);
+    assert(rb.empty() && rb.pop(out, 6) == 0);
+    END_TEST(test_num);
+
+    /* Moving */
+    START_NEW_TEST(test_num);
+    rb.push(ps, 3);
+    ringbuf::RingBuffer<point, 4> rb2(std::move(rb));
+    assert(rb.empty() && rb2.size() == 3);
+    rb = std::move(rb2);
+    assert(rb2.empty() && rb.size() == 3);
+    assert(rb.pop(p) && p.x == 10);
+    rb.clear();
+    assert(rb.empty());
+    END_TEST(test_num);
+
+    /* Interoperating with C byte ring buffers */
+    START_NEW_TEST(test_num);
+    ringbuf_t *crb = ringbuf_new(20);
+    ringbuf::RingBuffer<uint32_t, 8> words;
+    for (uint32_t i = 0; i != 8; ++i)
+        words.push(i);
+    assert(words.write_to(crb, 8) == 5);
+    assert(ringbuf_bytes_used(crb) == 20 && words.size() == 3);
+    uint32_t w;
+    assert(words.read_from(crb, 100) == 5 && words.full());
+    assert(ringbuf_is_empty(crb));
+    for (uint32_t i = 0; i != 8; ++i)
+        assert(words.pop(w) && w == (i + 5) % 8);
+    ringbuf_memcpy_into(crb, "abcdefg", 7);
+    assert(words.read_from(crb, 8) == 1 && ringbuf_bytes_used(crb) == 3);
+    assert(words.pop(w) && memcmp(&w, "abcd", 4) == 0);
+    ringbuf_free(&crb);
+    END_TEST(test_num);
+
+    /* Concurrent producer and consumer */
+    START_NEW_TEST(test_num);
+    static ringbuf::RingBuffer<uint64_t, 256> q;
+    std::thread producer([] {
+        uint64_t chunk[7];
+        uint64_t next = 0;
+        while (next != SPSC_TEST_ELEMS) {
+            std::size_t n = 0;
+            while (n != 7 && next + n != SPSC_TEST_ELEMS) {
+                chunk[n] = next + n;
+                ++n;
+            }
+            next += q.push(chunk, n);
+        }
+    });
+    uint64_t expected = 0;
+    while (expected != SPSC_TEST_ELEMS) {
+        uint64_t v;
+        if (q.pop(v))
+            assert(v == expected++);
+    }
+    producer.join();
+    assert(q.empty());
+    END_TEST(test_num);
+
+    /* Typed queues */
+    START_NEW_TEST(test_num);
+    {
+        ringbuf::Queue<counted, 4> cq;
+        assert(cq.empty() && !cq.pop() && !cq.front());
+        for (int i = 0; i != 4; ++i)
+            assert(cq.emplace(i));
+        assert(cq.full() && !cq.emplace(4));
+        assert(counted::live == 4);
+        assert(cq.front() && cq.front()->value == 0);
+        std::optional<counted> c = cq.pop();
+        assert(c && c->value == 0 && counted::live == 4);
+        c.reset();
+        assert(counted::live == 3);
+        counted c2(-1);
+        assert(cq.pop(c2) && c2.value == 1 && counted::live == 3);
+        assert(cq.push(counted(5)) && cq.size() == 3);
+        assert(counted::live == 4);
+        cq.clear();
+        assert(cq.empty() && counted::live == 1);
+        assert(cq.emplace(6) && cq.emplace(7));
+        assert(counted::live == 3);
+    }
+    assert(counted::live == 0);
+
+    ringbuf::Queue<std::string, 2> sq;
+    std::string hello("hello, world, in a string too long for SSO");
+    assert(sq.push(hello) && hello.size() == 42);
+    assert(sq.emplace(3, 'x'));
+    assert(*sq.pop() == hello && *sq.pop() == "xxx" && !sq.pop());
+    END_TEST(test_num);
+
+    /* Moving unique_ptrs between threads */
+    START_NEW_TEST(test_num);
+    static ringbuf::Queue<std::unique_ptr<uint64_t>, 64> pq;
+    std::thread pq_producer([] {
+        for (uint64_t i = 0; i != SPSC_TEST_ELEMS / 16; ++i) {
+            auto p = std::make_unique<uint64_t>(i);
+            while (!pq.push(std::move(p)))
+                ;
+        }
+    });
+    for (uint64_t i = 0; i != SPSC_TEST_ELEMS / 16; ) {
+        std::optional<std::unique_ptr<uint64_t>> p = pq.pop();
+        if (p)
+            assert(**p == i++);
+    }
+    pq_producer.join();
+    assert(pq.empty());
+    END_TEST(test_num);
+
+    /*
+     * Coroutines on one thread, resumed directly by the other side:
+     * the producer fills the ring and waits for room; then the
+     * consumer's first pop resumes it, and each stage runs whenever
+     * the other has made progress.
+     */
+    START_NEW_TEST(test_num);
+    {
+        async_ints ring;
+        int vals[12] = {};
+        bool produced = false;
+        bool consumed = false;
+        produce_ints(ring, 4, produced);
+        assert(!produced && ring.size() == 3);
+        consume_ints(ring, 6, vals, consumed);
+        assert(produced && consumed && ring.empty());
+        for (int i = 0; i != 12; ++i)
+            assert(vals[i] == i);
+
+        /* Nothing to wait for */
+        consumed = false;
+        ring.push(7);
+        ring.push(8);
+        consume_ints(ring, 1, vals, consumed);
+        assert(consumed && vals[0] == 7 && vals[1] == 8);
+    }
+    END_TEST(test_num);
+
+    /* Coroutines resumed through an executor */
+    START_NEW_TEST(test_num);
+    {
+        async_strings sq2;
+        event_loop loop;
+        bool consumed = false;
+        consume_strings(sq2, loop, 10, consumed);
+        produce_strings(sq2, loop, 10);
+        assert(!consumed && sq2.full() && loop.posted == 1);
+        loop.run();
+        assert(consumed && sq2.empty() && loop.posted > 1);
+    }
+    END_TEST(test_num);
+
+    /* A coroutine resumed by a producer thread */
+    START_NEW_TEST(test_num);
+    consume_async(SPSC_TEST_ELEMS);
+    std::thread async_producer([] {
+        for (uint64_t i = 0; i != SPSC_TEST_ELEMS; ++i)
+            while (!async_q.push(i))
+                ;
+    });
+    async_producer.join();
+    assert(async_done.load(std::memory_order_acquire) && async_q.empty());
+    END_TEST(test_num);
+
+    return 0;
+}
@@ -13,335 +13,3951 @@
  * <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for memfd_create, eventfd, splice */
+#endif
+
 #include "ringbuf.h"
 
 #include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/errqueue.h>
+#include <linux/mempolicy.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define RINGBUF_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+#include <pthread.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/*
+ * The code is written for clarity first, and contains many assert()s
+ * to enforce invariant assumptions and catch bugs. None of them has
+ * an effect the code depends on, so compiling with NDEBUG (as the
+ * Makefile's release library, "make lib", does) removes them, and
+ * leaves the fast path free of checks. Apart from the non-null
+ * checks in the *_free functions, they check only internal
+ * invariants, not how the caller uses the API: a precondition that a
+ * caller could violate, and that would otherwise fail silently (e.g.,
+ * by sleeping forever), must be checked at run time, and reported
+ * through the function's return value and errno.
+ */
+
+/*
+ * The head and tail are stored as indices rather than pointers. In
+ * the default mode, they are offsets into the contiguous buffer, and
+ * one byte of the buffer is sacrificed to distinguish the "buffer
+ * full" state from the "buffer empty" state. In power-of-two mode
+ * (RINGBUF_POW2), they are free-running counters, the offset of each
+ * is found by masking with size - 1, and the number of bytes used is
+ * simply the difference between the two; no byte is sacrificed. In
+ * the default mode, mask is all ones, so masking an index always
+ * yields the index itself.
+ *
+ * A mirrored ring buffer (RINGBUF_MIRRORED) is a power-of-two ring
+ * buffer whose buffer is mapped twice, back-to-back, in virtual
+ * memory, so that buf[i] and buf[i + size] are the same byte. Any
+ * span of up to size bytes, starting anywhere in the first mapping,
+ * is therefore contiguous.
+ *
+ * The head and tail are atomic so that, in SPSC mode, the producer
+ * and consumer can run concurrently. Each side loads its own index
+ * with relaxed ordering, loads the other side's index with acquire
+ * ordering, and publishes its own index with release ordering after
+ * it has finished touching the buffer contents. On buffers that are
+ * not shared between threads, these orderings cost nothing on x86
+ * and very little elsewhere.
+ *
+ * To avoid false sharing between a producer and a consumer running
+ * on different cores, the fields written by each side are on their
+ * own cache line. Each side also keeps a private, possibly stale,
+ * copy of the other side's index (tail_cache and head_cache), and
+ * only reloads the other side's cache line when the stale copy makes
+ * the ring buffer look too full (or too empty) for the operation at
+ * hand. A stale copy is always conservative, since each index only
+ * ever moves forward.
+ *
+ * Ring buffers created with RINGBUF_BLOCKING also have a 32-bit
+ * sequence number and a waiting flag per side, for
+ * ringbuf_wait_readable and ringbuf_wait_writable. A waiting consumer
+ * sets consumer_waiting and then sleeps (on a futex on Linux,
+ * otherwise on a condition variable) until head_seq changes; after
+ * publishing a new head, the producer bumps head_seq and wakes the
+ * consumer, but only if consumer_waiting is set. The producer waits
+ * for space in the same way, using producer_waiting and tail_seq.
+ * Full fences between publishing an index and checking the other
+ * side's waiting flag, and between setting a waiting flag and
+ * checking the other side's index, ensure that a wakeup is never
+ * lost.
+ *
+ * Bytes sent with MSG_ZEROCOPY (see ringbuf_send) must stay in the
+ * ring buffer until the kernel says it is done with them, so the tail
+ * can't be advanced when they're sent. Instead, the consumer keeps a
+ * separate send index, and a FIFO of the sends that are still in
+ * flight, in a struct ringbuf_zc that's allocated on the first
+ * zero-copy send. The tail only moves when the oldest sends
+ * complete.
+ *
+ * A pass-through ring buffer (RINGBUF_SPLICE) keeps its data in a
+ * pipe, pipefd, rather than in buf. The head and tail indices work
+ * exactly as they do for other ring buffers, but only count bytes;
+ * ringbuf_splice_in and ringbuf_splice_out move the data.
+ *
+ * An io_uring readv or writev prepared by ringbuf_uring_prep_read or
+ * ringbuf_uring_prep_write points the kernel at an iovec array which
+ * must stay valid until the operation completes, so each side keeps
+ * its own array, uring_iov, next to its index.
+ *
+ * A shared ring buffer (see ringbuf_new_shm) lives in a shared memory
+ * object which may be mapped at different addresses in different
+ * processes. The object begins with a struct ringbuf_shm header,
+ * which holds the head and tail indices (which are offsets, not
+ * pointers) and describes the layout, and is followed, at
+ * data_offset, by the buffer itself. Each process has its own struct
+ * ringbuf_t, whose headp and tailp point at the indices in the
+ * header; for other ring buffers, they point at the struct's own head
+ * and tail. The producer's tail_cache and the consumer's head_cache
+ * stay private to each process.
+ */
+#define RINGBUF_ZC_MAX 64
+
+struct ringbuf_zc
+{
+    size_t send_idx;
+    uint32_t next_seq;
+    size_t first;
+    size_t npending;
+    struct
+    {
+        uint32_t seq;
+        int done;
+        size_t end;
+    } pending[RINGBUF_ZC_MAX];
+};
+
+#if defined(__APPLE__) && defined(__aarch64__)
+#define RINGBUF_CACHELINE_SIZE 128
+#else
+#define RINGBUF_CACHELINE_SIZE 64
+#endif
+
+#define RINGBUF_SHM_MAGIC 0x52494e47 /* "RING" */
+#define RINGBUF_SHM_VERSION 1
+
+struct ringbuf_shm
+{
+    atomic_uint magic;
+    uint32_t version;
+    uint32_t index_size;
+    uint32_t flags;
+    uint64_t size;
+    uint64_t data_offset;
+
+    _Alignas(RINGBUF_CACHELINE_SIZE) atomic_size_t head;
+    _Alignas(RINGBUF_CACHELINE_SIZE) atomic_size_t tail;
+};
 
+#if defined(RINGBUF_STATS)
 /*
- * The code is written for clarity, not cleverness or performance, and
- * contains many assert()s to enforce invariant assumptions and catch
- * bugs. Feel free to optimize the code and to remove asserts for use
- * in your own projects, once you're comfortable that it functions as
- * intended.
+ * Statistics counters, kept only if ringbuf.c is compiled with
+ * RINGBUF_STATS defined. The producer's counters are on its cache
+ * line, and the consumer's on its own, and only the side that owns a
+ * counter writes it, so they're updated with relaxed loads and stores
+ * rather than atomic read-modify-writes; they're atomic only so that
+ * ringbuf_stats_snapshot may read them from another thread. The
+ * consumer uses only the first four.
  */
+struct ringbuf_counters
+{
+    atomic_uint_least64_t bytes;
+    atomic_uint_least64_t wrap_splits;
+    atomic_uint_least64_t syscalls;
+    atomic_uint_least64_t short_ios;
+    atomic_uint_least64_t overflows;
+    atomic_uint_least64_t bytes_lost;
+    atomic_uint_least64_t max_used;
+};
+#endif
 
 struct ringbuf_t
 {
+    /* Read-only after creation (except by ringbuf_resize). */
     uint8_t *buf;
-    uint8_t *head, *tail;
     size_t size;
+    size_t mask;
+    int flags;
+    int efd;
+    int pipefd[2];
+    atomic_size_t *headp;
+    atomic_size_t *tailp;
+    struct ringbuf_shm *shm;
+    size_t shm_len;
+    int shm_fd;
+    size_t map_len;
+    int external;
+    int locked;
+    int hugepages;
+    int numa_node;
+    int inplace;
+    size_t grow_max;
+    size_t grow_min;
+    struct ringbuf_pool_t *pool;
+    size_t pool_class;
+    ringbuf_t pool_next;
+#if !defined(__linux__)
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+
+    /* Written by the producer. */
+    _Alignas(RINGBUF_CACHELINE_SIZE) atomic_size_t head;
+    size_t tail_cache;
+    atomic_uint head_seq;
+    atomic_int producer_waiting;
+    struct iovec producer_uring_iov[2];
+#if defined(RINGBUF_STATS)
+    struct ringbuf_counters producer_stats;
+#endif
+
+    /* Written by the consumer. */
+    _Alignas(RINGBUF_CACHELINE_SIZE) atomic_size_t tail;
+    size_t head_cache;
+    atomic_uint tail_seq;
+    atomic_int consumer_waiting;
+    struct ringbuf_zc *zc;
+    struct iovec consumer_uring_iov[2];
+#if defined(RINGBUF_STATS)
+    struct ringbuf_counters consumer_stats;
+#endif
 };
 
-ringbuf_t
-ringbuf_new(size_t capacity)
+static size_t
+ringbuf_load_head(const struct ringbuf_t *rb, memory_order order)
 {
-    ringbuf_t rb = malloc(sizeof(struct ringbuf_t));
-    if (rb) {
+    return atomic_load_explicit(rb->headp, order);
+}
 
-        /* One byte is used for detecting the full condition. */
-        rb->size = capacity + 1;
-        rb->buf = malloc(rb->size);
-        if (rb->buf)
-            ringbuf_reset(rb);
-        else {
-            free(rb);
-            return 0;
-        }
-    }
-    return rb;
+static size_t
+ringbuf_load_tail(const struct ringbuf_t *rb, memory_order order)
+{
+    return atomic_load_explicit(rb->tailp, order);
 }
 
-size_t
-ringbuf_buffer_size(const struct ringbuf_t *rb)
+static int
+ringbuf_is_blocking(const struct ringbuf_t *rb)
 {
-    return rb->size;
+    return (rb->flags & RINGBUF_BLOCKING) != 0;
 }
 
-void
-ringbuf_reset(ringbuf_t rb)
+/*
+ * Wake any thread sleeping on the sequence number seq.
+ */
+static void
+ringbuf_wake(ringbuf_t rb, atomic_uint *seq)
 {
-    rb->head = rb->tail = rb->buf;
+#if defined(__linux__)
+    (void) rb;
+    atomic_fetch_add_explicit(seq, 1, memory_order_release);
+    syscall(SYS_futex, seq, FUTEX_WAKE_PRIVATE, INT32_MAX, 0, 0, 0);
+#else
+    pthread_mutex_lock(&rb->lock);
+    atomic_fetch_add_explicit(seq, 1, memory_order_release);
+    pthread_cond_broadcast(&rb->cond);
+    pthread_mutex_unlock(&rb->lock);
+#endif
 }
 
-void
-ringbuf_free(ringbuf_t *rb)
+/*
+ * Sleep until the sequence number seq is no longer equal to seen, or
+ * until timeout_ns nanoseconds have passed (if timeout_ns is
+ * negative, there is no time limit). May return early.
+ */
+static void
+ringbuf_sleep(ringbuf_t rb, atomic_uint *seq, unsigned seen,
+              long long timeout_ns)
 {
-    assert(rb && *rb);
-    free((*rb)->buf);
-    free(*rb);
-    *rb = 0;
+    struct timespec ts;
+#if defined(__linux__)
+    (void) rb;
+    ts.tv_sec = timeout_ns / 1000000000;
+    ts.tv_nsec = timeout_ns % 1000000000;
+    syscall(SYS_futex, seq, FUTEX_WAIT_PRIVATE, seen,
+            timeout_ns < 0 ? 0 : &ts, 0, 0);
+#else
+    pthread_mutex_lock(&rb->lock);
+    if (atomic_load_explicit(seq, memory_order_relaxed) == seen) {
+        if (timeout_ns < 0)
+            pthread_cond_wait(&rb->cond, &rb->lock);
+        else {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            timeout_ns += ts.tv_nsec;
+            ts.tv_sec += timeout_ns / 1000000000;
+            ts.tv_nsec = timeout_ns % 1000000000;
+            pthread_cond_timedwait(&rb->cond, &rb->lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&rb->lock);
+#endif
 }
 
-size_t
-ringbuf_capacity(const struct ringbuf_t *rb)
+#if defined(RINGBUF_STATS)
+static void
+ringbuf_count(atomic_uint_least64_t *counter, uint64_t n)
 {
-    return ringbuf_buffer_size(rb) - 1;
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed) +
+                          n,
+                          memory_order_relaxed);
 }
 
+#define RINGBUF_COUNT(stats, counter, n) ringbuf_count(&(stats).counter, (n))
+
+static void
+ringbuf_count_in(ringbuf_t rb, size_t old_head, size_t head, size_t n);
+
+static void
+ringbuf_count_out(ringbuf_t rb, size_t old_tail, size_t n);
+#else
+#define RINGBUF_COUNT(stats, counter, n) ((void) 0)
+#endif
+
 /*
- * Return a pointer to one-past-the-end of the ring buffer's
- * contiguous buffer. You shouldn't normally need to use this function
- * unless you're writing a new ringbuf_* function.
+ * Publish a new head index, after the producer has added n bytes to
+ * rb (n is only used for statistics).
  */
-static const uint8_t *
-ringbuf_end(const struct ringbuf_t *rb)
+static void
+ringbuf_store_head(ringbuf_t rb, size_t head, size_t n)
 {
-    return rb->buf + ringbuf_buffer_size(rb);
+#if defined(RINGBUF_STATS)
+    ringbuf_count_in(rb, atomic_load_explicit(rb->headp, memory_order_relaxed),
+                     head, n);
+#else
+    (void) n;
+#endif
+    if (!ringbuf_is_blocking(rb)) {
+        atomic_store_explicit(rb->headp, head, memory_order_release);
+        return;
+    }
+
+    size_t old_head = atomic_load_explicit(rb->headp, memory_order_relaxed);
+    atomic_store_explicit(rb->headp, head, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&rb->consumer_waiting, memory_order_relaxed))
+        ringbuf_wake(rb, &rb->head_seq);
+
+    /*
+     * Signal the eventfd when the ring buffer goes from empty to
+     * non-empty. If the consumer is still busy draining it, it will
+     * see the new head after it publishes its tail.
+     */
+    if (rb->efd >= 0 && head != old_head &&
+        atomic_load_explicit(rb->tailp, memory_order_relaxed) == old_head) {
+#if defined(__linux__)
+        eventfd_write(rb->efd, 1);
+#endif
+    }
 }
 
-size_t
-ringbuf_bytes_free(const struct ringbuf_t *rb)
+/*
+ * Likewise, after the consumer has removed n bytes.
+ */
+static void
+ringbuf_store_tail(ringbuf_t rb, size_t tail, size_t n)
 {
-    if (rb->head >= rb->tail)
-        return ringbuf_capacity(rb) - (rb->head - rb->tail);
-    else
-        return rb->tail - rb->head - 1;
+#if defined(RINGBUF_STATS)
+    ringbuf_count_out(rb, atomic_load_explicit(rb->tailp, memory_order_relaxed),
+                      n);
+#else
+    (void) n;
+#endif
+    atomic_store_explicit(rb->tailp, tail, memory_order_release);
+    if (ringbuf_is_blocking(rb)) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&rb->producer_waiting, memory_order_relaxed))
+            ringbuf_wake(rb, &rb->tail_seq);
+    }
 }
 
-size_t
-ringbuf_bytes_used(const struct ringbuf_t *rb)
+static int
+ringbuf_is_pow2(const struct ringbuf_t *rb)
 {
-    return ringbuf_capacity(rb) - ringbuf_bytes_free(rb);
+    return (rb->flags & RINGBUF_POW2) != 0;
 }
 
-int
-ringbuf_is_full(const struct ringbuf_t *rb)
+/*
+ * Allocate the contiguous buffer for a power-of-two ring buffer of
+ * size bytes, aligned to a page boundary if the buffer is at least a
+ * page in size, or else to a cache line boundary.
+ */
+static void *
+ringbuf_alloc_pow2(size_t size)
 {
-    return ringbuf_bytes_free(rb) == 0;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    size_t align = RINGBUF_CACHELINE_SIZE;
+    if (pagesize > 0 && size >= (size_t) pagesize)
+        align = pagesize;
+    void *buf;
+    if (posix_memalign(&buf, align, size) != 0)
+        return 0;
+    return buf;
 }
 
-int
-ringbuf_is_empty(const struct ringbuf_t *rb)
+/*
+ * Create a file descriptor referring to an anonymous, unlinked
+ * shared memory object, or return -1.
+ */
+static int
+ringbuf_memfd(void)
 {
-    return ringbuf_bytes_free(rb) == ringbuf_capacity(rb);
+#if defined(__linux__)
+    return memfd_create("ringbuf", MFD_CLOEXEC);
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/ringbuf-%ld-%p", (long) getpid(),
+             (void *) &name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1)
+        shm_unlink(name);
+    return fd;
+#endif
 }
 
-const void *
-ringbuf_tail(const struct ringbuf_t *rb)
+/*
+ * Allocate the buffer for a mirrored ring buffer of size bytes, where
+ * size is a multiple of the page size: reserve 2 * size bytes of
+ * address space, then map the same shared memory object into both
+ * halves.
+ */
+static void *
+ringbuf_alloc_mirrored(size_t size)
 {
-    return rb->tail;
+    if (size > SIZE_MAX / 2)
+        return 0;
+
+    int fd = ringbuf_memfd();
+    if (fd == -1)
+        return 0;
+
+    uint8_t *buf = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        buf = mmap(0, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+    if (buf != MAP_FAILED) {
+        if (mmap(buf, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                 fd, 0) == MAP_FAILED ||
+            mmap(buf + size, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(buf, 2 * size);
+            buf = MAP_FAILED;
+        }
+    }
+
+    /* The mappings keep the shared memory object alive. */
+    close(fd);
+    return buf == MAP_FAILED ? 0 : buf;
 }
 
-const void *
-ringbuf_head(const struct ringbuf_t *rb)
+/*
+ * Round n up to the next power of two. Returns 0 if the result is
+ * not representable.
+ */
+static size_t
+ringbuf_roundup_pow2(size_t n)
 {
-    return rb->head;
+    size_t p = 1;
+    while (p < n) {
+        if (p > SIZE_MAX / 2)
+            return 0;
+        p <<= 1;
+    }
+    return p;
 }
 
 /*
- * Given a ring buffer rb and a pointer to a location within its
- * contiguous buffer, return the a pointer to the next logical
- * location in the ring buffer.
+ * Initialize the ring buffer object at rb with the given flags, but
+ * no buffer.
  */
-static uint8_t *
-ringbuf_nextp(ringbuf_t rb, const uint8_t *p)
+static void
+ringbuf_init_handle(ringbuf_t rb, int flags)
 {
-    /*
-     * The assert guarantees the expression (++p - rb->buf) is
-     * non-negative; therefore, the modulus operation is safe and
-     * portable.
-     */
-    assert((p >= rb->buf) && (p < ringbuf_end(rb)));
-    return rb->buf + ((++p - rb->buf) % ringbuf_buffer_size(rb));
+    rb->buf = 0;
+    rb->flags = flags;
+    rb->efd = -1;
+    rb->pipefd[0] = rb->pipefd[1] = -1;
+    rb->headp = &rb->head;
+    rb->tailp = &rb->tail;
+    rb->tail_cache = 0;
+    rb->head_cache = 0;
+    rb->shm = 0;
+    rb->shm_len = 0;
+    rb->shm_fd = -1;
+    rb->map_len = 0;
+    rb->external = 0;
+    rb->locked = 0;
+    rb->hugepages = RINGBUF_HUGEPAGES_NONE;
+    rb->numa_node = -1;
+    rb->inplace = 0;
+    rb->grow_max = 0;
+    rb->grow_min = 0;
+    rb->pool = 0;
+    rb->pool_class = 0;
+    rb->pool_next = 0;
+    rb->zc = 0;
+#if !defined(__linux__)
+    pthread_mutex_init(&rb->lock, 0);
+    pthread_cond_init(&rb->cond, 0);
+#endif
+    atomic_init(&rb->head, 0);
+    atomic_init(&rb->tail, 0);
+    atomic_init(&rb->head_seq, 0);
+    atomic_init(&rb->tail_seq, 0);
+    atomic_init(&rb->producer_waiting, 0);
+    atomic_init(&rb->consumer_waiting, 0);
+    ringbuf_stats_reset(rb);
 }
 
-size_t
-ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset)
+/*
+ * Allocate and initialize a ring buffer object with the given flags,
+ * but no buffer, or return 0.
+ */
+static ringbuf_t
+ringbuf_new_handle(int flags)
 {
-    const uint8_t *bufend = ringbuf_end(rb);
-    size_t bytes_used = ringbuf_bytes_used(rb);
-    if (offset >= bytes_used)
-        return bytes_used;
-
-    const uint8_t *start = rb->buf +
-        (((rb->tail - rb->buf) + offset) % ringbuf_buffer_size(rb));
-    assert(bufend > start);
-    size_t n = MIN(bufend - start, bytes_used - offset);
-    const uint8_t *found = memchr(start, c, n);
-    if (found)
-        return offset + (found - start);
-    else
-        return ringbuf_findchr(rb, c, offset + n);
+    ringbuf_t rb;
+    if (posix_memalign((void **) &rb, RINGBUF_CACHELINE_SIZE,
+                       sizeof(struct ringbuf_t)) != 0)
+        return 0;
+    ringbuf_init_handle(rb, flags);
+    return rb;
 }
 
-size_t
-ringbuf_memset(ringbuf_t dst, int c, size_t len)
+/*
+ * Return flags, plus the flags they imply.
+ */
+static int
+ringbuf_implied_flags(int flags)
 {
-    const uint8_t *bufend = ringbuf_end(dst);
-    size_t nwritten = 0;
-    size_t count = MIN(len, ringbuf_buffer_size(dst));
-    int overflow = count > ringbuf_bytes_free(dst);
+    if (flags & RINGBUF_EVENTFD)
+        flags |= RINGBUF_BLOCKING;
+    if (flags & RINGBUF_BLOCKING)
+        flags |= RINGBUF_SPSC;
+    if (flags & RINGBUF_MIRRORED)
+        flags |= RINGBUF_POW2;
+    return flags;
+}
 
-    while (nwritten != count) {
+/*
+ * The size of the internal buffer of a ring buffer with the given
+ * capacity and (implied) flags, or 0 if it would be too large.
+ */
+static size_t
+ringbuf_size_for(size_t capacity, int flags)
+{
+    if (flags & RINGBUF_POW2)
+        return ringbuf_roundup_pow2(capacity);
 
-        /* don't copy beyond the end of the buffer */
-        assert(bufend > dst->head);
-        size_t n = MIN(bufend - dst->head, count - nwritten);
-        memset(dst->head, c, n);
-        dst->head += n;
-        nwritten += n;
+    /* One byte is used for detecting the full condition. */
+    return capacity + 1;
+}
 
-        /* wrap? */
-        if (dst->head == bufend)
-            dst->head = dst->buf;
+/*
+ * Create the eventfd and pipe, if any, required by rb's flags.
+ * Returns 0 on success, or -1.
+ */
+static int
+ringbuf_open_fds(ringbuf_t rb, size_t capacity)
+{
+#if defined(__linux__)
+    if (rb->flags & RINGBUF_EVENTFD) {
+        rb->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (rb->efd == -1)
+            return -1;
     }
 
-    if (overflow) {
-        dst->tail = ringbuf_nextp(dst, dst->head);
-        assert(ringbuf_is_full(dst));
+    /*
+     * The pipe must be able to hold the ring buffer's capacity.
+     * Never shrink it below the default size, though, since each
+     * splice may use up a page slot in the pipe, however few bytes
+     * it moves.
+     */
+    if (rb->flags & RINGBUF_SPLICE) {
+        int pipe_size;
+        if (pipe2(rb->pipefd, O_CLOEXEC | O_NONBLOCK) == -1 ||
+            (pipe_size = fcntl(rb->pipefd[1], F_GETPIPE_SZ)) == -1 ||
+            capacity > INT_MAX ||
+            ((size_t) pipe_size < capacity &&
+             fcntl(rb->pipefd[1], F_SETPIPE_SZ, (int) capacity) == -1))
+            return -1;
     }
+    return 0;
+#else
+    (void) capacity;
+    return (rb->flags & (RINGBUF_EVENTFD | RINGBUF_SPLICE)) ? -1 : 0;
+#endif
+}
 
-    return nwritten;
+/*
+ * When a ring buffer object and its buffer share a single
+ * allocation, the buffer begins at this offset from the object, on
+ * the first cache line boundary after it.
+ */
+#define RINGBUF_INLINE_OFFSET \
+    ((sizeof(struct ringbuf_t) + RINGBUF_CACHELINE_SIZE - 1) / \
+     RINGBUF_CACHELINE_SIZE * RINGBUF_CACHELINE_SIZE)
+
+/*
+ * The alignment of a buffer of size bytes, with the given (implied)
+ * flags, that follows its ring buffer object: as RINGBUF_POW2
+ * promises, a page if it's a power-of-two buffer of at least a page,
+ * and otherwise a cache line. The object itself sits
+ * RINGBUF_INLINE_OFFSET bytes before the buffer, so it's always
+ * cache-line aligned.
+ */
+static size_t
+ringbuf_inline_align(size_t size, int flags)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if ((flags & RINGBUF_POW2) && pagesize > 0 && size >= (size_t) pagesize)
+        return pagesize;
+    return RINGBUF_CACHELINE_SIZE;
 }
 
-void *
-ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count)
+size_t
+ringbuf_sizeof(size_t capacity, int flags)
 {
-    const uint8_t *u8src = src;
-    const uint8_t *bufend = ringbuf_end(dst);
-    int overflow = count > ringbuf_bytes_free(dst);
-    size_t nread = 0;
+    flags = ringbuf_implied_flags(flags);
+    size_t size = ringbuf_size_for(capacity, flags);
 
-    while (nread != count) {
-        /* don't copy beyond the end of the buffer */
-        assert(bufend > dst->head);
-        size_t n = MIN(bufend - dst->head, count - nread);
-        memcpy(dst->head, u8src + nread, n);
-        dst->head += n;
-        nread += n;
+    /* Leave room to align the buffer, wherever the storage begins. */
+    size_t overhead = ringbuf_inline_align(size, flags) - 1 +
+        RINGBUF_INLINE_OFFSET;
+    if ((flags & RINGBUF_MIRRORED) || size == 0 ||
+        size > SIZE_MAX - overhead)
+        return 0;
+    return overhead + size;
+}
 
-        /* wrap? */
-        if (dst->head == bufend)
-            dst->head = dst->buf;
-    }
+static void
+ringbuf_release(ringbuf_t rb);
 
-    if (overflow) {
-        dst->tail = ringbuf_nextp(dst, dst->head);
-        assert(ringbuf_is_full(dst));
+/*
+ * Initialize a ring buffer with the given capacity and (implied)
+ * flags at rb, with its buffer right after it, in storage owned by
+ * the caller. rb + RINGBUF_INLINE_OFFSET must be aligned as
+ * ringbuf_inline_align says. Returns 0 on success, or -1.
+ */
+static int
+ringbuf_init_inplace(ringbuf_t rb, size_t capacity, int flags)
+{
+    ringbuf_init_handle(rb, flags);
+    rb->inplace = 1;
+    rb->size = ringbuf_size_for(capacity, flags);
+    rb->mask = (flags & RINGBUF_POW2) ? rb->size - 1 : SIZE_MAX;
+    rb->buf = (uint8_t *) rb + RINGBUF_INLINE_OFFSET;
+    if (ringbuf_open_fds(rb, capacity) == -1) {
+        ringbuf_release(rb);
+        return -1;
     }
-
-    return dst->head;
+    ringbuf_reset(rb);
+    return 0;
 }
 
-ssize_t
-ringbuf_read(int fd, ringbuf_t rb, size_t count)
+ringbuf_t
+ringbuf_init(void *storage, size_t storage_size, size_t capacity, int flags)
 {
-    const uint8_t *bufend = ringbuf_end(rb);
-    size_t nfree = ringbuf_bytes_free(rb);
+    size_t needed = ringbuf_sizeof(capacity, flags);
+    if (!storage || needed == 0 || storage_size < needed)
+        return 0;
 
-    /* don't write beyond the end of the buffer */
-    assert(bufend > rb->head);
-    count = MIN(bufend - rb->head, count);
-    ssize_t n = read(fd, rb->head, count);
-    if (n > 0) {
-        assert(rb->head + n <= bufend);
-        rb->head += n;
+    flags = ringbuf_implied_flags(flags);
+    size_t align = ringbuf_inline_align(ringbuf_size_for(capacity, flags),
+                                        flags);
+    uintptr_t buf = ((uintptr_t) storage + RINGBUF_INLINE_OFFSET + align - 1) &
+        ~(uintptr_t) (align - 1);
+    ringbuf_t rb = (ringbuf_t) (buf - RINGBUF_INLINE_OFFSET);
+    if (ringbuf_init_inplace(rb, capacity, flags) == -1)
+        return 0;
+    return rb;
+}
 
-        /* wrap? */
-        if (rb->head == bufend)
-            rb->head = rb->buf;
+/*
+ * Allocate a buffer of at least size bytes with mmap(2), rather than
+ * malloc(3), as requested by the given RINGBUF_HUGEPAGES_* option,
+ * and set *len to the length of the mapping. For transparent huge
+ * pages, the mapping is aligned to a huge page boundary, so that the
+ * kernel can back it with huge pages.
+ */
+#define RINGBUF_HUGEPAGE_2M ((size_t) 1 << 21)
+#define RINGBUF_HUGEPAGE_1G ((size_t) 1 << 30)
 
-        /* fix up the tail pointer if an overflow occurred */
-        if (n > nfree) {
-            rb->tail = ringbuf_nextp(rb, rb->head);
-            assert(ringbuf_is_full(rb));
-        }
+static void *
+ringbuf_alloc_mapped(size_t size, int hugepages, size_t *len)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize <= 0)
+        return 0;
+    size_t align = pagesize;
+    int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (hugepages == RINGBUF_HUGEPAGES_THP)
+        align = RINGBUF_HUGEPAGE_2M;
+    else if (hugepages == RINGBUF_HUGEPAGES_2M ||
+             hugepages == RINGBUF_HUGEPAGES_1G) {
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+        align = hugepages == RINGBUF_HUGEPAGES_2M ?
+            RINGBUF_HUGEPAGE_2M : RINGBUF_HUGEPAGE_1G;
+        mflags |= MAP_HUGETLB |
+            ((hugepages == RINGBUF_HUGEPAGES_2M ? 21 : 30) << MAP_HUGE_SHIFT);
+#else
+        return 0;
+#endif
     }
+    if (size > SIZE_MAX - 2 * align)
+        return 0;
+    *len = (size + align - 1) / align * align;
 
-    return n;
-}
+    if (hugepages != RINGBUF_HUGEPAGES_THP) {
+        void *buf = mmap(0, *len, PROT_READ | PROT_WRITE, mflags, -1, 0);
+        return buf == MAP_FAILED ? 0 : buf;
+    }
 
-void *
-ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count)
-{
-    size_t bytes_used = ringbuf_bytes_used(src);
-    if (count > bytes_used)
+    /* Over-allocate, then trim the mapping to an aligned range. */
+    uint8_t *p = mmap(0, *len + align, PROT_READ | PROT_WRITE, mflags, -1, 0);
+    if (p == MAP_FAILED)
         return 0;
+    uint8_t *buf = (uint8_t *) (((uintptr_t) p + align - 1) & ~(align - 1));
+    if (buf != p)
+        munmap(p, buf - p);
+    if (buf + *len != p + *len + align)
+        munmap(buf + *len, (p + *len + align) - (buf + *len));
+#if defined(MADV_HUGEPAGE)
+    madvise(buf, *len, MADV_HUGEPAGE);
+#endif
+    return buf;
+}
 
-    uint8_t *u8dst = dst;
-    const uint8_t *bufend = ringbuf_end(src);
-    size_t nwritten = 0;
-    while (nwritten != count) {
-        assert(bufend > src->tail);
-        size_t n = MIN(bufend - src->tail, count - nwritten);
-        memcpy(u8dst + nwritten, src->tail, n);
-        src->tail += n;
-        nwritten += n;
+/*
+ * Bind the len bytes at buf to the given NUMA node. Returns 0 on
+ * success, or -1.
+ */
+#define RINGBUF_MAX_NUMA_NODES 1024
 
-        /* wrap ? */
-        if (src->tail == bufend)
-            src->tail = src->buf;
-    }
+static int
+ringbuf_bind_node(void *buf, size_t len, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask[RINGBUF_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    if (node < 0 || node >= RINGBUF_MAX_NUMA_NODES)
+        return -1;
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |=
+        1UL << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, buf, len, MPOL_BIND, mask,
+                   RINGBUF_MAX_NUMA_NODES + 1, MPOL_MF_STRICT | MPOL_MF_MOVE)
+        == 0 ? 0 : -1;
+#else
+    (void) buf;
+    (void) len;
+    (void) node;
+    return -1;
+#endif
+}
 
-    assert(count + ringbuf_bytes_used(src) == bytes_used);
-    return src->tail;
+void
+ringbuf_opts_init(struct ringbuf_opts *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->hugepages = RINGBUF_HUGEPAGES_NONE;
+    opts->numa_node = -1;
 }
 
-ssize_t
-ringbuf_write(int fd, ringbuf_t rb, size_t count)
+ringbuf_t
+ringbuf_new_ex(size_t capacity, int flags)
 {
-    size_t bytes_used = ringbuf_bytes_used(rb);
-    if (count > bytes_used)
+    struct ringbuf_opts opts;
+    ringbuf_opts_init(&opts);
+    opts.flags = flags;
+    return ringbuf_new_opts(capacity, &opts);
+}
+
+ringbuf_t
+ringbuf_new_opts(size_t capacity, const struct ringbuf_opts *opts)
+{
+    int flags = ringbuf_implied_flags(opts->flags);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize <= 0)
         return 0;
+    if (flags & RINGBUF_MIRRORED)
+        capacity = MAX(capacity, (size_t) pagesize);
 
-    const uint8_t *bufend = ringbuf_end(rb);
-    assert(bufend > rb->head);
-    count = MIN(bufend - rb->tail, count);
-    ssize_t n = write(fd, rb->tail, count);
-    if (n > 0) {
-        assert(rb->tail + n <= bufend);
-        rb->tail += n;
+    /*
+     * Huge pages and external memory can't be mirrored, and the NUMA
+     * policy only applies to memory the ring buffer allocates itself.
+     * (The second mapping of a mirrored buffer is only huge-page
+     * aligned if the buffer is a whole number of huge pages, so even
+     * transparent huge pages would rarely be used; the request is
+     * refused rather than silently ignored.)
+     */
+    int mapped = opts->hugepages != RINGBUF_HUGEPAGES_NONE ||
+        opts->numa_node >= 0 || opts->lock;
+    if (((flags & RINGBUF_MIRRORED) &&
+         (opts->mem || opts->hugepages != RINGBUF_HUGEPAGES_NONE)) ||
+        (opts->mem && (opts->hugepages || opts->numa_node >= 0))) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    size_t size = ringbuf_size_for(capacity, flags);
+    if (size == 0)
+        return 0;
 
-        /* wrap? */
-        if (rb->tail == bufend)
-            rb->tail = rb->buf;
+    /*
+     * An ordinary heap buffer is allocated together with the ring
+     * buffer object, so that creating a ring buffer takes a single
+     * allocation, and the buffer sits right after the indices in
+     * memory. Power-of-two buffers of a page or more are still
+     * allocated separately, since they're page-aligned.
+     */
+    ringbuf_t rb;
+    if (!opts->mem && !mapped && !(flags & RINGBUF_MIRRORED) &&
+        !((flags & RINGBUF_POW2) && size >= (size_t) pagesize)) {
+        if (size > SIZE_MAX - RINGBUF_INLINE_OFFSET ||
+            posix_memalign((void **) &rb, RINGBUF_CACHELINE_SIZE,
+                           RINGBUF_INLINE_OFFSET + size) != 0)
+            return 0;
+        ringbuf_init_handle(rb, flags);
+        rb->buf = (uint8_t *) rb + RINGBUF_INLINE_OFFSET;
+    } else if (!(rb = ringbuf_new_handle(flags)))
+        return 0;
+    rb->size = size;
+    rb->mask = (flags & RINGBUF_POW2) ? size - 1 : SIZE_MAX;
+    rb->hugepages = opts->hugepages;
+    rb->numa_node = opts->numa_node;
 
-        assert(n + ringbuf_bytes_used(rb) == bytes_used);
+    size_t len = size;
+    if (rb->buf)
+        ;
+    else if (opts->mem) {
+        rb->buf = opts->mem_size >= size ? opts->mem : 0;
+        rb->external = 1;
+    } else if (flags & RINGBUF_MIRRORED) {
+        rb->buf = ringbuf_alloc_mirrored(size);
+        len = 2 * size;
+    } else if (mapped) {
+        rb->buf = ringbuf_alloc_mapped(size, opts->hugepages, &rb->map_len);
+        len = rb->map_len;
+    } else
+        rb->buf = ringbuf_alloc_pow2(size);
+    if (!rb->buf) {
+        free(rb);
+        return 0;
     }
 
-    return n;
+    /*
+     * Bind the memory before touching it, so that its pages are
+     * allocated on the right node; then fault them all in, so that
+     * the hot path doesn't take page faults.
+     */
+    if (opts->numa_node >= 0 &&
+        ringbuf_bind_node(rb->buf, len, opts->numa_node) == -1) {
+        ringbuf_free(&rb);
+        return 0;
+    }
+    if (opts->lock) {
+        if (mlock(rb->buf, len) == -1) {
+            ringbuf_free(&rb);
+            return 0;
+        }
+        rb->locked = 1;
+    }
+    if (opts->prefault) {
+        volatile uint8_t *p = rb->buf;
+        size_t i;
+        for (i = 0; i < size; i += pagesize)
+            p[i] = 0;
+    }
+    if (ringbuf_open_fds(rb, capacity) == -1) {
+        ringbuf_free(&rb);
+        return 0;
+    }
+    ringbuf_reset(rb);
+    return rb;
 }
 
-void *
-ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count)
+ringbuf_t
+ringbuf_new(size_t capacity)
 {
-    size_t src_bytes_used = ringbuf_bytes_used(src);
-    if (count > src_bytes_used)
-        return 0;
-    int overflow = count > ringbuf_bytes_free(dst);
+    return ringbuf_new_ex(capacity, 0);
+}
 
-    const uint8_t *src_bufend = ringbuf_end(src);
-    const uint8_t *dst_bufend = ringbuf_end(dst);
-    size_t ncopied = 0;
-    while (ncopied != count) {
-        assert(src_bufend > src->tail);
-        size_t nsrc = MIN(src_bufend - src->tail, count - ncopied);
-        assert(dst_bufend > dst->head);
-        size_t n = MIN(dst_bufend - dst->head, nsrc);
-        memcpy(dst->head, src->tail, n);
-        src->tail += n;
-        dst->head += n;
-        ncopied += n;
+ringbuf_t
+ringbuf_new_spsc(size_t capacity)
+{
+    return ringbuf_new_ex(capacity, RINGBUF_SPSC);
+}
 
-        /* wrap ? */
-        if (src->tail == src_bufend)
-            src->tail = src->buf;
-        if (dst->head == dst_bufend)
-            dst->head = dst->buf;
+/*
+ * Map the shared ring buffer in the shared memory object fd, whose
+ * buffer of size bytes begins at data_offset, into a new ring buffer
+ * object with the given flags. If the ring buffer is mirrored, the
+ * buffer is mapped twice, back-to-back, after the header. Takes
+ * ownership of fd.
+ */
+static ringbuf_t
+ringbuf_map_shm(int fd, size_t size, size_t data_offset, int flags)
+{
+    ringbuf_t rb = ringbuf_new_handle(flags);
+    if (!rb) {
+        close(fd);
+        return 0;
     }
 
-    assert(count + ringbuf_bytes_used(src) == src_bytes_used);
-    
-    if (overflow) {
-        dst->tail = ringbuf_nextp(dst, dst->head);
-        assert(ringbuf_is_full(dst));
+    int mirrored = (flags & RINGBUF_MIRRORED) != 0;
+    size_t len = data_offset + (mirrored ? 2 * size : size);
+    uint8_t *base = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base != MAP_FAILED && mirrored &&
+        mmap(base + data_offset + size, size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, data_offset) == MAP_FAILED) {
+        munmap(base, len);
+        base = MAP_FAILED;
     }
+    if (base == MAP_FAILED) {
+        close(fd);
+        free(rb);
+        return 0;
+    }
+
+    rb->shm = (struct ringbuf_shm *) base;
+    rb->shm_len = len;
+    rb->shm_fd = fd;
+    rb->buf = base + data_offset;
+    rb->size = size;
+    rb->mask = size - 1;
+    rb->headp = &rb->shm->head;
+    rb->tailp = &rb->shm->tail;
+
+    /*
+     * An attaching process may find data already in the ring buffer,
+     * so its cached views of the other side's index start from the
+     * shared indices, not from 0.
+     */
+    rb->tail_cache = ringbuf_load_tail(rb, memory_order_acquire);
+    rb->head_cache = ringbuf_load_head(rb, memory_order_acquire);
+    return rb;
+}
 
-    return dst->head;
+ringbuf_t
+ringbuf_new_shm(const char *name, size_t capacity, int flags)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize <= 0 || (flags & ~RINGBUF_MIRRORED))
+        return 0;
+    flags |= RINGBUF_SPSC | RINGBUF_POW2;
+    if (flags & RINGBUF_MIRRORED)
+        capacity = MAX(capacity, (size_t) pagesize);
+    size_t size = ringbuf_roundup_pow2(capacity);
+    size_t data_offset = MAX(sizeof(struct ringbuf_shm), (size_t) pagesize);
+    if (size == 0 || size > (SIZE_MAX - data_offset) / 2 ||
+        data_offset + 2 * size > (uint64_t) INT64_MAX)
+        return 0;
+
+    int fd;
+    if (name)
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    else
+        fd = ringbuf_memfd();
+    if (fd == -1)
+        return 0;
+    if (ftruncate(fd, data_offset + size) == -1) {
+        close(fd);
+        if (name)
+            shm_unlink(name);
+        return 0;
+    }
+
+    ringbuf_t rb = ringbuf_map_shm(fd, size, data_offset, flags);
+    if (!rb) {
+        if (name)
+            shm_unlink(name);
+        return 0;
+    }
+
+    /* Publish the header last, so that attachers never see half of it. */
+    struct ringbuf_shm *shm = rb->shm;
+    shm->version = RINGBUF_SHM_VERSION;
+    shm->index_size = sizeof(size_t);
+    shm->flags = flags;
+    shm->size = size;
+    shm->data_offset = data_offset;
+    atomic_init(&shm->head, 0);
+    atomic_init(&shm->tail, 0);
+    atomic_store_explicit(&shm->magic, RINGBUF_SHM_MAGIC, memory_order_release);
+    return rb;
+}
+
+ringbuf_t
+ringbuf_attach_fd(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(struct ringbuf_shm))
+        return 0;
+
+    struct ringbuf_shm *shm = mmap(0, sizeof(struct ringbuf_shm), PROT_READ,
+                                   MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED)
+        return 0;
+    int valid =
+        atomic_load_explicit(&shm->magic, memory_order_acquire) ==
+            RINGBUF_SHM_MAGIC &&
+        shm->version == RINGBUF_SHM_VERSION &&
+        shm->index_size == sizeof(size_t) &&
+        (shm->flags & ~(RINGBUF_SPSC | RINGBUF_POW2 | RINGBUF_MIRRORED)) == 0 &&
+        shm->size != 0 && (shm->size & (shm->size - 1)) == 0 &&
+        shm->size <= (SIZE_MAX - shm->data_offset) / 2 &&
+        shm->data_offset >= sizeof(struct ringbuf_shm) &&
+        shm->data_offset + shm->size <= (uint64_t) st.st_size;
+    size_t size = shm->size;
+    size_t data_offset = shm->data_offset;
+    int flags = shm->flags;
+    munmap(shm, sizeof(struct ringbuf_shm));
+    if (!valid)
+        return 0;
+
+    int dupfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dupfd == -1)
+        return 0;
+    return ringbuf_map_shm(dupfd, size, data_offset, flags);
+}
+
+ringbuf_t
+ringbuf_attach_shm(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return 0;
+    ringbuf_t rb = ringbuf_attach_fd(fd);
+    close(fd);
+    return rb;
+}
+
+int
+ringbuf_shm_fd(const struct ringbuf_t *rb)
+{
+    return rb->shm_fd;
+}
+
+int
+ringbuf_is_spsc(const struct ringbuf_t *rb)
+{
+    return (rb->flags & RINGBUF_SPSC) != 0;
+}
+
+int
+ringbuf_is_mirrored(const struct ringbuf_t *rb)
+{
+    return (rb->flags & RINGBUF_MIRRORED) != 0;
+}
+
+int
+ringbuf_eventfd(const struct ringbuf_t *rb)
+{
+    return rb->efd;
+}
+
+size_t
+ringbuf_buffer_size(const struct ringbuf_t *rb)
+{
+    return rb->size;
+}
+
+void
+ringbuf_reset(ringbuf_t rb)
+{
+    atomic_store_explicit(rb->headp, 0, memory_order_relaxed);
+    atomic_store_explicit(rb->tailp, 0, memory_order_relaxed);
+    rb->tail_cache = 0;
+    rb->head_cache = 0;
+    if (rb->zc)
+        rb->zc->npending = 0;
+
+    /* Discard a pass-through ring buffer's data. */
+    if (rb->pipefd[0] >= 0) {
+        char scratch[4096];
+        while (read(rb->pipefd[0], scratch, sizeof(scratch)) > 0)
+            ;
+    }
+}
+
+#if defined(RINGBUF_STATS)
+static uint64_t
+ringbuf_counter(const atomic_uint_least64_t *counter)
+{
+    return atomic_load_explicit((atomic_uint_least64_t *) counter,
+                                memory_order_relaxed);
+}
+#endif
+
+int
+ringbuf_stats_snapshot(const struct ringbuf_t *rb,
+                       struct ringbuf_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+#if defined(RINGBUF_STATS)
+    const struct ringbuf_counters *p = &rb->producer_stats;
+    const struct ringbuf_counters *c = &rb->consumer_stats;
+    stats->bytes_in = ringbuf_counter(&p->bytes);
+    stats->bytes_out = ringbuf_counter(&c->bytes);
+    stats->overflows = ringbuf_counter(&p->overflows);
+    stats->bytes_lost = ringbuf_counter(&p->bytes_lost);
+    stats->max_used = ringbuf_counter(&p->max_used);
+    stats->wrap_splits = ringbuf_counter(&p->wrap_splits) +
+        ringbuf_counter(&c->wrap_splits);
+    stats->syscalls = ringbuf_counter(&p->syscalls) +
+        ringbuf_counter(&c->syscalls);
+    stats->short_reads = ringbuf_counter(&p->short_ios);
+    stats->short_writes = ringbuf_counter(&c->short_ios);
+    return 1;
+#else
+    (void) rb;
+    return 0;
+#endif
+}
+
+void
+ringbuf_stats_reset(ringbuf_t rb)
+{
+#if defined(RINGBUF_STATS)
+    struct ringbuf_counters *sides[2] = {
+        &rb->producer_stats, &rb->consumer_stats
+    };
+    size_t i;
+    for (i = 0; i != 2; ++i) {
+        atomic_init(&sides[i]->bytes, 0);
+        atomic_init(&sides[i]->wrap_splits, 0);
+        atomic_init(&sides[i]->syscalls, 0);
+        atomic_init(&sides[i]->short_ios, 0);
+        atomic_init(&sides[i]->overflows, 0);
+        atomic_init(&sides[i]->bytes_lost, 0);
+        atomic_init(&sides[i]->max_used, 0);
+    }
+#else
+    (void) rb;
+#endif
+}
+
+/*
+ * Returns non-zero if rb's buffer was allocated together with rb
+ * itself, or placed right after it by ringbuf_init.
+ */
+static int
+ringbuf_has_inline_buf(const struct ringbuf_t *rb)
+{
+    return (uintptr_t) rb->buf == (uintptr_t) rb + RINGBUF_INLINE_OFFSET;
+}
+
+/*
+ * Release rb's buffer, if rb owns it.
+ */
+static void
+ringbuf_free_buf(ringbuf_t rb)
+{
+    if (rb->shm) {
+        munmap(rb->shm, rb->shm_len);
+        close(rb->shm_fd);
+    } else if (ringbuf_is_mirrored(rb))
+        munmap(rb->buf, 2 * ringbuf_buffer_size(rb));
+    else if (rb->map_len)
+        munmap(rb->buf, rb->map_len);
+    else if (rb->external) {
+        if (rb->locked)
+            munlock(rb->buf, ringbuf_buffer_size(rb));
+    } else if (!ringbuf_has_inline_buf(rb))
+        free(rb->buf);
+}
+
+/*
+ * Release everything rb owns, other than the ring buffer object
+ * itself.
+ */
+static void
+ringbuf_release(ringbuf_t rb)
+{
+    ringbuf_free_buf(rb);
+    if (rb->efd >= 0)
+        close(rb->efd);
+    if (rb->pipefd[0] >= 0) {
+        close(rb->pipefd[0]);
+        close(rb->pipefd[1]);
+    }
+    free(rb->zc);
+#if !defined(__linux__)
+    pthread_cond_destroy(&rb->cond);
+    pthread_mutex_destroy(&rb->lock);
+#endif
+}
+
+static void
+ringbuf_pool_put(ringbuf_t rb);
+
+void
+ringbuf_free(ringbuf_t *rb)
+{
+    assert(rb && *rb);
+    if ((*rb)->pool)
+        ringbuf_pool_put(*rb);
+    else {
+        ringbuf_release(*rb);
+        if (!(*rb)->inplace)
+            free(*rb);
+    }
+    *rb = 0;
+}
+
+size_t
+ringbuf_capacity(const struct ringbuf_t *rb)
+{
+    if (ringbuf_is_pow2(rb))
+        return ringbuf_buffer_size(rb);
+    return ringbuf_buffer_size(rb) - 1;
+}
+
+/*
+ * Return the offset into rb's contiguous buffer of the head or tail
+ * index idx. You shouldn't normally need to use this function (or
+ * ringbuf_advance) unless you're writing a new ringbuf_* function.
+ */
+static size_t
+ringbuf_offset(const struct ringbuf_t *rb, size_t idx)
+{
+    return idx & rb->mask;
+}
+
+/*
+ * Advance the head or tail index idx of ring buffer rb by n bytes,
+ * where n is no larger than ringbuf_buffer_size(rb), and return the
+ * new index.
+ */
+static size_t
+ringbuf_advance(const struct ringbuf_t *rb, size_t idx, size_t n)
+{
+    assert(n <= ringbuf_buffer_size(rb));
+    idx += n;
+
+    /* Power-of-two indices are free-running; others wrap. */
+    if (!ringbuf_is_pow2(rb) && idx >= ringbuf_buffer_size(rb))
+        idx -= ringbuf_buffer_size(rb);
+    return idx;
+}
+
+/*
+ * The number of contiguous bytes in rb's buffer from the index idx
+ * to the end of the buffer. For mirrored ring buffers, the end of the
+ * buffer is the end of the second mapping, so this is never less
+ * than ringbuf_buffer_size(rb).
+ */
+static size_t
+ringbuf_contiguous(const struct ringbuf_t *rb, size_t idx)
+{
+    size_t end = ringbuf_buffer_size(rb);
+    if (ringbuf_is_mirrored(rb))
+        end *= 2;
+    return end - ringbuf_offset(rb, idx);
+}
+
+/*
+ * The number of bytes, up to count, that a producer may write at
+ * index idx in one piece. This is ringbuf_contiguous, except that,
+ * for mirrored ring buffers, it's no more than
+ * ringbuf_buffer_size(rb): a larger piece would write some bytes
+ * twice, once through each mapping, leaving the buffer's contents
+ * to depend on the order in which memcpy(3) or read(2) happens to
+ * store them.
+ */
+static size_t
+ringbuf_chunk(const struct ringbuf_t *rb, size_t idx, size_t count)
+{
+    return MIN(MIN(ringbuf_contiguous(rb, idx), ringbuf_buffer_size(rb)),
+               count);
+}
+
+/*
+ * The number of bytes used in rb, given a snapshot of its head and
+ * tail indices.
+ */
+static size_t
+ringbuf_used_between(const struct ringbuf_t *rb, size_t head, size_t tail)
+{
+    if (ringbuf_is_pow2(rb) || head >= tail)
+        return head - tail;
+    else
+        return ringbuf_buffer_size(rb) - (tail - head);
+}
+
+#if defined(RINGBUF_STATS)
+static void
+ringbuf_count_max_used(ringbuf_t rb, size_t used)
+{
+    atomic_uint_least64_t *max_used = &rb->producer_stats.max_used;
+    if (used > atomic_load_explicit(max_used, memory_order_relaxed))
+        atomic_store_explicit(max_used, used, memory_order_relaxed);
+}
+
+/*
+ * Count n bytes added to rb by a producer operation that moved the
+ * head index from old_head to head, and update the high-water mark.
+ * An operation is split if its bytes don't fit between old_head and
+ * the end of the buffer.
+ */
+static void
+ringbuf_count_in(ringbuf_t rb, size_t old_head, size_t head, size_t n)
+{
+    struct ringbuf_counters *stats = &rb->producer_stats;
+    ringbuf_count(&stats->bytes, n);
+    if (n > ringbuf_contiguous(rb, old_head))
+        ringbuf_count(&stats->wrap_splits, 1);
+
+    size_t tail = ringbuf_load_tail(rb, memory_order_acquire);
+    ringbuf_count_max_used(rb, MIN(ringbuf_used_between(rb, head, tail),
+                                   ringbuf_capacity(rb)));
+}
+
+static void
+ringbuf_count_out(ringbuf_t rb, size_t old_tail, size_t n)
+{
+    ringbuf_count(&rb->consumer_stats.bytes, n);
+    if (n > ringbuf_contiguous(rb, old_tail))
+        ringbuf_count(&rb->consumer_stats.wrap_splits, 1);
+}
+#endif
+
+size_t
+ringbuf_bytes_free(const struct ringbuf_t *rb)
+{
+    return ringbuf_capacity(rb) - ringbuf_bytes_used(rb);
+}
+
+size_t
+ringbuf_bytes_used(const struct ringbuf_t *rb)
+{
+    /*
+     * In SPSC mode, one of these two indices belongs to the caller
+     * and cannot change underneath it, so the snapshot is
+     * consistent.
+     */
+    size_t tail = ringbuf_load_tail(rb, memory_order_acquire);
+    size_t head = ringbuf_load_head(rb, memory_order_acquire);
+    return ringbuf_used_between(rb, head, tail);
+}
+
+int
+ringbuf_is_full(const struct ringbuf_t *rb)
+{
+    return ringbuf_bytes_free(rb) == 0;
+}
+
+int
+ringbuf_is_empty(const struct ringbuf_t *rb)
+{
+    return ringbuf_bytes_free(rb) == ringbuf_capacity(rb);
+}
+
+const void *
+ringbuf_tail(const struct ringbuf_t *rb)
+{
+    return rb->buf +
+        ringbuf_offset(rb, ringbuf_load_tail(rb, memory_order_acquire));
+}
+
+const void *
+ringbuf_head(const struct ringbuf_t *rb)
+{
+    return rb->buf +
+        ringbuf_offset(rb, ringbuf_load_head(rb, memory_order_acquire));
+}
+
+/* How many times ringbuf_wait_* polls before going to sleep. */
+#define RINGBUF_WAIT_SPINS 128
+
+static void
+ringbuf_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static long long
+ringbuf_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Wait until avail(rb) is at least min_bytes. waiting is the calling
+ * side's waiting flag, and seq is the other side's sequence number.
+ */
+static int
+ringbuf_wait(ringbuf_t rb, size_t (*avail)(const struct ringbuf_t *),
+             size_t min_bytes, int timeout, atomic_int *waiting,
+             atomic_uint *seq)
+{
+    if (!ringbuf_is_blocking(rb)) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (min_bytes > ringbuf_capacity(rb))
+        return 0;
+
+    int i;
+    for (i = 0; i != RINGBUF_WAIT_SPINS; ++i) {
+        if (avail(rb) >= min_bytes)
+            return 1;
+        if (timeout == 0)
+            return 0;
+        ringbuf_cpu_relax();
+    }
+
+    long long deadline = timeout < 0 ? 0 :
+        ringbuf_now_ns() + (long long) timeout * 1000000;
+    for (;;) {
+        unsigned seen = atomic_load_explicit(seq, memory_order_acquire);
+        atomic_store_explicit(waiting, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (avail(rb) >= min_bytes) {
+            atomic_store_explicit(waiting, 0, memory_order_relaxed);
+            return 1;
+        }
+        long long remaining = -1;
+        if (timeout >= 0) {
+            remaining = deadline - ringbuf_now_ns();
+            if (remaining <= 0) {
+                atomic_store_explicit(waiting, 0, memory_order_relaxed);
+                return 0;
+            }
+        }
+        ringbuf_sleep(rb, seq, seen, remaining);
+        atomic_store_explicit(waiting, 0, memory_order_relaxed);
+    }
+}
+
+int
+ringbuf_wait_readable(ringbuf_t rb, size_t min_bytes, int timeout)
+{
+    return ringbuf_wait(rb, ringbuf_bytes_used, min_bytes, timeout,
+                        &rb->consumer_waiting, &rb->head_seq);
+}
+
+int
+ringbuf_wait_writable(ringbuf_t rb, size_t min_bytes, int timeout)
+{
+    return ringbuf_wait(rb, ringbuf_bytes_free, min_bytes, timeout,
+                        &rb->producer_waiting, &rb->tail_seq);
+}
+
+/*
+ * The number of free bytes in rb, as seen by the producer, whose
+ * head index is head. In SPSC mode, the producer's cached copy of the
+ * tail index is used unless it shows fewer than want bytes free.
+ */
+static size_t
+ringbuf_producer_free(ringbuf_t rb, size_t head, size_t want)
+{
+    if (!ringbuf_is_spsc(rb))
+        return ringbuf_capacity(rb) -
+            ringbuf_used_between(rb, head,
+                                 ringbuf_load_tail(rb, memory_order_acquire));
+
+    size_t nfree = ringbuf_capacity(rb) -
+        ringbuf_used_between(rb, head, rb->tail_cache);
+    if (nfree < want) {
+        rb->tail_cache = ringbuf_load_tail(rb, memory_order_acquire);
+        nfree = ringbuf_capacity(rb) -
+            ringbuf_used_between(rb, head, rb->tail_cache);
+    }
+    return nfree;
+}
+
+/*
+ * The number of bytes used in rb, as seen by the consumer, whose tail
+ * index is tail. In SPSC mode, the consumer's cached copy of the head
+ * index is used unless it shows fewer than want bytes used.
+ */
+static size_t
+ringbuf_consumer_used(ringbuf_t rb, size_t tail, size_t want)
+{
+    if (!ringbuf_is_spsc(rb))
+        return ringbuf_used_between(rb,
+                                    ringbuf_load_head(rb, memory_order_acquire),
+                                    tail);
+
+    size_t used = ringbuf_used_between(rb, rb->head_cache, tail);
+    if (used < want) {
+        rb->head_cache = ringbuf_load_head(rb, memory_order_acquire);
+        used = ringbuf_used_between(rb, rb->head_cache, tail);
+    }
+    return used;
+}
+
+/*
+ * The product a * b, or SIZE_MAX if it would overflow.
+ */
+static size_t
+ringbuf_mul_sat(size_t a, size_t b)
+{
+    if (a && b > SIZE_MAX / a)
+        return SIZE_MAX;
+    return a * b;
+}
+
+/*
+ * The total length of the iovcnt buffers described by iov, or
+ * SIZE_MAX if it would overflow.
+ */
+static size_t
+ringbuf_iov_total(const struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    int i;
+    for (i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len > SIZE_MAX - total)
+            return SIZE_MAX;
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+/*
+ * Returns non-zero if producers may not overwrite old data in rb.
+ * Only the consumer may move the tail index of an SPSC ring buffer,
+ * so SPSC implies no-overwrite.
+ */
+static int
+ringbuf_is_nooverwrite(const struct ringbuf_t *rb)
+{
+    return (rb->flags & (RINGBUF_SPSC | RINGBUF_NOOVERWRITE)) != 0;
+}
+
+/*
+ * A producer is about to add count bytes to rb, which currently has
+ * nfree free bytes. Returns the number of bytes the producer may
+ * write. If the producer may not overwrite old data, either because
+ * of rb's mode or because nooverwrite is non-zero, the count is
+ * clamped to the number of free bytes.
+ */
+static size_t
+ringbuf_producer_count(const struct ringbuf_t *rb, size_t count,
+                       size_t nfree, int nooverwrite)
+{
+    if (nooverwrite || ringbuf_is_nooverwrite(rb))
+        return MIN(count, nfree);
+    return count;
+}
+
+/*
+ * Fix up rb's tail index after a producer operation, which left the
+ * head index at head, has overwritten lost bytes of old data. Never
+ * called in SPSC or no-overwrite mode.
+ */
+static void
+ringbuf_overflow(ringbuf_t rb, size_t head, size_t lost)
+{
+    assert(!ringbuf_is_nooverwrite(rb));
+    if (ringbuf_is_pow2(rb))
+        ringbuf_store_tail(rb, head - ringbuf_capacity(rb), 0);
+    else
+        ringbuf_store_tail(rb, ringbuf_advance(rb, head, 1), 0);
+    assert(ringbuf_is_full(rb));
+#if defined(RINGBUF_STATS)
+    RINGBUF_COUNT(rb->producer_stats, overflows, 1);
+    RINGBUF_COUNT(rb->producer_stats, bytes_lost, lost);
+    ringbuf_count_max_used(rb, ringbuf_capacity(rb));
+#else
+    (void) lost;
+#endif
+}
+
+/*
+ * Describe the count bytes of rb's buffer beginning at index idx,
+ * where count is no larger than ringbuf_buffer_size(rb), with one or
+ * two iovecs (two only if the region wraps around the end of the
+ * buffer). Returns the number of iovecs used.
+ */
+static int
+ringbuf_iovec(const struct ringbuf_t *rb, size_t idx, size_t count,
+              struct iovec iov[2])
+{
+    assert(count <= ringbuf_buffer_size(rb));
+    size_t n = MIN(ringbuf_contiguous(rb, idx), count);
+    iov[0].iov_base = rb->buf + ringbuf_offset(rb, idx);
+    iov[0].iov_len = n;
+    if (n == count)
+        return 1;
+    iov[1].iov_base = rb->buf;
+    iov[1].iov_len = count - n;
+    return 2;
+}
+
+/*
+ * Copy count bytes from the contiguous memory area src into rb's
+ * buffer, beginning at index idx, and return the index following the
+ * last byte copied. Does not modify rb's head or tail.
+ */
+static size_t
+ringbuf_copy_in(ringbuf_t rb, size_t idx, const void *src, size_t count)
+{
+    const uint8_t *u8src = src;
+    size_t nread = 0;
+    while (nread != count) {
+        /* don't copy beyond the end of the buffer */
+        size_t n = ringbuf_chunk(rb, idx, count - nread);
+        memcpy(rb->buf + ringbuf_offset(rb, idx), u8src + nread, n);
+        idx = ringbuf_advance(rb, idx, n);
+        nread += n;
+    }
+    return idx;
+}
+
+/*
+ * Copy count bytes from rb's buffer, beginning at index idx, into the
+ * contiguous memory area dst, and return the index following the
+ * last byte copied. Does not modify rb.
+ */
+static size_t
+ringbuf_copy_out(void *dst, const struct ringbuf_t *rb, size_t idx,
+                 size_t count)
+{
+    uint8_t *u8dst = dst;
+    size_t nwritten = 0;
+    while (nwritten != count) {
+        size_t n = MIN(ringbuf_contiguous(rb, idx), count - nwritten);
+        memcpy(u8dst + nwritten, rb->buf + ringbuf_offset(rb, idx), n);
+        idx = ringbuf_advance(rb, idx, n);
+        nwritten += n;
+    }
+    return idx;
+}
+
+/*
+ * CRC32C (the Castagnoli CRC, as used by iSCSI, SCTP, ext4 and
+ * others). The helpers below work on the CRC's internal state, which
+ * is the bitwise complement of the CRC, so that a checksum spanning
+ * the end of the internal buffer can be carried from one piece to the
+ * next. They use the SSE4.2 or ARMv8 CRC32C instructions if the
+ * compiler targets them (e.g., -msse4.2 or -march=armv8-a+crc), and
+ * otherwise a table.
+ */
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#define RINGBUF_CRC32C_U64(state, v) ((uint32_t) _mm_crc32_u64((state), (v)))
+#define RINGBUF_CRC32C_U8(state, b) _mm_crc32_u8((state), (b))
+#elif defined(__ARM_FEATURE_CRC32) && defined(__aarch64__)
+#define RINGBUF_CRC32C_U64(state, v) __crc32cd((state), (v))
+#define RINGBUF_CRC32C_U8(state, b) __crc32cb((state), (b))
+#else
+static const uint32_t ringbuf_crc32c_table[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4,
+    0xc79a971f, 0x35f1141c, 0x26a1e7e8, 0xd4ca64eb,
+    0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24,
+    0x105ec76f, 0xe235446c, 0xf165b798, 0x030e349b,
+    0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54,
+    0x5d1d08bf, 0xaf768bbc, 0xbc267848, 0x4e4dfb4b,
+    0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35,
+    0xaa64d611, 0x580f5512, 0x4b5fa6e6, 0xb93425e5,
+    0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45,
+    0xf779deae, 0x05125dad, 0x1642ae59, 0xe4292d5a,
+    0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595,
+    0x417b1dbc, 0xb3109ebf, 0xa0406d4b, 0x522bee48,
+    0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687,
+    0x0c38d26c, 0xfe53516f, 0xed03a29b, 0x1f682198,
+    0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38,
+    0xdbfc821c, 0x2997011f, 0x3ac7f2eb, 0xc8ac71e8,
+    0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096,
+    0xa65c047d, 0x5437877e, 0x4767748a, 0xb50cf789,
+    0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46,
+    0x7198540d, 0x83f3d70e, 0x90a324fa, 0x62c8a7f9,
+    0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36,
+    0x3cdb9bdd, 0xceb018de, 0xdde0eb2a, 0x2f8b6829,
+    0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93,
+    0x082f63b7, 0xfa44e0b4, 0xe9141340, 0x1b7f9043,
+    0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3,
+    0x55326b08, 0xa759e80b, 0xb4091bff, 0x466298fc,
+    0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033,
+    0xa24bb5a6, 0x502036a5, 0x4370c551, 0xb11b4652,
+    0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d,
+    0xef087a76, 0x1d63f975, 0x0e330a81, 0xfc588982,
+    0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622,
+    0x38cc2a06, 0xcaa7a905, 0xd9f75af1, 0x2b9cd9f2,
+    0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530,
+    0x0417b1db, 0xf67c32d8, 0xe52cc12c, 0x1747422f,
+    0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0,
+    0xd3d3e1ab, 0x21b862a8, 0x32e8915c, 0xc083125f,
+    0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90,
+    0x9e902e7b, 0x6cfbad78, 0x7fab5e8c, 0x8dc0dd8f,
+    0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1,
+    0x69e9f0d5, 0x9b8273d6, 0x88d28022, 0x7ab90321,
+    0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81,
+    0x34f4f86a, 0xc69f7b69, 0xd5cf889d, 0x27a40b9e,
+    0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351,
+};
+
+#define RINGBUF_CRC32C_U8(state, b) \
+    (ringbuf_crc32c_table[((state) ^ (b)) & 0xff] ^ ((state) >> 8))
+#endif
+
+/*
+ * Update state with the len bytes at p.
+ */
+static uint32_t
+ringbuf_crc32c_bytes(uint32_t state, const uint8_t *p, size_t len)
+{
+#if defined(RINGBUF_CRC32C_U64)
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        state = RINGBUF_CRC32C_U64(state, v);
+        p += sizeof(v);
+    }
+#endif
+    for (; len; --len)
+        state = RINGBUF_CRC32C_U8(state, *p++);
+    return state;
+}
+
+/*
+ * Copy len bytes from src to dst, and update state with them, reading
+ * each byte of src only once.
+ */
+static uint32_t
+ringbuf_crc32c_copy(uint32_t state, uint8_t *dst, const uint8_t *src,
+                    size_t len)
+{
+#if defined(RINGBUF_CRC32C_U64)
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+        uint64_t v;
+        memcpy(&v, src, sizeof(v));
+        memcpy(dst, &v, sizeof(v));
+        state = RINGBUF_CRC32C_U64(state, v);
+        src += sizeof(v);
+        dst += sizeof(v);
+    }
+#endif
+    for (; len; --len) {
+        state = RINGBUF_CRC32C_U8(state, *src);
+        *dst++ = *src++;
+    }
+    return state;
+}
+
+uint32_t
+ringbuf_crc32c_update(uint32_t crc, const void *buf, size_t len)
+{
+    return ~ringbuf_crc32c_bytes(~crc, buf, len);
+}
+
+/*
+ * Like ringbuf_copy_in and ringbuf_copy_out, but also update *state
+ * with the bytes copied.
+ */
+static size_t
+ringbuf_copy_in_crc(ringbuf_t rb, size_t idx, const void *src, size_t count,
+                    uint32_t *state)
+{
+    const uint8_t *u8src = src;
+    size_t nread = 0;
+    while (nread != count) {
+        size_t n = ringbuf_chunk(rb, idx, count - nread);
+        *state = ringbuf_crc32c_copy(*state, rb->buf + ringbuf_offset(rb, idx),
+                                     u8src + nread, n);
+        idx = ringbuf_advance(rb, idx, n);
+        nread += n;
+    }
+    return idx;
+}
+
+static size_t
+ringbuf_copy_out_crc(void *dst, const struct ringbuf_t *rb, size_t idx,
+                     size_t count, uint32_t *state)
+{
+    uint8_t *u8dst = dst;
+    size_t nwritten = 0;
+    while (nwritten != count) {
+        size_t n = MIN(ringbuf_contiguous(rb, idx), count - nwritten);
+        *state = ringbuf_crc32c_copy(*state, u8dst + nwritten,
+                                     rb->buf + ringbuf_offset(rb, idx), n);
+        idx = ringbuf_advance(rb, idx, n);
+        nwritten += n;
+    }
+    return idx;
+}
+
+/*
+ * Resizing moves the contents to a new buffer, allocated the same
+ * way as the old one, so that they begin at the start of the new
+ * buffer: the tail index becomes 0, and the head index is the number
+ * of bytes used.
+ */
+int
+ringbuf_resize(ringbuf_t rb, size_t capacity)
+{
+    size_t used = ringbuf_bytes_used(rb);
+    if (capacity < used || rb->shm || rb->external || rb->pool ||
+        rb->pipefd[0] >= 0 || (rb->zc && rb->zc->npending))
+        return 0;
+    if (ringbuf_is_mirrored(rb)) {
+        long pagesize = sysconf(_SC_PAGESIZE);
+        if (pagesize <= 0)
+            return 0;
+        capacity = MAX(capacity, (size_t) pagesize);
+    }
+    size_t size = ringbuf_size_for(capacity, rb->flags);
+    if (size == 0)
+        return 0;
+    if (size == rb->size)
+        return 1;
+
+    uint8_t *buf;
+    size_t map_len = 0;
+    size_t len = size;
+    if (ringbuf_is_mirrored(rb)) {
+        buf = ringbuf_alloc_mirrored(size);
+        len = 2 * size;
+    } else if (rb->map_len) {
+        buf = ringbuf_alloc_mapped(size, rb->hugepages, &map_len);
+        len = map_len;
+    } else if (ringbuf_is_pow2(rb))
+        buf = ringbuf_alloc_pow2(size);
+    else
+        buf = malloc(size);
+    if (!buf)
+        return 0;
+
+    /*
+     * Bind and lock the new buffer as ringbuf_new_opts did the old
+     * one. Only mapped and mirrored buffers are ever bound or locked.
+     */
+    if ((rb->numa_node >= 0 &&
+         ringbuf_bind_node(buf, len, rb->numa_node) == -1) ||
+        (rb->locked && mlock(buf, len) == -1)) {
+        munmap(buf, len);
+        return 0;
+    }
+
+    ringbuf_copy_out(buf, rb, ringbuf_load_tail(rb, memory_order_relaxed),
+                     used);
+    ringbuf_free_buf(rb);
+    rb->buf = buf;
+    rb->size = size;
+    rb->mask = ringbuf_is_pow2(rb) ? size - 1 : SIZE_MAX;
+    rb->map_len = map_len;
+    atomic_store_explicit(rb->tailp, 0, memory_order_relaxed);
+    atomic_store_explicit(rb->headp, used, memory_order_relaxed);
+    rb->tail_cache = 0;
+    rb->head_cache = used;
+    if (rb->zc)
+        rb->zc->send_idx = 0;
+    return 1;
+}
+
+int
+ringbuf_set_autogrow(ringbuf_t rb, size_t max_capacity)
+{
+    if (ringbuf_is_spsc(rb) || rb->shm || rb->external || rb->pool ||
+        rb->pipefd[0] >= 0)
+        return 0;
+    rb->grow_max = max_capacity;
+    rb->grow_min = ringbuf_capacity(rb);
+    return 1;
+}
+
+int
+ringbuf_shrink(ringbuf_t rb)
+{
+    if (!rb->grow_max)
+        return 0;
+    size_t capacity = MAX(rb->grow_min, ringbuf_bytes_used(rb));
+    if (ringbuf_size_for(capacity, rb->flags) >= rb->size)
+        return 0;
+    return ringbuf_resize(rb, capacity);
+}
+
+/*
+ * A producer is about to add count bytes to rb. If rb grows
+ * automatically, and count is more than the number of free bytes,
+ * grow it, at least doubling its capacity, but never beyond its
+ * maximum capacity. If rb can't grow (enough), the producer goes on
+ * to overwrite old data, or to write fewer bytes, as usual.
+ */
+static void
+ringbuf_autogrow(ringbuf_t rb, size_t count)
+{
+    if (!rb->grow_max)
+        return;
+    size_t capacity = ringbuf_capacity(rb);
+    size_t used = ringbuf_bytes_used(rb);
+    if (count <= capacity - used || capacity >= rb->grow_max)
+        return;
+    size_t want = count > rb->grow_max - used ? rb->grow_max : used + count;
+    if (capacity <= rb->grow_max / 2)
+        want = MAX(want, 2 * capacity);
+    ringbuf_resize(rb, want);
+}
+
+size_t
+ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset)
+{
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (offset >= bytes_used)
+        return bytes_used;
+
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    size_t start = ringbuf_advance(rb, tail, offset);
+    size_t n = MIN(ringbuf_contiguous(rb, start), bytes_used - offset);
+    const uint8_t *p = rb->buf + ringbuf_offset(rb, start);
+    const uint8_t *found = memchr(p, c, n);
+    if (found)
+        return offset + (found - p);
+    else
+        return ringbuf_findchr(rb, c, offset + n);
+}
+
+void *
+ringbuf_reserve(ringbuf_t rb, size_t *len)
+{
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    size_t contiguous = ringbuf_contiguous(rb, head);
+    *len = MIN(contiguous, ringbuf_producer_free(rb, head, contiguous));
+    return rb->buf + ringbuf_offset(rb, head);
+}
+
+void *
+ringbuf_commit(ringbuf_t rb, size_t count)
+{
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    if (count > ringbuf_producer_free(rb, head, count))
+        return 0;
+
+    head = ringbuf_advance(rb, head, count);
+    ringbuf_store_head(rb, head, count);
+    return rb->buf + ringbuf_offset(rb, head);
+}
+
+const void *
+ringbuf_peek(const struct ringbuf_t *rb, size_t *len)
+{
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    *len = MIN(ringbuf_contiguous(rb, tail), ringbuf_bytes_used(rb));
+    return rb->buf + ringbuf_offset(rb, tail);
+}
+
+void *
+ringbuf_consume(ringbuf_t rb, size_t count)
+{
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    if (count > ringbuf_consumer_used(rb, tail, count))
+        return 0;
+
+    tail = ringbuf_advance(rb, tail, count);
+    ringbuf_store_tail(rb, tail, count);
+    return rb->buf + ringbuf_offset(rb, tail);
+}
+
+/*
+ * Vectorized search kernels for ringbuf_findmem. Each one returns the
+ * offset of the first position i in [0, n) at which hay[i] == first
+ * and hay[i + k] == last, where it is known that hay[i + k] is
+ * readable for every such i; or n if there is no such position.
+ * Candidates still have to be checked in full by the caller. This is
+ * the "generic SIMD" substring search: testing the first and last
+ * bytes of the needle together rejects nearly all false positives.
+ */
+#if defined(__AVX2__)
+#define RINGBUF_SIMD_WIDTH 32
+static size_t
+ringbuf_find_pair(const uint8_t *hay, size_t n, uint8_t first, uint8_t last,
+                  size_t k)
+{
+    const __m256i vfirst = _mm256_set1_epi8((char) first);
+    const __m256i vlast = _mm256_set1_epi8((char) last);
+    size_t i;
+    for (i = 0; i + RINGBUF_SIMD_WIDTH <= n; i += RINGBUF_SIMD_WIDTH) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (hay + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (hay + i + k));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, vfirst),
+                             _mm256_cmpeq_epi8(b, vlast)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    for (; i != n; ++i)
+        if (hay[i] == first && hay[i + k] == last)
+            return i;
+    return n;
+}
+#elif defined(__SSE2__)
+#define RINGBUF_SIMD_WIDTH 16
+static size_t
+ringbuf_find_pair(const uint8_t *hay, size_t n, uint8_t first, uint8_t last,
+                  size_t k)
+{
+    const __m128i vfirst = _mm_set1_epi8((char) first);
+    const __m128i vlast = _mm_set1_epi8((char) last);
+    size_t i;
+    for (i = 0; i + RINGBUF_SIMD_WIDTH <= n; i += RINGBUF_SIMD_WIDTH) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (hay + i + k));
+        unsigned mask = (unsigned) _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, vfirst),
+                          _mm_cmpeq_epi8(b, vlast)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    for (; i != n; ++i)
+        if (hay[i] == first && hay[i + k] == last)
+            return i;
+    return n;
+}
+#elif defined(__ARM_NEON)
+#define RINGBUF_SIMD_WIDTH 16
+static size_t
+ringbuf_find_pair(const uint8_t *hay, size_t n, uint8_t first, uint8_t last,
+                  size_t k)
+{
+    const uint8x16_t vfirst = vdupq_n_u8(first);
+    const uint8x16_t vlast = vdupq_n_u8(last);
+    size_t i;
+    for (i = 0; i + RINGBUF_SIMD_WIDTH <= n; i += RINGBUF_SIMD_WIDTH) {
+        uint8x16_t eq = vandq_u8(vceqq_u8(vld1q_u8(hay + i), vfirst),
+                                 vceqq_u8(vld1q_u8(hay + i + k), vlast));
+
+        /* Narrow to a 64-bit mask with 4 bits per byte. */
+        uint64_t mask = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)),
+            0);
+        if (mask)
+            return i + (__builtin_ctzll(mask) >> 2);
+    }
+    for (; i != n; ++i)
+        if (hay[i] == first && hay[i + k] == last)
+            return i;
+    return n;
+}
+#else
+static size_t
+ringbuf_find_pair(const uint8_t *hay, size_t n, uint8_t first, uint8_t last,
+                  size_t k)
+{
+    size_t i = 0;
+    while (i != n) {
+        const uint8_t *p = memchr(hay + i, first, n - i);
+        if (!p)
+            return n;
+        i = p - hay;
+        if (hay[i + k] == last)
+            return i;
+        ++i;
+    }
+    return n;
+}
+#endif
+
+/*
+ * Locate the first occurrence of the len-byte needle that lies
+ * entirely within the contiguous memory area hay of haylen bytes.
+ * Returns its offset, or haylen if there is none. len must be at
+ * least 1.
+ */
+static size_t
+ringbuf_memmem(const uint8_t *hay, size_t haylen, const uint8_t *needle,
+               size_t len)
+{
+    if (len > haylen)
+        return haylen;
+    if (len == 1) {
+        const uint8_t *p = memchr(hay, needle[0], haylen);
+        return p ? (size_t) (p - hay) : haylen;
+    }
+
+    size_t k = len - 1;
+    size_t ncandidates = haylen - k;
+    size_t i = 0;
+    while (i != ncandidates) {
+        i += ringbuf_find_pair(hay + i, ncandidates - i, needle[0],
+                               needle[k], k);
+        if (i == ncandidates)
+            break;
+        if (memcmp(hay + i + 1, needle + 1, len - 2) == 0)
+            return i;
+        ++i;
+    }
+    return haylen;
+}
+
+/*
+ * Compare the len bytes of rb's buffer beginning at index idx, which
+ * may wrap around the end of the buffer, with the memory area s.
+ */
+static int
+ringbuf_memcmp_at(const struct ringbuf_t *rb, size_t idx, const uint8_t *s,
+                  size_t len)
+{
+    size_t n = MIN(ringbuf_contiguous(rb, idx), len);
+    int r = memcmp(rb->buf + ringbuf_offset(rb, idx), s, n);
+    if (r || n == len)
+        return r;
+    return memcmp(rb->buf, s + n, len - n);
+}
+
+size_t
+ringbuf_findmem(const struct ringbuf_t *rb, const void *needle, size_t len,
+                size_t offset)
+{
+    const uint8_t *u8needle = needle;
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (offset >= bytes_used || len > bytes_used - offset)
+        return bytes_used;
+    if (len == 0)
+        return offset;
+
+    /*
+     * The used bytes occupy up to two linear regions: [0, n1) and
+     * [n1, bytes_used), in logical offsets. Search the first region,
+     * then the matches that straddle the two regions, then the
+     * second region.
+     */
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    size_t last = bytes_used - len;
+    size_t n1 = MIN(ringbuf_contiguous(rb, tail), bytes_used);
+    const uint8_t *p1 = rb->buf + ringbuf_offset(rb, tail);
+    size_t i;
+
+    if (offset < n1) {
+        i = offset + ringbuf_memmem(p1 + offset, n1 - offset, u8needle, len);
+        if (i != n1)
+            return i;
+    }
+
+    i = MAX(offset, n1 >= len ? n1 - len + 1 : 0);
+    for (; i < n1 && i <= last; ++i)
+        if (ringbuf_memcmp_at(rb, ringbuf_advance(rb, tail, i), u8needle,
+                              len) == 0)
+            return i;
+
+    i = MAX(offset, n1);
+    if (i < bytes_used) {
+        const uint8_t *p2 = rb->buf + (i - n1);
+        size_t n2 = bytes_used - i;
+        size_t found = ringbuf_memmem(p2, n2, u8needle, len);
+        if (found != n2)
+            return i + found;
+    }
+
+    return bytes_used;
+}
+
+/*
+ * The producer functions below are implemented in terms of these
+ * helpers, which take an extra nooverwrite argument. When it is
+ * non-zero, the producer writes at most the number of free bytes,
+ * regardless of dst's mode.
+ */
+static size_t
+ringbuf_do_memset(ringbuf_t dst, int c, size_t len, int nooverwrite)
+{
+    ringbuf_autogrow(dst, len);
+    size_t head = ringbuf_load_head(dst, memory_order_relaxed);
+    size_t count = MIN(len, ringbuf_buffer_size(dst));
+    size_t nfree = ringbuf_producer_free(dst, head, count);
+    size_t nwritten = 0;
+    count = ringbuf_producer_count(dst, count, nfree, nooverwrite);
+    int overflow = count > nfree;
+
+    while (nwritten != count) {
+
+        /* don't copy beyond the end of the buffer */
+        size_t n = MIN(ringbuf_contiguous(dst, head), count - nwritten);
+        memset(dst->buf + ringbuf_offset(dst, head), c, n);
+        head = ringbuf_advance(dst, head, n);
+        nwritten += n;
+    }
+
+    ringbuf_store_head(dst, head, nwritten);
+    if (overflow)
+        ringbuf_overflow(dst, head, count - nfree);
+
+    return nwritten;
+}
+
+size_t
+ringbuf_memset(ringbuf_t dst, int c, size_t len)
+{
+    return ringbuf_do_memset(dst, c, len, 0);
+}
+
+size_t
+ringbuf_memset_nooverwrite(ringbuf_t dst, int c, size_t len)
+{
+    return ringbuf_do_memset(dst, c, len, 1);
+}
+
+/*
+ * If crc isn't 0, the internal state of a CRC32C to update with the
+ * bytes copied.
+ */
+static size_t
+ringbuf_do_memcpy_into(ringbuf_t dst, const void *src, size_t count,
+                       int nooverwrite, uint32_t *crc)
+{
+    ringbuf_autogrow(dst, count);
+    size_t head = ringbuf_load_head(dst, memory_order_relaxed);
+    size_t nfree = ringbuf_producer_free(dst, head, count);
+    count = ringbuf_producer_count(dst, count, nfree, nooverwrite);
+    int overflow = count > nfree;
+
+    if (crc)
+        head = ringbuf_copy_in_crc(dst, head, src, count, crc);
+    else
+        head = ringbuf_copy_in(dst, head, src, count);
+    ringbuf_store_head(dst, head, count);
+    if (overflow)
+        ringbuf_overflow(dst, head, count - nfree);
+
+    return count;
+}
+
+void *
+ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count)
+{
+    ringbuf_do_memcpy_into(dst, src, count, 0, 0);
+    return dst->buf +
+        ringbuf_offset(dst, ringbuf_load_head(dst, memory_order_relaxed));
+}
+
+void *
+ringbuf_memcpy_into_crc(ringbuf_t dst, const void *src, size_t count,
+                        uint32_t *crc)
+{
+    uint32_t state = ~*crc;
+    ringbuf_do_memcpy_into(dst, src, count, 0, &state);
+    *crc = ~state;
+    return dst->buf +
+        ringbuf_offset(dst, ringbuf_load_head(dst, memory_order_relaxed));
+}
+
+size_t
+ringbuf_memcpy_into_nooverwrite(ringbuf_t dst, const void *src,
+                                size_t count)
+{
+    return ringbuf_do_memcpy_into(dst, src, count, 1, 0);
+}
+
+size_t
+ringbuf_memcpy_into_batch(ringbuf_t dst, const struct iovec *iov, int iovcnt)
+{
+    size_t total = ringbuf_iov_total(iov, iovcnt);
+    ringbuf_autogrow(dst, total);
+    size_t head = ringbuf_load_head(dst, memory_order_relaxed);
+    size_t nfree = ringbuf_producer_free(dst, head, total);
+    size_t nwritten = 0;
+    int i;
+    for (i = 0; i < iovcnt && iov[i].iov_len <= nfree - nwritten; ++i) {
+        head = ringbuf_copy_in(dst, head, iov[i].iov_base, iov[i].iov_len);
+        nwritten += iov[i].iov_len;
+    }
+
+    ringbuf_store_head(dst, head, nwritten);
+    return i;
+}
+
+static ssize_t
+ringbuf_do_read(int fd, ringbuf_t rb, size_t count, int nooverwrite)
+{
+    ringbuf_autogrow(rb, count);
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    size_t nfree = ringbuf_producer_free(rb, head, count);
+
+    /* don't write beyond the end of the buffer */
+    size_t want = ringbuf_producer_count(rb, count, nfree, nooverwrite);
+    if (!want && count) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    count = ringbuf_chunk(rb, head, want);
+    if (count < want)
+        RINGBUF_COUNT(rb->producer_stats, short_ios, 1);
+    RINGBUF_COUNT(rb->producer_stats, syscalls, 1);
+    ssize_t n = read(fd, rb->buf + ringbuf_offset(rb, head), count);
+    if (n > 0) {
+        assert((size_t) n <= count);
+        head = ringbuf_advance(rb, head, n);
+        ringbuf_store_head(rb, head, n);
+
+        /* fix up the tail index if an overflow occurred */
+        if ((size_t) n > nfree)
+            ringbuf_overflow(rb, head, n - nfree);
+    }
+
+    return n;
+}
+
+ssize_t
+ringbuf_read(int fd, ringbuf_t rb, size_t count)
+{
+    return ringbuf_do_read(fd, rb, count, 0);
+}
+
+ssize_t
+ringbuf_read_nooverwrite(int fd, ringbuf_t rb, size_t count)
+{
+    return ringbuf_do_read(fd, rb, count, 1);
+}
+
+static ssize_t
+ringbuf_do_readv(int fd, ringbuf_t rb, size_t count, int nooverwrite)
+{
+    ringbuf_autogrow(rb, count);
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    size_t nfree = ringbuf_producer_free(rb, head, count);
+    struct iovec iov[2];
+
+    size_t want = ringbuf_producer_count(rb, count, nfree, nooverwrite);
+    if (!want && count) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    count = MIN(ringbuf_buffer_size(rb), want);
+    RINGBUF_COUNT(rb->producer_stats, syscalls, 1);
+    ssize_t n = readv(fd, iov, ringbuf_iovec(rb, head, count, iov));
+    if (n > 0) {
+        assert((size_t) n <= count);
+        head = ringbuf_advance(rb, head, n);
+        ringbuf_store_head(rb, head, n);
+
+        /* fix up the tail index if an overflow occurred */
+        if ((size_t) n > nfree)
+            ringbuf_overflow(rb, head, n - nfree);
+    }
+
+    return n;
+}
+
+ssize_t
+ringbuf_readv(int fd, ringbuf_t rb, size_t count)
+{
+    return ringbuf_do_readv(fd, rb, count, 0);
+}
+
+ssize_t
+ringbuf_readv_nooverwrite(int fd, ringbuf_t rb, size_t count)
+{
+    return ringbuf_do_readv(fd, rb, count, 1);
+}
+
+ssize_t
+ringbuf_recv(int sockfd, ringbuf_t rb, size_t count, int flags)
+{
+    ringbuf_autogrow(rb, count);
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    size_t nfree = ringbuf_producer_free(rb, head, count);
+    int peek = (flags & MSG_PEEK) != 0;
+    struct iovec iov[2];
+    struct msghdr msg;
+
+    size_t want = ringbuf_producer_count(rb, count, nfree, peek);
+    if (!want && count) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    count = MIN(ringbuf_buffer_size(rb), want);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = ringbuf_iovec(rb, head, count, iov);
+    RINGBUF_COUNT(rb->producer_stats, syscalls, 1);
+    ssize_t n = recvmsg(sockfd, &msg, flags);
+    if (n > 0 && !peek) {
+        assert((size_t) n <= count);
+        head = ringbuf_advance(rb, head, n);
+        ringbuf_store_head(rb, head, n);
+
+        /* fix up the tail index if an overflow occurred */
+        if ((size_t) n > nfree)
+            ringbuf_overflow(rb, head, n - nfree);
+    }
+
+    return n;
+}
+
+ssize_t
+ringbuf_splice_in(int fd, ringbuf_t rb, size_t count)
+{
+#if defined(__linux__)
+    if (rb->pipefd[1] < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    size_t nfree = ringbuf_producer_free(rb, head, count);
+    if (!nfree && count) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    count = MIN(count, nfree);
+    RINGBUF_COUNT(rb->producer_stats, syscalls, 1);
+    ssize_t n = splice(fd, 0, rb->pipefd[1], 0, count,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+        assert((size_t) n <= count);
+        ringbuf_store_head(rb, ringbuf_advance(rb, head, n), n);
+    }
+
+    return n;
+#else
+    (void) fd;
+    (void) rb;
+    (void) count;
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+void *
+ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count)
+{
+    size_t tail = ringbuf_load_tail(src, memory_order_relaxed);
+    size_t bytes_used = ringbuf_consumer_used(src, tail, count);
+    if (count > bytes_used)
+        return 0;
+
+    tail = ringbuf_copy_out(dst, src, tail, count);
+    ringbuf_store_tail(src, tail, count);
+    assert(ringbuf_is_spsc(src) ||
+           count + ringbuf_bytes_used(src) == bytes_used);
+    return src->buf + ringbuf_offset(src, tail);
+}
+
+void *
+ringbuf_memcpy_from_crc(void *dst, ringbuf_t src, size_t count,
+                        uint32_t *crc)
+{
+    size_t tail = ringbuf_load_tail(src, memory_order_relaxed);
+    size_t bytes_used = ringbuf_consumer_used(src, tail, count);
+    if (count > bytes_used)
+        return 0;
+
+    uint32_t state = ~*crc;
+    tail = ringbuf_copy_out_crc(dst, src, tail, count, &state);
+    *crc = ~state;
+    ringbuf_store_tail(src, tail, count);
+    assert(ringbuf_is_spsc(src) ||
+           count + ringbuf_bytes_used(src) == bytes_used);
+    return src->buf + ringbuf_offset(src, tail);
+}
+
+size_t
+ringbuf_memcpy_from_batch(const struct iovec *iov, int iovcnt, ringbuf_t src)
+{
+    size_t tail = ringbuf_load_tail(src, memory_order_relaxed);
+    size_t bytes_used = ringbuf_consumer_used(src, tail,
+                                              ringbuf_iov_total(iov, iovcnt));
+    size_t nread = 0;
+    int i;
+    for (i = 0; i < iovcnt && iov[i].iov_len <= bytes_used - nread; ++i) {
+        tail = ringbuf_copy_out(iov[i].iov_base, src, tail, iov[i].iov_len);
+        nread += iov[i].iov_len;
+    }
+
+    ringbuf_store_tail(src, tail, nread);
+    return i;
+}
+
+void *
+ringbuf_memcpy_peek(void *dst, const struct ringbuf_t *src, size_t offset,
+                    size_t count)
+{
+    size_t bytes_used = ringbuf_bytes_used(src);
+    if (offset > bytes_used || count > bytes_used - offset)
+        return 0;
+
+    size_t tail = ringbuf_load_tail(src, memory_order_relaxed);
+    ringbuf_copy_out(dst, src, ringbuf_advance(src, tail, offset), count);
+    return dst;
+}
+
+int
+ringbuf_crc32c(const struct ringbuf_t *rb, size_t offset, size_t count,
+               uint32_t *crc)
+{
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (offset > bytes_used || count > bytes_used - offset)
+        return 0;
+
+    size_t idx = ringbuf_advance(rb, ringbuf_load_tail(rb, memory_order_relaxed),
+                                 offset);
+    uint32_t state = ~*crc;
+    while (count) {
+        size_t n = MIN(ringbuf_contiguous(rb, idx), count);
+        state = ringbuf_crc32c_bytes(state, rb->buf + ringbuf_offset(rb, idx),
+                                     n);
+        idx = ringbuf_advance(rb, idx, n);
+        count -= n;
+    }
+    *crc = ~state;
+    return 1;
+}
+
+ssize_t
+ringbuf_write(int fd, ringbuf_t rb, size_t count)
+{
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    size_t bytes_used = ringbuf_consumer_used(rb, tail, count);
+    if (count > bytes_used)
+        return 0;
+
+    if (ringbuf_contiguous(rb, tail) < count) {
+        count = ringbuf_contiguous(rb, tail);
+        RINGBUF_COUNT(rb->consumer_stats, short_ios, 1);
+    }
+    RINGBUF_COUNT(rb->consumer_stats, syscalls, 1);
+    ssize_t n = write(fd, rb->buf + ringbuf_offset(rb, tail), count);
+    if (n > 0) {
+        assert((size_t) n <= count);
+        ringbuf_store_tail(rb, ringbuf_advance(rb, tail, n), n);
+        assert(ringbuf_is_spsc(rb) ||
+               n + ringbuf_bytes_used(rb) == bytes_used);
+    }
+
+    return n;
+}
+
+ssize_t
+ringbuf_writev(int fd, ringbuf_t rb, size_t count)
+{
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    size_t bytes_used = ringbuf_consumer_used(rb, tail, count);
+    if (count > bytes_used)
+        return 0;
+
+    struct iovec iov[2];
+    RINGBUF_COUNT(rb->consumer_stats, syscalls, 1);
+    ssize_t n = writev(fd, iov, ringbuf_iovec(rb, tail, count, iov));
+    if (n > 0) {
+        assert((size_t) n <= count);
+        ringbuf_store_tail(rb, ringbuf_advance(rb, tail, n), n);
+        assert(ringbuf_is_spsc(rb) ||
+               n + ringbuf_bytes_used(rb) == bytes_used);
+    }
+
+    return n;
+}
+
+void
+ringbuf_buffer_iovec(const struct ringbuf_t *rb, struct iovec *iov)
+{
+    iov->iov_base = rb->buf;
+    iov->iov_len = ringbuf_contiguous(rb, 0);
+}
+
+#if defined(RINGBUF_HAVE_IO_URING)
+static void
+ringbuf_uring_sqe(struct io_uring_sqe *sqe, int opcode, int fd,
+                  const void *addr, size_t len, int buf_index)
+{
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->off = (uint64_t) -1; /* the file's current position */
+    sqe->addr = (uintptr_t) addr;
+    sqe->len = len;
+    sqe->buf_index = buf_index;
+}
+#endif
+
+/*
+ * Prepare an io_uring read (if read is non-zero) or write of the
+ * count bytes of rb's buffer at index idx. See
+ * ringbuf_uring_prep_read.
+ */
+static int
+ringbuf_uring_prep(struct io_uring_sqe *sqes, int nsqes, int fd,
+                   ringbuf_t rb, size_t idx, size_t count, int buf_index,
+                   struct iovec iov[2], int read)
+{
+#if defined(RINGBUF_HAVE_IO_URING)
+    count = MIN(count, UINT32_MAX);
+    if (count == 0 || nsqes < 1)
+        return 0;
+
+    if (buf_index < 0) {
+        int iovcnt = ringbuf_iovec(rb, idx, count, iov);
+        ringbuf_uring_sqe(&sqes[0], read ? IORING_OP_READV : IORING_OP_WRITEV,
+                          fd, iov, iovcnt, 0);
+        return 1;
+    }
+
+    /*
+     * Fixed buffers can't be scattered, so a wrapped region takes
+     * two SQEs. They're linked, so that the second runs only after
+     * the first, and is cancelled if the first is short.
+     */
+    int opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    size_t n = MIN(ringbuf_contiguous(rb, idx), count);
+    ringbuf_uring_sqe(&sqes[0], opcode, fd, rb->buf + ringbuf_offset(rb, idx),
+                      n, buf_index);
+    if (n == count || nsqes < 2)
+        return 1;
+    sqes[0].flags |= IOSQE_IO_LINK;
+    ringbuf_uring_sqe(&sqes[1], opcode, fd, rb->buf, count - n, buf_index);
+    return 2;
+#else
+    (void) sqes;
+    (void) nsqes;
+    (void) fd;
+    (void) rb;
+    (void) idx;
+    (void) count;
+    (void) buf_index;
+    (void) iov;
+    (void) read;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int
+ringbuf_uring_prep_read(struct io_uring_sqe *sqes, int nsqes, int fd,
+                        ringbuf_t rb, size_t count, int buf_index)
+{
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    count = MIN(count, ringbuf_producer_free(rb, head, count));
+    return ringbuf_uring_prep(sqes, nsqes, fd, rb, head, count, buf_index,
+                              rb->producer_uring_iov, 1);
+}
+
+int
+ringbuf_uring_prep_write(struct io_uring_sqe *sqes, int nsqes, int fd,
+                         ringbuf_t rb, size_t count, int buf_index)
+{
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    count = MIN(count, ringbuf_consumer_used(rb, tail, count));
+    return ringbuf_uring_prep(sqes, nsqes, fd, rb, tail, count, buf_index,
+                              rb->consumer_uring_iov, 0);
+}
+
+int
+ringbuf_uring_complete_read(ringbuf_t rb, int res)
+{
+    if (res > 0) {
+        size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+        assert((size_t) res <= ringbuf_producer_free(rb, head, res));
+        ringbuf_store_head(rb, ringbuf_advance(rb, head, res), res);
+    }
+    return res;
+}
+
+int
+ringbuf_uring_complete_write(ringbuf_t rb, int res)
+{
+    if (res > 0) {
+        size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+        assert((size_t) res <= ringbuf_consumer_used(rb, tail, res));
+        ringbuf_store_tail(rb, ringbuf_advance(rb, tail, res), res);
+    }
+    return res;
+}
+
+ssize_t
+ringbuf_splice_out(int fd, ringbuf_t rb, size_t count)
+{
+#if defined(__linux__)
+    if (rb->pipefd[0] < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    if (count > ringbuf_consumer_used(rb, tail, count))
+        return 0;
+
+    RINGBUF_COUNT(rb->consumer_stats, syscalls, 1);
+    ssize_t n = splice(rb->pipefd[0], 0, fd, 0, count,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+        assert((size_t) n <= count);
+        ringbuf_store_tail(rb, ringbuf_advance(rb, tail, n), n);
+    }
+
+    return n;
+#else
+    (void) fd;
+    (void) rb;
+    (void) count;
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+/*
+ * Advance rb's tail past the oldest sends which have completed.
+ * Returns the number of bytes released.
+ */
+static size_t
+ringbuf_zc_release(ringbuf_t rb)
+{
+    struct ringbuf_zc *zc = rb->zc;
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    size_t old_tail = tail;
+    while (zc->npending && zc->pending[zc->first].done) {
+        tail = zc->pending[zc->first].end;
+        zc->first = (zc->first + 1) % RINGBUF_ZC_MAX;
+        --zc->npending;
+    }
+    if (tail == old_tail)
+        return 0;
+    size_t n = ringbuf_used_between(rb, tail, old_tail);
+    ringbuf_store_tail(rb, tail, n);
+    return n;
+}
+
+ssize_t
+ringbuf_send(int sockfd, ringbuf_t rb, size_t count, int flags)
+{
+    struct ringbuf_zc *zc = rb->zc;
+    int zerocopy = 0;
+#if defined(MSG_ZEROCOPY)
+    zerocopy = (flags & MSG_ZEROCOPY) != 0;
+    if (zerocopy && !zc) {
+        zc = rb->zc = calloc(1, sizeof(struct ringbuf_zc));
+        if (!zc)
+            return -1;
+    }
+#endif
+
+    /*
+     * While zero-copy sends are in flight, send from the send index,
+     * and queue even ordinary sends behind the zero-copy ones, since
+     * the tail can't move past them.
+     */
+    int queued = zerocopy || (zc && zc->npending);
+    size_t start = ringbuf_load_tail(rb, memory_order_relaxed);
+    if (zc && zc->npending)
+        start = zc->send_idx;
+    if (queued && zc->npending == RINGBUF_ZC_MAX) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    size_t bytes_used = ringbuf_consumer_used(rb, start, count);
+    if (count > bytes_used || (zerocopy && count == 0))
+        return 0;
+
+    struct iovec iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = ringbuf_iovec(rb, start, count, iov);
+    RINGBUF_COUNT(rb->consumer_stats, syscalls, 1);
+    ssize_t n = sendmsg(sockfd, &msg, flags);
+    if (n > 0) {
+        assert((size_t) n <= count);
+        size_t end = ringbuf_advance(rb, start, n);
+        if (queued) {
+            size_t i = (zc->first + zc->npending) % RINGBUF_ZC_MAX;
+            zc->pending[i].seq = zerocopy ? zc->next_seq++ : 0;
+            zc->pending[i].done = !zerocopy;
+            zc->pending[i].end = end;
+            ++zc->npending;
+            zc->send_idx = end;
+            ringbuf_zc_release(rb);
+        } else
+            ringbuf_store_tail(rb, end, n);
+    }
+
+    return n;
+}
+
+ssize_t
+ringbuf_send_complete(int sockfd, ringbuf_t rb)
+{
+    if (!rb->zc || !rb->zc->npending)
+        return 0;
+
+#if defined(SO_EE_ORIGIN_ZEROCOPY)
+    struct ringbuf_zc *zc = rb->zc;
+    for (;;) {
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(struct sock_extended_err) +
+                                sizeof(struct sockaddr_in6))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        RINGBUF_COUNT(rb->consumer_stats, syscalls, 1);
+        if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == IPPROTO_IP &&
+                   cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == IPPROTO_IPV6 &&
+                   cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+            struct sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_errno != 0 ||
+                serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* Sends lo through hi, inclusive, have completed. */
+            uint32_t lo = serr.ee_info, hi = serr.ee_data;
+            size_t i;
+            for (i = 0; i != zc->npending; ++i) {
+                size_t j = (zc->first + i) % RINGBUF_ZC_MAX;
+                if ((uint32_t) (zc->pending[j].seq - lo) <= hi - lo)
+                    zc->pending[j].done = 1;
+            }
+        }
+    }
+
+    return ringbuf_zc_release(rb);
+#else
+    (void) sockfd;
+    return 0;
+#endif
+}
+
+size_t
+ringbuf_send_pending(const struct ringbuf_t *rb)
+{
+    if (!rb->zc || !rb->zc->npending)
+        return 0;
+    return ringbuf_used_between(rb, rb->zc->send_idx,
+                                ringbuf_load_tail(rb, memory_order_relaxed));
+}
+
+/*
+ * Returns the number of bytes copied, or SIZE_MAX if count is greater
+ * than the number of bytes used in src.
+ */
+static size_t
+ringbuf_do_copy(ringbuf_t dst, ringbuf_t src, size_t count, int nooverwrite)
+{
+    size_t src_tail = ringbuf_load_tail(src, memory_order_relaxed);
+    size_t src_bytes_used = ringbuf_consumer_used(src, src_tail, count);
+    if (count > src_bytes_used)
+        return SIZE_MAX;
+    ringbuf_autogrow(dst, count);
+    size_t dst_head = ringbuf_load_head(dst, memory_order_relaxed);
+    size_t dst_nfree = ringbuf_producer_free(dst, dst_head, count);
+    count = ringbuf_producer_count(dst, count, dst_nfree, nooverwrite);
+    int overflow = count > dst_nfree;
+
+    size_t ncopied = 0;
+    while (ncopied != count) {
+        size_t nsrc = MIN(ringbuf_contiguous(src, src_tail), count - ncopied);
+        size_t n = ringbuf_chunk(dst, dst_head, nsrc);
+        memcpy(dst->buf + ringbuf_offset(dst, dst_head),
+               src->buf + ringbuf_offset(src, src_tail), n);
+        src_tail = ringbuf_advance(src, src_tail, n);
+        dst_head = ringbuf_advance(dst, dst_head, n);
+        ncopied += n;
+    }
+
+    ringbuf_store_tail(src, src_tail, count);
+    assert(ringbuf_is_spsc(src) ||
+           count + ringbuf_bytes_used(src) == src_bytes_used);
+    
+    ringbuf_store_head(dst, dst_head, count);
+    if (overflow)
+        ringbuf_overflow(dst, dst_head, count - dst_nfree);
+
+    return count;
+}
+
+void *
+ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count)
+{
+    if (ringbuf_do_copy(dst, src, count, 0) == SIZE_MAX)
+        return 0;
+    return dst->buf +
+        ringbuf_offset(dst, ringbuf_load_head(dst, memory_order_relaxed));
+}
+
+size_t
+ringbuf_copy_nooverwrite(ringbuf_t dst, ringbuf_t src, size_t count)
+{
+    size_t n = ringbuf_do_copy(dst, src, count, 1);
+    return n == SIZE_MAX ? 0 : n;
+}
+
+/*
+ * Returns non-zero if ring buffers a and b may trade buffers: they
+ * must be alike in every way that affects how their buffers are
+ * allocated and indexed, neither may be shared with another thread,
+ * and each must own its buffer outright.
+ */
+static int
+ringbuf_can_swap(const struct ringbuf_t *a, const struct ringbuf_t *b)
+{
+    const struct ringbuf_t *rbs[2] = { a, b };
+    int i;
+    if (a == b || a->size != b->size || a->flags != b->flags ||
+        a->map_len != b->map_len || a->locked != b->locked ||
+        a->hugepages != b->hugepages || a->numa_node != b->numa_node)
+        return 0;
+    for (i = 0; i != 2; ++i) {
+        const struct ringbuf_t *rb = rbs[i];
+        if (ringbuf_is_spsc(rb) || rb->shm || rb->external || rb->pool ||
+            rb->pipefd[0] >= 0 || ringbuf_has_inline_buf(rb) ||
+            (rb->zc && rb->zc->npending))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * The index n bytes before idx in rb.
+ */
+static size_t
+ringbuf_retreat(const struct ringbuf_t *rb, size_t idx, size_t n)
+{
+    assert(n <= ringbuf_buffer_size(rb));
+    if (ringbuf_is_pow2(rb))
+        return idx - n;
+    return idx >= n ? idx - n : idx + ringbuf_buffer_size(rb) - n;
+}
+
+/*
+ * Copy the count bytes of the buffer of from beginning at index idx
+ * into rb, beginning at index to, and return the index following the
+ * last byte copied. Modifies neither ring buffer's indices.
+ */
+static size_t
+ringbuf_copy_between(ringbuf_t rb, size_t to, const struct ringbuf_t *from,
+                     size_t idx, size_t count)
+{
+    while (count) {
+        size_t n = MIN(ringbuf_contiguous(from, idx), count);
+        to = ringbuf_copy_in(rb, to, from->buf + ringbuf_offset(from, idx), n);
+        idx = ringbuf_advance(from, idx, n);
+        count -= n;
+    }
+    return to;
+}
+
+void *
+ringbuf_transfer(ringbuf_t dst, ringbuf_t src, size_t count)
+{
+    if (!ringbuf_can_swap(dst, src))
+        return ringbuf_copy(dst, src, count);
+
+    size_t src_used = ringbuf_bytes_used(src);
+    size_t dst_used = ringbuf_bytes_used(dst);
+    if (count > src_used)
+        return 0;
+    size_t rest = src_used - count;
+    size_t src_tail = ringbuf_load_tail(src, memory_order_relaxed);
+    size_t src_head = ringbuf_load_head(src, memory_order_relaxed);
+    size_t dst_tail = ringbuf_load_tail(dst, memory_order_relaxed);
+    size_t head, tail;
+
+    /*
+     * Trade buffers, so that dst takes over src's contents as they
+     * stand, whenever that means copying fewer bytes than count: if
+     * dst is empty, the rest of src's contents (after the first count
+     * bytes) are copied back to src; if src is being emptied, and
+     * dst's contents will fit, they're copied in ahead of src's.
+     */
+    if (dst_used == 0 && rest < count) {
+        tail = src_tail;
+        head = ringbuf_advance(src, src_tail, count);
+    } else if (rest == 0 && dst_used < count &&
+               dst_used <= ringbuf_capacity(dst) - count) {
+        tail = ringbuf_retreat(src, src_tail, dst_used);
+        head = src_head;
+    } else
+        return ringbuf_copy(dst, src, count);
+
+    uint8_t *buf = dst->buf;
+    dst->buf = src->buf;
+    src->buf = buf;
+    ringbuf_reset(src);
+    if (rest)
+        ringbuf_store_head(src, ringbuf_copy_between(src, 0, dst, head, rest),
+                           0);
+    else if (dst_used)
+        ringbuf_copy_between(dst, tail, src, dst_tail, dst_used);
+
+    atomic_store_explicit(dst->tailp, tail, memory_order_relaxed);
+    atomic_store_explicit(dst->headp, head, memory_order_relaxed);
+    dst->tail_cache = tail;
+    dst->head_cache = head;
+    if (dst->zc)
+        dst->zc->send_idx = tail;
+#if defined(RINGBUF_STATS)
+    RINGBUF_COUNT(src->consumer_stats, bytes, count);
+    RINGBUF_COUNT(dst->producer_stats, bytes, count);
+    ringbuf_count_max_used(dst, ringbuf_bytes_used(dst));
+#endif
+    return dst->buf + ringbuf_offset(dst, head);
+}
+
+/*
+ * Records are stored as a native-endian uint32_t length header,
+ * followed immediately by the record's bytes. A record is never split
+ * across the end of the internal buffer: when the producer reaches a
+ * point where the next record won't fit contiguously, it skips the
+ * remaining bytes of the buffer. If at least a header's worth of
+ * bytes remains, it marks the skip with a RINGBUF_RECORD_PAD header;
+ * otherwise the skip is implicit, and the consumer infers it in the
+ * same way. The padding and the record are published together.
+ */
+#define RINGBUF_RECORD_HDR_SIZE sizeof(uint32_t)
+#define RINGBUF_RECORD_PAD UINT32_MAX
+
+void *
+ringbuf_record_push(ringbuf_t rb, const void *src, size_t len)
+{
+    if (len >= RINGBUF_RECORD_PAD ||
+        len > ringbuf_capacity(rb) - MIN(ringbuf_capacity(rb),
+                                         RINGBUF_RECORD_HDR_SIZE))
+        return 0;
+
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    size_t need = RINGBUF_RECORD_HDR_SIZE + len;
+    size_t contiguous = ringbuf_contiguous(rb, head);
+    size_t pad = contiguous < need ? contiguous : 0;
+    if (pad + need > ringbuf_producer_free(rb, head, pad + need))
+        return 0;
+
+    if (pad >= RINGBUF_RECORD_HDR_SIZE) {
+        uint32_t marker = RINGBUF_RECORD_PAD;
+        memcpy(rb->buf + ringbuf_offset(rb, head), &marker, sizeof(marker));
+    }
+    head = ringbuf_advance(rb, head, pad);
+    assert(ringbuf_contiguous(rb, head) >= need);
+
+    uint8_t *p = rb->buf + ringbuf_offset(rb, head);
+    uint32_t hdr = len;
+    memcpy(p, &hdr, sizeof(hdr));
+    memcpy(p + RINGBUF_RECORD_HDR_SIZE, src, len);
+    head = ringbuf_advance(rb, head, need);
+    ringbuf_store_head(rb, head, pad + need);
+    return rb->buf + ringbuf_offset(rb, head);
+}
+
+/*
+ * Locate the record at the front of rb. Returns the number of bytes
+ * of padding that precede it (0 if none), and sets *len to its
+ * length and *p to its header; or returns SIZE_MAX if there is no
+ * record.
+ */
+static size_t
+ringbuf_record_front(const struct ringbuf_t *rb, const uint8_t **p,
+                     size_t *len)
+{
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    size_t pad = 0;
+    if (bytes_used == 0)
+        return SIZE_MAX;
+
+    /* Too little room for a header is padding, like a pad marker. */
+    size_t contiguous = ringbuf_contiguous(rb, tail);
+    uint32_t hdr = RINGBUF_RECORD_PAD;
+    if (contiguous >= RINGBUF_RECORD_HDR_SIZE)
+        memcpy(&hdr, rb->buf + ringbuf_offset(rb, tail), sizeof(hdr));
+    if (hdr == RINGBUF_RECORD_PAD) {
+        pad = contiguous;
+        assert(bytes_used >= pad + RINGBUF_RECORD_HDR_SIZE);
+        tail = ringbuf_advance(rb, tail, pad);
+        memcpy(&hdr, rb->buf + ringbuf_offset(rb, tail), sizeof(hdr));
+    }
+
+    assert(bytes_used >= pad + RINGBUF_RECORD_HDR_SIZE + hdr);
+    *p = rb->buf + ringbuf_offset(rb, tail);
+    *len = hdr;
+    return pad;
+}
+
+const void *
+ringbuf_record_peek(const struct ringbuf_t *rb, size_t *len)
+{
+    const uint8_t *p;
+    if (ringbuf_record_front(rb, &p, len) == SIZE_MAX)
+        return 0;
+    return p + RINGBUF_RECORD_HDR_SIZE;
+}
+
+void *
+ringbuf_record_consume(ringbuf_t rb)
+{
+    const uint8_t *p;
+    size_t len;
+    size_t pad = ringbuf_record_front(rb, &p, &len);
+    if (pad == SIZE_MAX)
+        return 0;
+
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    tail = ringbuf_advance(rb, tail, pad);
+    tail = ringbuf_advance(rb, tail, RINGBUF_RECORD_HDR_SIZE + len);
+    ringbuf_store_tail(rb, tail, pad + RINGBUF_RECORD_HDR_SIZE + len);
+    return rb->buf + ringbuf_offset(rb, tail);
+}
+
+void *
+ringbuf_record_pop(void *dst, ringbuf_t rb, size_t *len)
+{
+    size_t dstlen = *len;
+    const void *record = ringbuf_record_peek(rb, len);
+    if (!record) {
+        *len = 0;
+        return 0;
+    }
+    if (*len > dstlen)
+        return 0;
+    memcpy(dst, record, *len);
+    return ringbuf_record_consume(rb);
+}
+
+size_t
+ringbuf_elems_push(ringbuf_t rb, const void *src, size_t nelems,
+                   size_t elemsize)
+{
+    if (elemsize == 0)
+        return 0;
+
+    ringbuf_autogrow(rb, ringbuf_mul_sat(nelems, elemsize));
+    size_t head = ringbuf_load_head(rb, memory_order_relaxed);
+    size_t nfree = ringbuf_producer_free(rb, head,
+                                         ringbuf_mul_sat(nelems, elemsize));
+    nelems = MIN(nelems, nfree / elemsize);
+    ringbuf_store_head(rb, ringbuf_copy_in(rb, head, src, nelems * elemsize),
+                       nelems * elemsize);
+    return nelems;
+}
+
+size_t
+ringbuf_elems_pop(void *dst, ringbuf_t rb, size_t nelems, size_t elemsize)
+{
+    if (elemsize == 0)
+        return 0;
+
+    size_t tail = ringbuf_load_tail(rb, memory_order_relaxed);
+    size_t bytes_used = ringbuf_consumer_used(rb, tail,
+                                              ringbuf_mul_sat(nelems, elemsize));
+    nelems = MIN(nelems, bytes_used / elemsize);
+    ringbuf_store_tail(rb, ringbuf_copy_out(dst, rb, tail, nelems * elemsize),
+                       nelems * elemsize);
+    return nelems;
+}
+
+/*
+ * MPMC queues.
+ *
+ * This is Dmitry Vyukov's bounded MPMC queue. Each slot has a
+ * sequence number which tells producers and consumers whose turn it
+ * is to use the slot: a producer at position pos may fill the slot
+ * when its sequence number is pos, and a consumer at position pos
+ * may empty it when its sequence number is pos + 1. Producers and
+ * consumers claim positions with a compare-and-swap on enqueue_pos
+ * and dequeue_pos, respectively, which are kept on separate cache
+ * lines.
+ */
+struct ringbuf_mpmc_slot
+{
+    atomic_size_t seq;
+    size_t len;
+    /* followed by slot_size bytes of data */
+};
+
+struct ringbuf_mpmc_t
+{
+    /* Read-only after creation. */
+    uint8_t *slots;
+    size_t nslots;
+    size_t mask;
+    size_t slot_size;
+    size_t stride;
+
+    _Alignas(RINGBUF_CACHELINE_SIZE) atomic_size_t enqueue_pos;
+    _Alignas(RINGBUF_CACHELINE_SIZE) atomic_size_t dequeue_pos;
+};
+
+static struct ringbuf_mpmc_slot *
+ringbuf_mpmc_slot(const struct ringbuf_mpmc_t *q, size_t pos)
+{
+    return (struct ringbuf_mpmc_slot *)
+        (q->slots + (pos & q->mask) * q->stride);
+}
+
+ringbuf_mpmc_t
+ringbuf_mpmc_new(size_t nslots, size_t slot_size)
+{
+    const size_t align = _Alignof(struct ringbuf_mpmc_slot);
+    size_t hdr_size = sizeof(struct ringbuf_mpmc_slot);
+    if (slot_size > SIZE_MAX - hdr_size - align)
+        return 0;
+    size_t stride = (hdr_size + slot_size + align - 1) / align * align;
+
+    nslots = ringbuf_roundup_pow2(MAX(nslots, 1));
+    if (nslots == 0 || nslots > SIZE_MAX / stride)
+        return 0;
+
+    ringbuf_mpmc_t q;
+    if (posix_memalign((void **) &q, RINGBUF_CACHELINE_SIZE,
+                       sizeof(struct ringbuf_mpmc_t)) != 0)
+        return 0;
+    q->slots = ringbuf_alloc_pow2(nslots * stride);
+    if (!q->slots) {
+        free(q);
+        return 0;
+    }
+    q->nslots = nslots;
+    q->mask = nslots - 1;
+    q->slot_size = slot_size;
+    q->stride = stride;
+    ringbuf_mpmc_reset(q);
+    return q;
+}
+
+void
+ringbuf_mpmc_free(ringbuf_mpmc_t *q)
+{
+    assert(q && *q);
+    free((*q)->slots);
+    free(*q);
+    *q = 0;
+}
+
+void
+ringbuf_mpmc_reset(ringbuf_mpmc_t q)
+{
+    size_t i;
+    for (i = 0; i != q->nslots; ++i)
+        atomic_store_explicit(&ringbuf_mpmc_slot(q, i)->seq, i,
+                              memory_order_relaxed);
+    atomic_store_explicit(&q->enqueue_pos, 0, memory_order_relaxed);
+    atomic_store_explicit(&q->dequeue_pos, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+size_t
+ringbuf_mpmc_capacity(const struct ringbuf_mpmc_t *q)
+{
+    return q->nslots;
+}
+
+size_t
+ringbuf_mpmc_slot_size(const struct ringbuf_mpmc_t *q)
+{
+    return q->slot_size;
+}
+
+size_t
+ringbuf_mpmc_size(const struct ringbuf_mpmc_t *q)
+{
+    size_t tail = atomic_load_explicit((atomic_size_t *) &q->dequeue_pos,
+                                       memory_order_acquire);
+    size_t head = atomic_load_explicit((atomic_size_t *) &q->enqueue_pos,
+                                       memory_order_acquire);
+
+    /* The snapshot may be inconsistent under concurrent use. */
+    ptrdiff_t n = (ptrdiff_t) (head - tail);
+    if (n < 0)
+        return 0;
+    return MIN((size_t) n, q->nslots);
+}
+
+int
+ringbuf_mpmc_try_push(ringbuf_mpmc_t q, const void *src, size_t len)
+{
+    if (len > q->slot_size)
+        return 0;
+
+    struct ringbuf_mpmc_slot *slot;
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        slot = ringbuf_mpmc_slot(q, pos);
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t) (seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return 0; /* full */
+        else
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    }
+
+    slot->len = len;
+    memcpy(slot + 1, src, len);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 1;
+}
+
+int
+ringbuf_mpmc_try_pop(void *dst, ringbuf_mpmc_t q, size_t *len)
+{
+    struct ringbuf_mpmc_slot *slot;
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        slot = ringbuf_mpmc_slot(q, pos);
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t) (seq - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos,
+                                                      pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return 0; /* empty */
+        else
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    }
+
+    *len = slot->len;
+    memcpy(dst, slot + 1, slot->len);
+    atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+    return 1;
+}
+
+/*
+ * Ring buffer pools.
+ *
+ * A pool carves all of its ring buffers, and their buffers, out of a
+ * single region, laid out as by ringbuf_init, one size class after
+ * another. Each size class has two free lists of ring buffers, linked
+ * through pool_next: one private to the pool's owner, which it pops
+ * and pushes without atomics, and a lock-free stack, remote, onto
+ * which other threads push the ring buffers they free. When its
+ * private list runs dry, the owner takes the whole remote stack with
+ * a single exchange. Since only the owner ever pops the remote stack,
+ * and it always takes the whole thing, there is no ABA problem.
+ */
+struct ringbuf_pool_class
+{
+    size_t capacity;
+    size_t count;
+    size_t align;
+    size_t stride;
+    uint8_t *base;
+    ringbuf_t free;
+
+    _Alignas(RINGBUF_CACHELINE_SIZE) _Atomic(ringbuf_t) remote;
+};
+
+struct ringbuf_pool_t
+{
+    uint8_t *region;
+    pthread_t owner;
+    int lazy_reset;
+    size_t nclasses;
+    struct ringbuf_pool_class *classes;
+};
+
+/*
+ * Each ring buffer in a pool's region takes up a slot, aligned as
+ * ringbuf_inline_align says its buffer must be. The slot begins with
+ * this many bytes of padding, so that the buffer, which follows the
+ * ring buffer object, is aligned too.
+ */
+static size_t
+ringbuf_pool_lead(size_t align)
+{
+    return (RINGBUF_INLINE_OFFSET + align - 1) / align * align -
+        RINGBUF_INLINE_OFFSET;
+}
+
+/*
+ * The size of each slot for a ring buffer of the given capacity and
+ * (implied) flags, whose alignment is align, or 0 if it would be too
+ * large.
+ */
+static size_t
+ringbuf_pool_stride(size_t capacity, int flags, size_t align)
+{
+    size_t size = ringbuf_size_for(capacity, flags);
+    size_t overhead = ringbuf_pool_lead(align) + RINGBUF_INLINE_OFFSET;
+    if (size == 0 || size > SIZE_MAX - overhead - align)
+        return 0;
+    return (overhead + size + align - 1) / align * align;
+}
+
+ringbuf_pool_t
+ringbuf_pool_new(const size_t *capacities, const size_t *counts,
+                 size_t nclasses, int flags, int lazy_reset)
+{
+    flags = ringbuf_implied_flags(flags);
+    if (nclasses == 0 || (flags & RINGBUF_MIRRORED) ||
+        nclasses > SIZE_MAX / sizeof(struct ringbuf_pool_class))
+        return 0;
+
+    ringbuf_pool_t pool = malloc(sizeof(struct ringbuf_pool_t));
+    if (!pool)
+        return 0;
+    if (posix_memalign((void **) &pool->classes, RINGBUF_CACHELINE_SIZE,
+                       nclasses * sizeof(struct ringbuf_pool_class)) != 0) {
+        free(pool);
+        return 0;
+    }
+    pool->region = 0;
+    pool->owner = pthread_self();
+    pool->lazy_reset = lazy_reset;
+    pool->nclasses = nclasses;
+
+    /*
+     * Sort the classes by capacity, smallest first, so that
+     * ringbuf_pool_get can take the first class that fits, and size
+     * the region.
+     */
+    size_t region_size = 0;
+    size_t i, j;
+    for (i = 0; i != nclasses; ++i) {
+        struct ringbuf_pool_class c;
+        c.capacity = capacities[i];
+        c.count = counts[i];
+        c.align = ringbuf_inline_align(ringbuf_size_for(c.capacity, flags),
+                                       flags);
+        c.stride = ringbuf_pool_stride(c.capacity, flags, c.align);
+        if (c.stride == 0 || region_size > SIZE_MAX - c.align ||
+            c.count > (SIZE_MAX - c.align - region_size) / c.stride) {
+            free(pool->classes);
+            free(pool);
+            return 0;
+        }
+
+        /* Leave room to align the class's first slot. */
+        region_size += c.align - 1 + c.count * c.stride;
+        for (j = i; j > 0 && pool->classes[j - 1].capacity > c.capacity; --j)
+            pool->classes[j] = pool->classes[j - 1];
+        pool->classes[j] = c;
+    }
+    if (region_size == 0 ||
+        !(pool->region = ringbuf_alloc_pow2(region_size))) {
+        free(pool->classes);
+        free(pool);
+        return 0;
+    }
+
+    /*
+     * Initialize the ring buffers, pushing each class's onto its free
+     * list in reverse, so that they're handed out in address order.
+     */
+    uint8_t *p = pool->region;
+    for (i = 0; i != nclasses; ++i) {
+        struct ringbuf_pool_class *c = &pool->classes[i];
+        p = (uint8_t *) (((uintptr_t) p + c->align - 1) &
+                         ~(uintptr_t) (c->align - 1));
+        c->base = p + ringbuf_pool_lead(c->align);
+        c->free = 0;
+        atomic_init(&c->remote, 0);
+        p += c->count * c->stride;
+    }
+    for (i = 0; i != nclasses; ++i) {
+        struct ringbuf_pool_class *c = &pool->classes[i];
+        for (j = 0; j != c->count; ++j) {
+            ringbuf_t rb = (ringbuf_t) (c->base + j * c->stride);
+            if (ringbuf_init_inplace(rb, c->capacity, flags) == -1) {
+
+                /* Only free the ring buffers initialized so far. */
+                c->count = j;
+                while (++i != nclasses)
+                    pool->classes[i].count = 0;
+                ringbuf_pool_free(&pool);
+                return 0;
+            }
+            rb->pool = pool;
+            rb->pool_class = i;
+        }
+        for (j = c->count; j != 0; --j) {
+            ringbuf_t rb = (ringbuf_t) (c->base + (j - 1) * c->stride);
+            rb->pool_next = c->free;
+            c->free = rb;
+        }
+    }
+    return pool;
+}
+
+void
+ringbuf_pool_free(ringbuf_pool_t *pool)
+{
+    assert(pool && *pool);
+    size_t i, j;
+    for (i = 0; i != (*pool)->nclasses; ++i) {
+        struct ringbuf_pool_class *c = &(*pool)->classes[i];
+        for (j = 0; j != c->count; ++j)
+            ringbuf_release((ringbuf_t) (c->base + j * c->stride));
+    }
+    free((*pool)->region);
+    free((*pool)->classes);
+    free(*pool);
+    *pool = 0;
+}
+
+ringbuf_t
+ringbuf_pool_get(ringbuf_pool_t pool, size_t capacity)
+{
+    size_t i;
+    for (i = 0; i != pool->nclasses; ++i) {
+        struct ringbuf_pool_class *c = &pool->classes[i];
+        if (c->capacity < capacity)
+            continue;
+        if (!c->free && atomic_load_explicit(&c->remote, memory_order_relaxed))
+            c->free = atomic_exchange_explicit(&c->remote, 0,
+                                               memory_order_acquire);
+        ringbuf_t rb = c->free;
+        if (rb) {
+            c->free = rb->pool_next;
+            rb->pool_next = 0;
+            if (pool->lazy_reset)
+                ringbuf_reset(rb);
+            ringbuf_stats_reset(rb);
+            return rb;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Return rb to its pool: onto the private free list, on the pool's
+ * owner thread, or else onto the remote stack.
+ */
+static void
+ringbuf_pool_put(ringbuf_t rb)
+{
+    ringbuf_pool_t pool = rb->pool;
+    struct ringbuf_pool_class *c = &pool->classes[rb->pool_class];
+    if (!pool->lazy_reset)
+        ringbuf_reset(rb);
+    if (pthread_equal(pthread_self(), pool->owner)) {
+        rb->pool_next = c->free;
+        c->free = rb;
+        return;
+    }
+    ringbuf_t top = atomic_load_explicit(&c->remote, memory_order_relaxed);
+    do
+        rb->pool_next = top;
+    while (!atomic_compare_exchange_weak_explicit(&c->remote, &top, rb,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+/*
+ * Chained ring buffers.
+ *
+ * A chain is a singly-linked list of fixed-size segments, from the
+ * oldest, first (where the consumer reads), to the newest, last
+ * (where the producer writes). The used bytes of each segment are
+ * data[start..end). The producer appends to the last segment until
+ * it's full, then links a new one; the consumer frees a segment when
+ * it has consumed all of it, except for the last segment, which it
+ * empties and keeps. Freed segments are kept on a short spare list,
+ * for reuse, before they're returned to the heap.
+ *
+ * A segment from one chain can be linked into another chain with the
+ * same segment size as it stands, which is how ringbuf_chain_copy
+ * moves whole segments without copying their contents.
+ */
+#define RINGBUF_CHAIN_SPARE 4
+#define RINGBUF_CHAIN_IOV 16
+
+struct ringbuf_chain_seg
+{
+    struct ringbuf_chain_seg *next;
+    size_t start;
+    size_t end;
+    uint8_t data[];
+};
+
+struct ringbuf_chain_t
+{
+    size_t segment_size;
+    size_t bytes_used;
+    struct ringbuf_chain_seg *first;
+    struct ringbuf_chain_seg *last;
+    struct ringbuf_chain_seg *spare;
+    size_t nspare;
+};
+
+/*
+ * Take a segment from c's spare list, or allocate a new one. Returns
+ * an empty, unlinked segment, or 0.
+ */
+static struct ringbuf_chain_seg *
+ringbuf_chain_seg_new(ringbuf_chain_t c)
+{
+    struct ringbuf_chain_seg *seg = c->spare;
+    if (seg) {
+        c->spare = seg->next;
+        --c->nspare;
+    } else if (posix_memalign((void **) &seg, RINGBUF_CACHELINE_SIZE,
+                              sizeof(struct ringbuf_chain_seg) +
+                              c->segment_size) != 0)
+        return 0;
+    seg->next = 0;
+    seg->start = seg->end = 0;
+    return seg;
+}
+
+/*
+ * Put the unlinked segment seg on c's spare list, or free it if the
+ * spare list is full.
+ */
+static void
+ringbuf_chain_seg_free(ringbuf_chain_t c, struct ringbuf_chain_seg *seg)
+{
+    if (c->nspare == RINGBUF_CHAIN_SPARE) {
+        free(seg);
+        return;
+    }
+    seg->next = c->spare;
+    c->spare = seg;
+    ++c->nspare;
+}
+
+/*
+ * Append seg, which holds seg->end - seg->start bytes, to c.
+ */
+static void
+ringbuf_chain_link(ringbuf_chain_t c, struct ringbuf_chain_seg *seg)
+{
+    seg->next = 0;
+    if (c->last)
+        c->last->next = seg;
+    else
+        c->first = seg;
+    c->last = seg;
+    c->bytes_used += seg->end - seg->start;
+}
+
+/*
+ * Unlink c's first segment, and return it.
+ */
+static struct ringbuf_chain_seg *
+ringbuf_chain_unlink_first(ringbuf_chain_t c)
+{
+    struct ringbuf_chain_seg *seg = c->first;
+    assert(seg);
+    c->first = seg->next;
+    if (!c->first)
+        c->last = 0;
+    c->bytes_used -= seg->end - seg->start;
+    return seg;
+}
+
+ringbuf_chain_t
+ringbuf_chain_new(size_t segment_size)
+{
+    if (segment_size == 0 ||
+        segment_size > SIZE_MAX - sizeof(struct ringbuf_chain_seg))
+        return 0;
+    ringbuf_chain_t c = malloc(sizeof(struct ringbuf_chain_t));
+    if (!c)
+        return 0;
+    c->segment_size = segment_size;
+    c->bytes_used = 0;
+    c->first = c->last = 0;
+    c->spare = 0;
+    c->nspare = 0;
+    return c;
+}
+
+void
+ringbuf_chain_free(ringbuf_chain_t *c)
+{
+    assert(c && *c);
+    ringbuf_chain_reset(*c);
+    while ((*c)->spare) {
+        struct ringbuf_chain_seg *seg = (*c)->spare;
+        (*c)->spare = seg->next;
+        free(seg);
+    }
+    free(*c);
+    *c = 0;
+}
+
+void
+ringbuf_chain_reset(ringbuf_chain_t c)
+{
+    while (c->first) {
+        struct ringbuf_chain_seg *seg = c->first;
+        c->first = seg->next;
+        ringbuf_chain_seg_free(c, seg);
+    }
+    c->last = 0;
+    c->bytes_used = 0;
+}
+
+size_t
+ringbuf_chain_segment_size(const struct ringbuf_chain_t *c)
+{
+    return c->segment_size;
+}
+
+size_t
+ringbuf_chain_bytes_used(const struct ringbuf_chain_t *c)
+{
+    return c->bytes_used;
+}
+
+int
+ringbuf_chain_is_empty(const struct ringbuf_chain_t *c)
+{
+    return c->bytes_used == 0;
+}
+
+size_t
+ringbuf_chain_memcpy_into(ringbuf_chain_t dst, const void *src, size_t count)
+{
+    const uint8_t *u8src = src;
+    size_t nread = 0;
+    while (nread != count) {
+        struct ringbuf_chain_seg *seg = dst->last;
+        if (!seg || seg->end == dst->segment_size) {
+            if (!(seg = ringbuf_chain_seg_new(dst)))
+                break;
+            ringbuf_chain_link(dst, seg);
+        }
+        size_t n = MIN(dst->segment_size - seg->end, count - nread);
+        memcpy(seg->data + seg->end, u8src + nread, n);
+        seg->end += n;
+        dst->bytes_used += n;
+        nread += n;
+    }
+    return nread;
+}
+
+size_t
+ringbuf_chain_consume(ringbuf_chain_t c, size_t count)
+{
+    if (count > c->bytes_used)
+        return 0;
+    size_t nconsumed = 0;
+    while (nconsumed != count) {
+        struct ringbuf_chain_seg *seg = c->first;
+        size_t n = MIN(seg->end - seg->start, count - nconsumed);
+        seg->start += n;
+        c->bytes_used -= n;
+        nconsumed += n;
+        if (seg->start == seg->end) {
+            if (seg == c->last)
+                seg->start = seg->end = 0;
+            else
+                ringbuf_chain_seg_free(c, ringbuf_chain_unlink_first(c));
+        }
+    }
+    return count;
+}
+
+int
+ringbuf_chain_memcpy_from(void *dst, ringbuf_chain_t src, size_t count)
+{
+    if (count > src->bytes_used)
+        return 0;
+    uint8_t *u8dst = dst;
+    size_t nwritten = 0;
+    const struct ringbuf_chain_seg *seg;
+    for (seg = src->first; nwritten != count; seg = seg->next) {
+        size_t n = MIN(seg->end - seg->start, count - nwritten);
+        memcpy(u8dst + nwritten, seg->data + seg->start, n);
+        nwritten += n;
+    }
+    ringbuf_chain_consume(src, count);
+    return 1;
+}
+
+size_t
+ringbuf_chain_findchr(const struct ringbuf_chain_t *c, int ch, size_t offset)
+{
+    const struct ringbuf_chain_seg *seg;
+    size_t skipped = 0;
+    for (seg = c->first; seg; seg = seg->next) {
+        size_t n = seg->end - seg->start;
+        if (offset < skipped + n) {
+            size_t skip = offset > skipped ? offset - skipped : 0;
+            const uint8_t *p = memchr(seg->data + seg->start + skip, ch,
+                                      n - skip);
+            if (p)
+                return skipped + (p - (seg->data + seg->start));
+        }
+        skipped += n;
+    }
+    return c->bytes_used;
+}
+
+ssize_t
+ringbuf_chain_read(int fd, ringbuf_chain_t c, size_t count)
+{
+    struct iovec iov[RINGBUF_CHAIN_IOV];
+    struct ringbuf_chain_seg *segs[RINGBUF_CHAIN_IOV];
+    int iovcnt = 0;
+    size_t total = 0;
+
+    /*
+     * Read into the free space at the end of the last segment, and
+     * then into new segments, which are only linked into the chain
+     * if the read fills them.
+     */
+    struct ringbuf_chain_seg *last = c->last;
+    if (last && last->end != c->segment_size && count) {
+        iov[0].iov_base = last->data + last->end;
+        iov[0].iov_len = MIN(c->segment_size - last->end, count);
+        total = iov[0].iov_len;
+        segs[0] = last;
+        iovcnt = 1;
+    }
+    while (total != count && iovcnt != RINGBUF_CHAIN_IOV) {
+        struct ringbuf_chain_seg *seg = ringbuf_chain_seg_new(c);
+        if (!seg)
+            break;
+        iov[iovcnt].iov_base = seg->data;
+        iov[iovcnt].iov_len = MIN(c->segment_size, count - total);
+        total += iov[iovcnt].iov_len;
+        segs[iovcnt++] = seg;
+    }
+    if (iovcnt == 0 && count) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ssize_t n = readv(fd, iov, iovcnt);
+    size_t left = n > 0 ? (size_t) n : 0;
+    int i;
+    for (i = 0; i != iovcnt; ++i) {
+        size_t nseg = MIN(left, iov[i].iov_len);
+        left -= nseg;
+        if (segs[i] == last) {
+            last->end += nseg;
+            c->bytes_used += nseg;
+        } else if (nseg) {
+            segs[i]->end = nseg;
+            ringbuf_chain_link(c, segs[i]);
+        } else
+            ringbuf_chain_seg_free(c, segs[i]);
+    }
+    return n;
+}
+
+ssize_t
+ringbuf_chain_write(int fd, ringbuf_chain_t c, size_t count)
+{
+    if (count > c->bytes_used)
+        count = c->bytes_used;
+
+    struct iovec iov[RINGBUF_CHAIN_IOV];
+    int iovcnt = 0;
+    size_t total = 0;
+    const struct ringbuf_chain_seg *seg;
+    for (seg = c->first; seg && total != count && iovcnt != RINGBUF_CHAIN_IOV;
+         seg = seg->next) {
+        iov[iovcnt].iov_base = (void *) (seg->data + seg->start);
+        iov[iovcnt].iov_len = MIN(seg->end - seg->start, count - total);
+        total += iov[iovcnt++].iov_len;
+    }
+
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n > 0) {
+        assert((size_t) n <= total);
+        ringbuf_chain_consume(c, n);
+    }
+    return n;
+}
+
+size_t
+ringbuf_chain_copy(ringbuf_chain_t dst, ringbuf_chain_t src, size_t count)
+{
+    if (count > src->bytes_used || dst == src)
+        return 0;
+
+    size_t ncopied = 0;
+    while (ncopied != count) {
+        struct ringbuf_chain_seg *seg = src->first;
+        size_t n = seg->end - seg->start;
+
+        /* Hand whole segments over by pointer, if they fit. */
+        if (n && n <= count - ncopied &&
+            dst->segment_size == src->segment_size) {
+            ringbuf_chain_link(dst, ringbuf_chain_unlink_first(src));
+            ncopied += n;
+            continue;
+        }
+        n = MIN(n, count - ncopied);
+        size_t m = ringbuf_chain_memcpy_into(dst, seg->data + seg->start, n);
+        ringbuf_chain_consume(src, m);
+        ncopied += m;
+        if (m != n)
+            break;
+    }
+    return ncopied;
 }
@@ -24,13 +24,107 @@
  * (e.g., with ringbuf_read). The ring buffer's tail pointer points to
  * the starting location where data should be read when copying data
  * *from* the buffer (e.g., with ringbuf_write).
+ *
+ * By default, a ring buffer is not safe to use from more than one
+ * thread at a time without external locking. A ring buffer created
+ * with ringbuf_new_spsc may be shared, without locking, by exactly
+ * one producer thread and exactly one consumer thread.
+ *
+ * The producer may call ringbuf_reserve, ringbuf_commit,
+ * ringbuf_memset, ringbuf_memcpy_into, ringbuf_memcpy_into_batch,
+ * ringbuf_read, ringbuf_readv (and the _nooverwrite variants of
+ * these), ringbuf_recv, ringbuf_splice_in, ringbuf_uring_prep_read,
+ * ringbuf_uring_complete_read, ringbuf_wait_writable, and
+ * ringbuf_copy and ringbuf_copy_nooverwrite (as dst).
+ *
+ * The consumer may call ringbuf_peek, ringbuf_consume,
+ * ringbuf_wait_readable, ringbuf_findchr, ringbuf_findmem,
+ * ringbuf_memcpy_peek, ringbuf_memcpy_from,
+ * ringbuf_memcpy_from_batch, ringbuf_write, ringbuf_writev,
+ * ringbuf_send, ringbuf_send_complete, ringbuf_splice_out,
+ * ringbuf_uring_prep_write, ringbuf_uring_complete_write, and
+ * ringbuf_copy and ringbuf_copy_nooverwrite (as src).
+ *
+ * Either side may call the size and pointer query functions, which
+ * return a consistent snapshot of the ring buffer's state. No other
+ * functions may be called while both threads are using the ring
+ * buffer.
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 typedef struct ringbuf_t *ringbuf_t;
 
+struct io_uring_sqe;
+
+/*
+ * Flags for ringbuf_new_ex.
+ *
+ * RINGBUF_SPSC: create a single-producer/single-consumer ring
+ * buffer. See ringbuf_new_spsc.
+ *
+ * RINGBUF_POW2: round the capacity up to the next power of two, and
+ * use the entire internal buffer for data. The head and tail are
+ * free-running counters, so that locating them in the buffer is a
+ * simple mask operation, and no byte is sacrificed to distinguish the
+ * "buffer full" state from the "buffer empty" state. The internal
+ * buffer is page-aligned if it is at least one page in size,
+ * otherwise it is cache line-aligned.
+ *
+ * RINGBUF_MIRRORED: create a power-of-two ring buffer (this flag
+ * implies RINGBUF_POW2) whose internal buffer is mapped twice,
+ * back-to-back, in virtual memory. The capacity is rounded up to at
+ * least one page. In a mirrored ring buffer, the ringbuf_bytes_used
+ * bytes starting at ringbuf_tail, and the ringbuf_bytes_free bytes
+ * starting at ringbuf_head, are always contiguous in memory, even
+ * when they wrap around the end of the buffer; consequently,
+ * ringbuf_read and ringbuf_write never return a short count because
+ * of the wrap. Requires mmap(2) and memfd_create(2) (on Linux) or
+ * shm_open(3) (elsewhere).
+ *
+ * RINGBUF_BLOCKING: create an SPSC ring buffer (this flag implies
+ * RINGBUF_SPSC) that supports ringbuf_wait_readable and
+ * ringbuf_wait_writable. Each producer and consumer operation on a
+ * blocking ring buffer costs an extra memory fence, and a system
+ * call when the other side is asleep.
+ *
+ * RINGBUF_EVENTFD: create a blocking ring buffer (this flag implies
+ * RINGBUF_BLOCKING) with an eventfd(2) that becomes readable when
+ * the producer adds data to the empty ring buffer. See
+ * ringbuf_eventfd. Linux only; elsewhere, ringbuf_new_ex fails when
+ * this flag is given.
+ *
+ * RINGBUF_NOOVERWRITE: never overwrite old data. Producer operations
+ * that would overflow the ring buffer (ringbuf_memset,
+ * ringbuf_memcpy_into, ringbuf_read, ringbuf_readv, and ringbuf_copy)
+ * write at most ringbuf_bytes_free bytes instead, leaving the tail
+ * pointer alone, so that the producer can apply backpressure. SPSC
+ * ring buffers always behave this way. Also see the _nooverwrite
+ * variants of those functions, which apply this policy to any ring
+ * buffer and return the number of bytes written.
+ *
+ * RINGBUF_SPLICE: create a pass-through ring buffer, whose data are
+ * kept in a pipe inside the kernel, rather than in memory. Data are
+ * moved in and out with ringbuf_splice_in and ringbuf_splice_out,
+ * using splice(2), and never copied to user space; the ring buffer's
+ * head and tail pointers count the bytes, so the size query functions
+ * (and ringbuf_wait_readable and ringbuf_wait_writable, with
+ * RINGBUF_BLOCKING) can be used for flow control as usual, but no
+ * other function may be used to access the data. The capacity may be
+ * no larger than the system's maximum pipe size (see pipe(7)). Linux
+ * only; elsewhere, ringbuf_new_ex fails when this flag is given.
+ */
+#define RINGBUF_SPSC 0x1
+#define RINGBUF_POW2 0x2
+#define RINGBUF_MIRRORED 0x4
+#define RINGBUF_BLOCKING 0x8
+#define RINGBUF_EVENTFD 0x10
+#define RINGBUF_NOOVERWRITE 0x20
+#define RINGBUF_SPLICE 0x40
+
 /*
  * Create a new ring buffer with the given capacity (usable
  * bytes). Note that the actual internal buffer size may be one or
@@ -42,10 +136,298 @@ typedef struct ringbuf_t *ringbuf_t;
 ringbuf_t
 ringbuf_new(size_t capacity);
 
+/*
+ * Create a new single-producer/single-consumer ring buffer with the
+ * given capacity (usable bytes). See above for the rules governing
+ * its use from two threads.
+ *
+ * An SPSC ring buffer never overflows: because only the consumer is
+ * permitted to move the tail pointer, producer operations write at
+ * most ringbuf_bytes_free bytes, and excess data is not written.
+ *
+ * Returns the new ring buffer object, or 0 if there's not enough
+ * memory to fulfill the request for the given capacity.
+ */
+ringbuf_t
+ringbuf_new_spsc(size_t capacity);
+
+/*
+ * Create a new ring buffer with the given capacity (usable bytes)
+ * and flags (zero or more of the RINGBUF_* flags defined above, or'd
+ * together). ringbuf_new(capacity) is equivalent to
+ * ringbuf_new_ex(capacity, 0).
+ *
+ * Returns the new ring buffer object, or 0 if there's not enough
+ * memory to fulfill the request for the given capacity.
+ */
+ringbuf_t
+ringbuf_new_ex(size_t capacity, int flags);
+
+/*
+ * Options for ringbuf_new_opts, which control how the ring buffer's
+ * internal buffer is allocated. Initialize them with
+ * ringbuf_opts_init, which sets every option to its default, and then
+ * set the ones you need.
+ *
+ * flags: zero or more of the RINGBUF_* flags, as for ringbuf_new_ex.
+ * Default 0.
+ *
+ * hugepages: back the buffer with huge pages, to reduce TLB misses on
+ * large ring buffers. RINGBUF_HUGEPAGES_THP aligns the buffer to a
+ * 2 MiB boundary and asks for transparent huge pages with
+ * madvise(2); RINGBUF_HUGEPAGES_2M and RINGBUF_HUGEPAGES_1G map the
+ * buffer with MAP_HUGETLB, which fails unless the system has huge
+ * pages of that size reserved. The buffer is rounded up to a whole
+ * number of huge pages. Huge pages of either kind can't be used with
+ * RINGBUF_MIRRORED; asking for both fails with EINVAL, rather than
+ * silently ignoring the hugepages option. Default
+ * RINGBUF_HUGEPAGES_NONE.
+ *
+ * numa_node: bind the buffer's memory to the given NUMA node, with
+ * mbind(2) (Linux only). Default -1, meaning no binding.
+ *
+ * lock: if non-zero, lock the buffer into memory with mlock(2), which
+ * also faults it in. Fails if the locked-memory limit (RLIMIT_MEMLOCK)
+ * is too low. Default 0.
+ *
+ * prefault: if non-zero, touch every page of the buffer when it's
+ * created, so that the first pass through the ring buffer takes no
+ * page faults. Default 0.
+ *
+ * mem, mem_size: use the mem_size bytes at mem, which the caller owns,
+ * as the internal buffer, instead of allocating one. mem_size must be
+ * at least the buffer size implied by the capacity and flags (see
+ * ringbuf_buffer_size). The memory is not freed by ringbuf_free.
+ * External memory can't be mirrored, or used with hugepages or
+ * numa_node (set those up when you allocate it). Default 0.
+ */
+struct ringbuf_opts
+{
+    int flags;
+    int hugepages;
+    int numa_node;
+    int lock;
+    int prefault;
+    void *mem;
+    size_t mem_size;
+};
+
+#define RINGBUF_HUGEPAGES_NONE 0
+#define RINGBUF_HUGEPAGES_THP 1
+#define RINGBUF_HUGEPAGES_2M 2
+#define RINGBUF_HUGEPAGES_1G 3
+
+/*
+ * Set each of the options in opts to its default value.
+ */
+void
+ringbuf_opts_init(struct ringbuf_opts *opts);
+
+/*
+ * Create a new ring buffer with the given capacity (usable bytes)
+ * and allocation options. ringbuf_new_ex(capacity, flags) is
+ * equivalent to ringbuf_new_opts with default options, other than
+ * flags.
+ *
+ * Returns the new ring buffer object, or 0 if the buffer can't be
+ * allocated as requested, or, with errno set to EINVAL, if the
+ * options are inconsistent.
+ */
+ringbuf_t
+ringbuf_new_opts(size_t capacity, const struct ringbuf_opts *opts);
+
+/*
+ * The number of bytes of storage that ringbuf_init needs for a ring
+ * buffer with the given capacity (usable bytes) and flags. This
+ * includes room for the ring buffer object itself, for its internal
+ * buffer, and for aligning them (a power-of-two buffer of at least a
+ * page is page-aligned, as RINGBUF_POW2 promises, so it needs up to a
+ * page of padding), so any suitably-sized storage will do, however
+ * it's aligned.
+ *
+ * Returns 0 if the ring buffer can't be placed in caller-provided
+ * storage (mirrored ring buffers can't), or if the size would
+ * overflow a size_t.
+ */
+size_t
+ringbuf_sizeof(size_t capacity, int flags);
+
+/*
+ * Create a new ring buffer with the given capacity (usable bytes)
+ * and flags, as for ringbuf_new_ex, in the storage_size bytes at
+ * storage, which the caller owns. The ring buffer object and its
+ * internal buffer are both placed in the storage, so creating the
+ * ring buffer allocates no heap memory at all, and the storage may
+ * be static, on the stack, or embedded in another object.
+ * storage_size must be at least ringbuf_sizeof(capacity, flags).
+ *
+ * The ring buffer must still be released with ringbuf_free, which
+ * releases any other resources it uses (e.g., the eventfd of a
+ * RINGBUF_EVENTFD ring buffer), but leaves the storage alone. The
+ * storage must outlive the ring buffer, and must not be used for
+ * anything else until the ring buffer has been freed.
+ *
+ * Returns the new ring buffer object, which points into storage, or
+ * 0 if the storage is too small, or if the ring buffer can't be
+ * created with the given flags (RINGBUF_MIRRORED isn't supported).
+ */
+ringbuf_t
+ringbuf_init(void *storage, size_t storage_size, size_t capacity, int flags);
+
+/*
+ * Change the capacity (usable bytes) of a ring buffer, keeping its
+ * contents. The contents are moved to a new buffer, allocated the
+ * same way as the old one (e.g., mirrored, or with the same
+ * ringbuf_opts huge page, NUMA and locking options), where they
+ * begin at the start of the buffer; the old buffer is then freed.
+ * Pointers into the old buffer, and any io_uring registration of it
+ * (see ringbuf_buffer_iovec), are no longer valid.
+ *
+ * No other thread may be using the ring buffer, even if it's an SPSC
+ * ring buffer. The ring buffer must not contain records (see
+ * ringbuf_record_push), whose padding only makes sense at the end of
+ * the old buffer.
+ *
+ * Returns non-zero on success. Returns 0, leaving the ring buffer
+ * unchanged, if the new capacity is smaller than the number of bytes
+ * used, if there's not enough memory (or the new buffer can't be
+ * bound to the NUMA node, or locked), or if the ring buffer can't be
+ * resized: shared, pass-through (RINGBUF_SPLICE) and pooled ring
+ * buffers, ring buffers using external memory (see ringbuf_opts),
+ * and ring buffers with MSG_ZEROCOPY sends in flight can't.
+ */
+int
+ringbuf_resize(ringbuf_t rb, size_t capacity);
+
+/*
+ * Make a ring buffer grow automatically: whenever a producer
+ * function (ringbuf_memset, ringbuf_memcpy_into,
+ * ringbuf_memcpy_into_batch, ringbuf_read, ringbuf_readv,
+ * ringbuf_recv, ringbuf_copy, ringbuf_elems_push, and the
+ * _nooverwrite variants) is asked to write more bytes than are free,
+ * the ring buffer is first resized, at least doubling its capacity,
+ * up to max_capacity (rounded up to a power of two, for a
+ * power-of-two ring buffer). Beyond that, or if the ring buffer
+ * can't be resized, the producer overwrites old data, or writes
+ * fewer bytes, as it would otherwise. A max_capacity of 0 turns
+ * automatic growth off again.
+ *
+ * Since resizing moves the buffer, SPSC ring buffers can't grow
+ * automatically; nor can ring buffers which can't be resized at all
+ * (see ringbuf_resize). Returns non-zero on success, or 0 if rb
+ * can't grow automatically.
+ */
+int
+ringbuf_set_autogrow(ringbuf_t rb, size_t max_capacity);
+
+/*
+ * Shrink an automatically-growing ring buffer back towards the
+ * capacity it had when ringbuf_set_autogrow was called, but no
+ * smaller than the number of bytes it currently holds. Call this
+ * when the ring buffer is idle, e.g., from a timer, to give back the
+ * memory it grew into during a burst.
+ *
+ * Returns non-zero if the ring buffer was shrunk, or 0 if it doesn't
+ * grow automatically, is already as small as it can be, or can't be
+ * resized right now.
+ */
+int
+ringbuf_shrink(ringbuf_t rb);
+
+/*
+ * Create a new SPSC ring buffer, in a shared memory object, which can
+ * be attached by another process (see ringbuf_attach_shm and
+ * ringbuf_attach_fd), so that the producer and the consumer may run
+ * in different processes. The ring buffer is a power-of-two ring
+ * buffer (see RINGBUF_POW2) with at least the given capacity, and
+ * flags may be 0 or RINGBUF_MIRRORED.
+ *
+ * The shared memory object holds a small versioned header, which
+ * describes its layout and holds the head and tail pointers as
+ * offsets rather than pointers, followed by the buffer; each process
+ * may map it at a different address. Once attached, the producer and
+ * consumer exchange data with no system calls, using the same SPSC
+ * protocol as two threads sharing a ring buffer; each process must
+ * confine itself to the functions permitted to its side (see above).
+ * Shared ring buffers cannot be blocking (RINGBUF_BLOCKING).
+ *
+ * If name is not 0, the object is created with shm_open(3) (it must
+ * not already exist), and another process may attach it by name; use
+ * shm_unlink(3) to remove the name when it's no longer needed. If
+ * name is 0, the object is anonymous (a memfd on Linux), and must be
+ * passed to the other process as a file descriptor (see
+ * ringbuf_shm_fd), e.g., over a Unix domain socket or by fork(2).
+ *
+ * Returns the new ring buffer object, or 0 if the shared memory
+ * object could not be created or mapped.
+ */
+ringbuf_t
+ringbuf_new_shm(const char *name, size_t capacity, int flags);
+
+/*
+ * Attach the shared ring buffer created by ringbuf_new_shm with the
+ * given name. Returns a new ring buffer object, which refers to the
+ * same shared buffer, or 0 if the name doesn't exist or doesn't refer
+ * to a compatible shared ring buffer (e.g., one created by a
+ * different version of this library, or by a process with a
+ * different word size).
+ */
+ringbuf_t
+ringbuf_attach_shm(const char *name);
+
+/*
+ * Like ringbuf_attach_shm, but attach the shared ring buffer in the
+ * shared memory object referred to by the file descriptor fd. fd is
+ * duplicated, so the caller may close it afterwards.
+ */
+ringbuf_t
+ringbuf_attach_fd(int fd);
+
+/*
+ * The file descriptor of a shared ring buffer's shared memory object,
+ * for passing to ringbuf_attach_fd in another process, or -1 if rb is
+ * not a shared ring buffer. The file descriptor belongs to the ring
+ * buffer, and is closed by ringbuf_free.
+ */
+int
+ringbuf_shm_fd(const struct ringbuf_t *rb);
+
+/*
+ * Returns non-zero if rb was created with ringbuf_new_spsc, or with
+ * the RINGBUF_SPSC flag.
+ */
+int
+ringbuf_is_spsc(const struct ringbuf_t *rb);
+
+/*
+ * Returns non-zero if rb was created with the RINGBUF_MIRRORED flag.
+ */
+int
+ringbuf_is_mirrored(const struct ringbuf_t *rb);
+
+/*
+ * The eventfd of a ring buffer created with RINGBUF_EVENTFD, or -1
+ * if rb has no eventfd.
+ *
+ * The eventfd is non-blocking, and is signalled each time the
+ * producer adds data to the ring buffer when it is empty, so that the
+ * consumer can wait for data with poll(2), epoll(7) and friends,
+ * alongside other file descriptors. When the eventfd becomes
+ * readable, the consumer should read(2) it to reset it, and then
+ * consume data until the ring buffer is empty: the eventfd is not
+ * signalled again until the producer finds the ring buffer empty.
+ *
+ * The eventfd belongs to the ring buffer, and is closed by
+ * ringbuf_free.
+ */
+int
+ringbuf_eventfd(const struct ringbuf_t *rb);
+
 /*
  * The size of the internal buffer, in bytes. One or more bytes may be
  * unusable in order to distinguish the "buffer full" state from the
- * "buffer empty" state.
+ * "buffer empty" state (except with RINGBUF_POW2, in which case the
+ * buffer size is equal to the capacity).
  *
  * For the usable capacity of the ring buffer, use the
  * ringbuf_capacity function.
@@ -55,17 +437,94 @@ ringbuf_buffer_size(const struct ringbuf_t *rb);
 
 /*
  * Deallocate a ring buffer, and, as a side effect, set the pointer to
- * 0.
+ * 0. A shared ring buffer is unmapped from the calling process; the
+ * shared memory object itself persists until every process that has
+ * it mapped has done so, and its name, if any, has been unlinked. A
+ * ring buffer obtained from a pool (see ringbuf_pool_get) is returned
+ * to its pool.
  */
 void
 ringbuf_free(ringbuf_t *rb);
 
 /*
- * Reset a ring buffer to its initial state (empty).
+ * Reset a ring buffer to its initial state (empty). In SPSC mode,
+ * neither the producer nor the consumer may be using the ring buffer
+ * concurrently.
  */
 void
 ringbuf_reset(ringbuf_t rb);
 
+/*
+ * Statistics. If ringbuf.c is compiled with RINGBUF_STATS defined
+ * (e.g., -DRINGBUF_STATS), each ring buffer counts the following, for
+ * sizing ring buffers and catching silent data loss; otherwise
+ * nothing is counted, and the counting costs nothing.
+ *
+ * bytes_in, bytes_out: the number of bytes added by producer
+ * functions and removed by consumer functions (including record
+ * headers and padding; bytes_lost are not counted as removed).
+ *
+ * overflows, bytes_lost: the number of producer operations that
+ * overwrote data which hadn't been consumed yet, and the number of
+ * bytes overwritten. Both are always 0 in SPSC and no-overwrite mode.
+ *
+ * max_used: the high-water mark of ringbuf_bytes_used, as measured
+ * by the producer after each operation.
+ *
+ * wrap_splits: the number of operations, on either side, whose data
+ * was split in two by the end of the internal buffer (never, in
+ * mirrored mode).
+ *
+ * syscalls: the number of read(2)-, write(2)-, splice(2)- and
+ * send/recv-family system calls made on the ring buffer's behalf.
+ *
+ * short_reads, short_writes: the number of ringbuf_read and
+ * ringbuf_read_nooverwrite calls that asked read(2) for fewer bytes
+ * than requested, because the free space wraps around the end of the
+ * buffer, and likewise the number of ringbuf_write calls that asked
+ * write(2) for fewer bytes than requested. (ringbuf_readv and
+ * ringbuf_writev don't have this problem.)
+ *
+ * The producer's counters are kept on its cache line, and the
+ * consumer's on its own, so enabling statistics doesn't make the
+ * producer and consumer of an SPSC ring buffer share any more data
+ * than they otherwise would, except that the producer loads the tail
+ * index after each operation, to measure max_used. A ring buffer in
+ * shared memory has separate statistics in each process.
+ */
+struct ringbuf_stats
+{
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t overflows;
+    uint64_t bytes_lost;
+    uint64_t max_used;
+    uint64_t wrap_splits;
+    uint64_t syscalls;
+    uint64_t short_reads;
+    uint64_t short_writes;
+};
+
+/*
+ * Fill in *stats with a snapshot of rb's statistics, and return
+ * non-zero; or, if ringbuf.c was compiled without RINGBUF_STATS, set
+ * them all to 0 and return 0. May be called from any thread, while
+ * the ring buffer is in use, though the snapshot is then not
+ * necessarily consistent between the producer's counters and the
+ * consumer's.
+ */
+int
+ringbuf_stats_snapshot(const struct ringbuf_t *rb,
+                       struct ringbuf_stats *stats);
+
+/*
+ * Set all of rb's statistics to 0. As with ringbuf_reset, no other
+ * thread may be using the ring buffer concurrently. A ring buffer
+ * obtained from a pool starts with its statistics reset.
+ */
+void
+ringbuf_stats_reset(ringbuf_t rb);
+
 /*
  * The usable capacity of the ring buffer, in bytes. Note that this
  * value may be less than the ring buffer's internal buffer size, as
@@ -103,6 +562,36 @@ ringbuf_tail(const struct ringbuf_t *rb);
 const void *
 ringbuf_head(const struct ringbuf_t *rb);
 
+/*
+ * Wait until the ring buffer holds at least min_bytes bytes, or until
+ * timeout milliseconds have passed. If timeout is negative, wait
+ * forever; if timeout is 0, don't wait at all.
+ *
+ * The caller first spins briefly, and then sleeps (on a futex on
+ * Linux, otherwise on a condition variable) until the producer
+ * publishes more data. The producer only issues a wakeup when the
+ * consumer is actually asleep.
+ *
+ * rb must have been created with RINGBUF_BLOCKING; if it wasn't,
+ * the function returns 0 immediately, with errno set to EINVAL,
+ * rather than sleeping on a wakeup that would never come. Only the
+ * consumer may call this function.
+ *
+ * Returns non-zero if the ring buffer holds at least min_bytes
+ * bytes, or 0 if the wait timed out. If min_bytes is greater than
+ * the ring buffer's capacity, returns 0 immediately.
+ */
+int
+ringbuf_wait_readable(ringbuf_t rb, size_t min_bytes, int timeout);
+
+/*
+ * Wait until the ring buffer has at least min_bytes bytes free, or
+ * until timeout milliseconds have passed. The counterpart of
+ * ringbuf_wait_readable; only the producer may call this function.
+ */
+int
+ringbuf_wait_writable(ringbuf_t rb, size_t min_bytes, int timeout);
+
 /*
  * Locate the first occurrence of character c (converted to an
  * unsigned char) in ring buffer rb, beginning the search at offset
@@ -117,6 +606,66 @@ ringbuf_head(const struct ringbuf_t *rb);
 size_t
 ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset);
 
+/*
+ * Locate the first occurrence of the len-byte sequence needle in
+ * ring buffer rb, beginning the search at offset bytes from the ring
+ * buffer's tail pointer. The function returns the offset of the
+ * first byte of the sequence from the ring buffer's tail pointer, if
+ * found. If the sequence does not occur in its entirety in the ring
+ * buffer, the function returns the number of bytes used in the ring
+ * buffer. An empty needle is found at offset (if offset is less than
+ * the number of bytes used).
+ *
+ * As with ringbuf_findchr, offsets are logical offsets from the tail
+ * pointer. Matches that wrap around the end of the internal buffer
+ * are found. Where the compiler targets SSE2, AVX2 or NEON, the
+ * search uses vector instructions.
+ */
+size_t
+ringbuf_findmem(const struct ringbuf_t *rb, const void *needle, size_t len,
+                size_t offset);
+
+/*
+ * Zero-copy access for producers. ringbuf_reserve returns rb's head
+ * pointer, and sets *len to the number of free bytes that are
+ * contiguous in memory beginning at that pointer. (Unless rb is
+ * mirrored, this may be less than ringbuf_bytes_free(rb) when the
+ * free region wraps around the end of the internal buffer.) The
+ * caller may write up to *len bytes there, then call ringbuf_commit
+ * to add the first count of them to the ring buffer.
+ *
+ * ringbuf_commit returns the new head pointer. It will *not* allow
+ * the ring buffer to overflow: if count is greater than the number
+ * of free bytes in rb, nothing is committed, and the function
+ * returns 0.
+ */
+void *
+ringbuf_reserve(ringbuf_t rb, size_t *len);
+
+void *
+ringbuf_commit(ringbuf_t rb, size_t count);
+
+/*
+ * Zero-copy access for consumers. ringbuf_peek returns rb's tail
+ * pointer, and sets *len to the number of used bytes that are
+ * contiguous in memory beginning at that pointer. (Unless rb is
+ * mirrored, this may be less than ringbuf_bytes_used(rb) when the
+ * used region wraps around the end of the internal buffer.) The
+ * caller may read up to *len bytes there in place, then call
+ * ringbuf_consume to remove the first count bytes from the ring
+ * buffer.
+ *
+ * ringbuf_consume returns the new tail pointer. It will *not* allow
+ * the ring buffer to underflow: if count is greater than the number
+ * of bytes used in rb, nothing is consumed, and the function returns
+ * 0.
+ */
+const void *
+ringbuf_peek(const struct ringbuf_t *rb, size_t *len);
+
+void *
+ringbuf_consume(ringbuf_t rb, size_t count);
+
 /*
  * Beginning at ring buffer dst's head pointer, fill the ring buffer
  * with a repeating sequence of len bytes, each of value c (converted
@@ -134,11 +683,21 @@ ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset);
  * may be different than it was before the function was called.
  *
  * Returns the actual number of bytes written to dst: len, if
- * len < ringbuf_buffer_size(dst), else ringbuf_buffer_size(dst).
+ * len < ringbuf_buffer_size(dst), else ringbuf_buffer_size(dst). In
+ * SPSC and RINGBUF_NOOVERWRITE modes, at most ringbuf_bytes_free(dst)
+ * bytes are written.
  */
 size_t
 ringbuf_memset(ringbuf_t dst, int c, size_t len);
 
+/*
+ * Like ringbuf_memset, but this function will *not* allow the ring
+ * buffer to overflow, whatever its mode: it writes at most
+ * ringbuf_bytes_free(dst) bytes. Returns the number of bytes written.
+ */
+size_t
+ringbuf_memset_nooverwrite(ringbuf_t dst, int c, size_t len);
+
 /*
  * Copy n bytes from a contiguous memory area src into the ring buffer
  * dst. Returns the ring buffer's new head pointer.
@@ -151,15 +710,42 @@ ringbuf_memset(ringbuf_t dst, int c, size_t len);
  * needed. However, note that, if calling the function results in an
  * overflow, the value of the ring buffer's tail pointer may be
  * different than it was before the function was called.
+ *
+ * In SPSC and RINGBUF_NOOVERWRITE modes, at most
+ * ringbuf_bytes_free(dst) bytes are copied.
  */
 void *
 ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count);
 
+/*
+ * Like ringbuf_memcpy_into, but this function will *not* allow the
+ * ring buffer to overflow, whatever its mode: it copies at most
+ * ringbuf_bytes_free(dst) bytes. Returns the number of bytes copied.
+ */
+size_t
+ringbuf_memcpy_into_nooverwrite(ringbuf_t dst, const void *src,
+                                size_t count);
+
+/*
+ * Copy a batch of buffers, described by the iovcnt iovecs in iov,
+ * into the ring buffer dst, in order. The ring buffer's free space is
+ * computed, and its head pointer updated, only once for the whole
+ * batch. Returns the number of buffers copied.
+ *
+ * Only whole buffers are copied, and this function will *not* allow
+ * the ring buffer to overflow: copying stops at the first buffer that
+ * doesn't fit in the remaining free space.
+ */
+size_t
+ringbuf_memcpy_into_batch(ringbuf_t dst, const struct iovec *iov, int iovcnt);
+
 /*
  * This convenience function calls read(2) on the file descriptor fd,
  * using the ring buffer rb as the destination buffer for the read,
  * and returns the value returned by read(2). It will only call
- * read(2) once, and may return a short count.
+ * read(2) once, and may return a short count. (Unless rb is
+ * mirrored, the count is limited to the number of bytes between the
+ * head pointer and the end of the internal buffer.)
  *
  * It is possible to read more data from the file descriptor than is
  * available in the buffer; i.e., it's possible to overflow the ring
@@ -169,10 +755,89 @@ ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count);
  * fashion, as needed. However, note that, if calling the function
  * results in an overflow, the value of the ring buffer's tail pointer
  * may be different than it was before the function was called.
+ *
+ * In SPSC and RINGBUF_NOOVERWRITE modes, at most
+ * ringbuf_bytes_free(rb) bytes are read. If rb is full, so that no
+ * bytes may be read, read(2) isn't called, and the function returns
+ * -1 with errno set to ENOBUFS, so that a full ring buffer can't be
+ * mistaken for end-of-file. (A count of 0 still calls read(2).)
  */
 ssize_t
 ringbuf_read(int fd, ringbuf_t rb, size_t count);
 
+/*
+ * Like ringbuf_read, but this function will *not* allow the ring
+ * buffer to overflow, whatever its mode: it reads at most
+ * ringbuf_bytes_free(rb) bytes. Returns the value returned by
+ * read(2). If rb is full, read(2) isn't called, and the function
+ * returns -1 with errno set to ENOBUFS.
+ */
+ssize_t
+ringbuf_read_nooverwrite(int fd, ringbuf_t rb, size_t count);
+
+/*
+ * This convenience function is like ringbuf_read, but calls readv(2)
+ * with up to two iovecs, so that a single call can fill the ring
+ * buffer on both sides of the end of its internal buffer. It will
+ * only call readv(2) once, and may return a short count.
+ *
+ * count can be as large as you like, but the function will never
+ * read more than ringbuf_buffer_size(rb) bytes in a single
+ * invocation. As with ringbuf_read, it is possible to overflow the
+ * ring buffer using this function, and the same guarantees apply,
+ * except in SPSC and RINGBUF_NOOVERWRITE modes, where at most
+ * ringbuf_bytes_free(rb) bytes are read; and, as with ringbuf_read,
+ * if rb is full, readv(2) isn't called, and the function returns -1
+ * with errno set to ENOBUFS.
+ */
+ssize_t
+ringbuf_readv(int fd, ringbuf_t rb, size_t count);
+
+/*
+ * Like ringbuf_readv, but this function will *not* allow the ring
+ * buffer to overflow, whatever its mode: it reads at most
+ * ringbuf_bytes_free(rb) bytes, and fails with ENOBUFS if rb is full.
+ */
+ssize_t
+ringbuf_readv_nooverwrite(int fd, ringbuf_t rb, size_t count);
+
+/*
+ * This convenience function is like ringbuf_readv, but receives from
+ * the socket sockfd by calling recvmsg(2) once, with up to two
+ * iovecs, and the given MSG_* flags (e.g., MSG_DONTWAIT). Returns the
+ * value returned by recvmsg(2).
+ *
+ * With MSG_PEEK, the data are received into the free space beginning
+ * at the ring buffer's head pointer, but the head pointer is not
+ * moved, and the data remain queued on the socket; at most
+ * ringbuf_bytes_free(rb) bytes are received, whatever the ring
+ * buffer's mode. Otherwise, the same overflow guarantees apply as for
+ * ringbuf_readv. In either case, if no bytes may be received because
+ * rb is full, recvmsg(2) isn't called, and the function returns -1
+ * with errno set to ENOBUFS.
+ */
+ssize_t
+ringbuf_recv(int sockfd, ringbuf_t rb, size_t count, int flags);
+
+/*
+ * Move up to count bytes from the file descriptor fd into the
+ * pass-through ring buffer rb (see RINGBUF_SPLICE), by calling
+ * splice(2) once, and return the value returned by splice(2). One of
+ * fd or the ring buffer's own pipe must be a pipe, so fd may be any
+ * file descriptor that splice(2) supports as a source, e.g., a file,
+ * socket or pipe.
+ *
+ * This function will *not* allow the ring buffer to overflow: at most
+ * ringbuf_bytes_free(rb) bytes are moved. If rb is full, splice(2)
+ * isn't called, and the function fails with ENOBUFS, as ringbuf_read
+ * does, rather than returning 0, which would look like end-of-file.
+ * It may fail with EAGAIN, even when the ring buffer has free space,
+ * if the pipe has run out of page slots; and with EINVAL if rb is not
+ * a pass-through ring buffer.
+ */
+ssize_t
+ringbuf_splice_in(int fd, ringbuf_t rb, size_t count);
+
 /*
  * Copy n bytes from the ring buffer src, starting from its tail
  * pointer, into a contiguous memory area dst. Returns the value of
@@ -191,12 +856,96 @@ ringbuf_read(int fd, ringbuf_t rb, size_t count);
 void *
 ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count);
 
+/*
+ * Fill a batch of buffers, described by the iovcnt iovecs in iov,
+ * with data from the ring buffer src, in order, starting from its
+ * tail pointer. The ring buffer's used space is computed, and its
+ * tail pointer updated, only once for the whole batch. Returns the
+ * number of buffers filled. As with ringbuf_memcpy_from, this copy is
+ * destructive.
+ *
+ * Only whole buffers are filled, and this function will *not* allow
+ * the ring buffer to underflow: copying stops at the first buffer
+ * that can't be filled completely from the remaining used bytes.
+ */
+size_t
+ringbuf_memcpy_from_batch(const struct iovec *iov, int iovcnt, ringbuf_t src);
+
+/*
+ * Copy count bytes from the ring buffer src, starting offset bytes
+ * from its tail pointer, into a contiguous memory area dst. Returns
+ * dst.
+ *
+ * Unlike ringbuf_memcpy_from, this copy is *not* destructive: src is
+ * not modified. As with ringbuf_findchr, offset is a logical offset
+ * from the tail pointer, and the copied range may wrap around the end
+ * of the internal buffer.
+ *
+ * If offset + count is greater than the number of bytes used in the
+ * ring buffer, no bytes are copied, and the function returns 0.
+ */
+void *
+ringbuf_memcpy_peek(void *dst, const struct ringbuf_t *src, size_t offset,
+                    size_t count);
+
+/*
+ * CRC32C checksums (the Castagnoli CRC used by iSCSI, SCTP and ext4,
+ * among others), computed while copying, so that verifying a message
+ * as it's copied in or out of a ring buffer reads each byte only
+ * once. In each function, crc is a running checksum: pass 0 to begin
+ * a new one, or the result of an earlier call to continue it, so
+ * that, e.g., the checksum of a message copied out in pieces is the
+ * same as that of the whole message. The checksum is unaffected by
+ * where the data wraps around the end of the internal buffer. If
+ * ringbuf.c is compiled for a target with CRC32C instructions
+ * (SSE4.2 on x86-64, e.g., -msse4.2; or ARMv8 with the CRC extension,
+ * e.g., -march=armv8-a+crc), they're used; otherwise a table is.
+ */
+
+/*
+ * Return crc updated with the len bytes at buf. E.g.,
+ * ringbuf_crc32c_update(0, "123456789", 9) is 0xe3069283.
+ */
+uint32_t
+ringbuf_crc32c_update(uint32_t crc, const void *buf, size_t len);
+
+/*
+ * Exactly like ringbuf_memcpy_into, and also update *crc with the
+ * count bytes copied.
+ */
+void *
+ringbuf_memcpy_into_crc(ringbuf_t dst, const void *src, size_t count,
+                        uint32_t *crc);
+
+/*
+ * Exactly like ringbuf_memcpy_from, and also update *crc with the
+ * count bytes copied. If the ring buffer doesn't hold count bytes,
+ * nothing is copied, *crc is unchanged, and the function returns 0.
+ */
+void *
+ringbuf_memcpy_from_crc(void *dst, ringbuf_t src, size_t count,
+                        uint32_t *crc);
+
+/*
+ * Update *crc with the count bytes in the ring buffer rb starting
+ * offset bytes from its tail pointer, without copying or removing
+ * them, and return non-zero. As with ringbuf_memcpy_peek, offset is a
+ * logical offset from the tail pointer; and if offset + count is
+ * greater than the number of bytes used in the ring buffer, *crc is
+ * unchanged, and the function returns 0.
+ */
+int
+ringbuf_crc32c(const struct ringbuf_t *rb, size_t offset, size_t count,
+               uint32_t *crc);
+
 /*
  * This convenience function calls write(2) on the file descriptor fd,
  * using the ring buffer rb as the source buffer for writing (starting
  * at the ring buffer's tail pointer), and returns the value returned
  * by write(2). It will only call write(2) once, and may return a
- * short count.
+ * short count. (Unless rb is mirrored, the count is limited to the
+ * number of bytes between the tail pointer and the end of the
+ * internal buffer.)
  *
  * Note that this copy is destructive with respect to the ring buffer:
  * any bytes written from the ring buffer to the file descriptor are
@@ -214,6 +963,161 @@ ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count);
 ssize_t
 ringbuf_write(int fd, ringbuf_t rb, size_t count);
 
+/*
+ * This convenience function is like ringbuf_write, but calls
+ * writev(2) with up to two iovecs, so that a single call can drain
+ * the ring buffer on both sides of the end of its internal
+ * buffer. It will only call writev(2) once, and may return a short
+ * count.
+ *
+ * As with ringbuf_write, this function will *not* allow the ring
+ * buffer to underflow. If count is greater than the number of bytes
+ * used in the ring buffer, no bytes are written to the file
+ * descriptor, and the function will return 0.
+ */
+ssize_t
+ringbuf_writev(int fd, ringbuf_t rb, size_t count);
+
+/*
+ * Move count bytes from the pass-through ring buffer rb (see
+ * RINGBUF_SPLICE) to the file descriptor fd, e.g., a socket, by
+ * calling splice(2) once, and return the value returned by
+ * splice(2). It may return a short count.
+ *
+ * This function will *not* allow the ring buffer to underflow. If
+ * count is greater than the number of bytes used in the ring buffer,
+ * no bytes are moved, and the function will return 0. It fails with
+ * EINVAL if rb is not a pass-through ring buffer.
+ */
+ssize_t
+ringbuf_splice_out(int fd, ringbuf_t rb, size_t count);
+
+/*
+ * io_uring support.
+ *
+ * These functions let an application that drives its own io_uring
+ * (e.g., with liburing) batch reads into, and writes out of, many
+ * ring buffers per io_uring_enter(2) call. They only fill in SQEs and
+ * account for CQEs; submitting and reaping are up to the caller.
+ */
+
+/*
+ * Describe rb's internal buffer (both mappings, for a mirrored ring
+ * buffer) with the iovec iov, for registration as a fixed buffer with
+ * IORING_REGISTER_BUFFERS. See ringbuf_uring_prep_read.
+ */
+void
+ringbuf_buffer_iovec(const struct ringbuf_t *rb, struct iovec *iov);
+
+/*
+ * Prepare an io_uring read of up to count bytes from fd, at its
+ * current file position, into the ring buffer rb's free space, using
+ * the array of nsqes SQEs sqes. Returns the number of SQEs used,
+ * which is 0 if rb is full or count is 0, or -1 if io_uring is not
+ * supported on this platform. The SQEs are zeroed before they are
+ * filled in, so set their user_data (and any other flags) afterwards.
+ *
+ * If buf_index is negative, a single IORING_OP_READV SQE is used,
+ * covering both sides of the end of the internal buffer. Otherwise,
+ * rb's buffer must have been registered (see ringbuf_buffer_iovec) at
+ * index buf_index of the io_uring's fixed buffers, and
+ * IORING_OP_READ_FIXED SQEs are used: one, or, if the free space
+ * wraps and nsqes is at least 2, two, linked with IOSQE_IO_LINK. A
+ * mirrored ring buffer never needs two.
+ *
+ * The read will *not* overflow the ring buffer: at most
+ * ringbuf_bytes_free(rb) bytes are read. The head pointer is not
+ * moved until the read completes; pass each of its CQEs' results, in
+ * order, to ringbuf_uring_complete_read. Until then, no other read
+ * may be prepared, and no other producer function called, on rb.
+ */
+int
+ringbuf_uring_prep_read(struct io_uring_sqe *sqes, int nsqes, int fd,
+                        ringbuf_t rb, size_t count, int buf_index);
+
+/*
+ * Prepare an io_uring write of up to count bytes from the ring
+ * buffer rb, starting at its tail pointer, to fd. This is the
+ * counterpart of ringbuf_uring_prep_read, using IORING_OP_WRITEV or
+ * IORING_OP_WRITE_FIXED SQEs; it writes at most
+ * ringbuf_bytes_used(rb) bytes, and returns 0 if rb is empty. Pass
+ * each of its CQEs' results, in order, to
+ * ringbuf_uring_complete_write. Until then, no other write may be
+ * prepared, and no other consumer function called, on rb.
+ */
+int
+ringbuf_uring_prep_write(struct io_uring_sqe *sqes, int nsqes, int fd,
+                         ringbuf_t rb, size_t count, int buf_index);
+
+/*
+ * Account for the completion of an SQE prepared by
+ * ringbuf_uring_prep_read, whose CQE's result was res: if res is
+ * positive, advance the head pointer by res bytes. Returns res.
+ */
+int
+ringbuf_uring_complete_read(ringbuf_t rb, int res);
+
+/*
+ * Account for the completion of an SQE prepared by
+ * ringbuf_uring_prep_write, whose CQE's result was res: if res is
+ * positive, advance the tail pointer by res bytes. Returns res.
+ */
+int
+ringbuf_uring_complete_write(ringbuf_t rb, int res);
+
+/*
+ * This convenience function is like ringbuf_writev, but sends to the
+ * socket sockfd by calling sendmsg(2) once, with up to two iovecs,
+ * and the given MSG_* flags (e.g., MSG_DONTWAIT, MSG_MORE). Returns
+ * the value returned by sendmsg(2).
+ *
+ * With MSG_ZEROCOPY (Linux only; the socket must have the SO_ZEROCOPY
+ * option set), the kernel transmits directly from the ring buffer's
+ * memory, so the bytes sent can't be released until the kernel says
+ * it is done with them. Rather than advancing the tail pointer, this
+ * function advances a separate send pointer, and the tail pointer
+ * only moves past the sent bytes when ringbuf_send_complete reads
+ * their completion notifications. Until then, they are still counted
+ * by ringbuf_bytes_used, and ringbuf_send_pending returns their
+ * number. Sends without MSG_ZEROCOPY which are made while zero-copy
+ * sends are pending are queued behind them in the same way.
+ *
+ * The ring buffer tracks up to 64 sends in flight; beyond that, this
+ * function fails with errno set to ENOBUFS until some complete.
+ * While any are in flight, the consumer must not call consumer
+ * functions other than ringbuf_send, ringbuf_send_complete and the
+ * query functions, and sockfd must not be used for zero-copy sends
+ * from any other memory.
+ *
+ * As with ringbuf_write, this function will *not* allow the ring
+ * buffer to underflow. If count is greater than the number of bytes
+ * used but not yet sent, no bytes are sent, and the function will
+ * return 0.
+ */
+ssize_t
+ringbuf_send(int sockfd, ringbuf_t rb, size_t count, int flags);
+
+/*
+ * Read any MSG_ZEROCOPY completion notifications queued on sockfd's
+ * error queue, without blocking, and release the ring buffer space
+ * used by the oldest sends that have completed (see ringbuf_send).
+ * Call this function when poll(2) or epoll(7) reports POLLERR on
+ * sockfd.
+ *
+ * Returns the number of bytes released, which may be 0, or -1 if
+ * reading the error queue failed.
+ */
+ssize_t
+ringbuf_send_complete(int sockfd, ringbuf_t rb);
+
+/*
+ * The number of bytes sent from the ring buffer with MSG_ZEROCOPY
+ * (and any sends queued behind them) which have not yet been
+ * released.
+ */
+size_t
+ringbuf_send_pending(const struct ringbuf_t *rb);
+
 /*
  * Copy count bytes from ring buffer src, starting from its tail
  * pointer, into ring buffer dst. Returns dst's new head pointer after
@@ -233,6 +1137,10 @@ ringbuf_write(int fd, ringbuf_t rb, size_t count);
  * pointer may be different than it was before the function was
  * called.
  *
+ * If dst is an SPSC or RINGBUF_NOOVERWRITE ring buffer, at most
+ * ringbuf_bytes_free(dst) bytes are copied, and only that many bytes
+ * are removed from src.
+ *
  * It is *not* possible to underflow src; if count is greater than the
  * number of bytes used in src, no bytes are copied, and the function
  * returns 0.
@@ -240,4 +1148,398 @@ ringbuf_write(int fd, ringbuf_t rb, size_t count);
 void *
 ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count);
 
+/*
+ * Move count bytes from ring buffer src to ring buffer dst, with the
+ * same result as ringbuf_copy, but, where possible, by trading the
+ * two ring buffers' internal buffers rather than by copying the data:
+ *
+ * - if dst is empty, the buffers are traded, and only the bytes that
+ *   stay behind in src (beyond the first count) are copied back to
+ *   it;
+ *
+ * - if count is all of src's contents, and dst's current contents will
+ *   fit in front of them, the buffers are traded, and only dst's old
+ *   contents are copied.
+ *
+ * Either way, this is only done when it copies fewer bytes than
+ * count. So moving the whole of a ring buffer into an empty one copies
+ * nothing, however large it is.
+ *
+ * Buffers can only be traded between ring buffers created with the
+ * same capacity, flags and allocation options, which own their
+ * buffers separately from the ring buffer object (i.e., power-of-two
+ * ring buffers of at least a page, and mirrored or mmap'd ring
+ * buffers; see ringbuf_new_opts), and which aren't SPSC, shared,
+ * pooled or pass-through ring buffers. Otherwise, this function is
+ * equivalent to ringbuf_copy. Pointers into either ring buffer are no
+ * longer valid afterwards.
+ *
+ * Returns dst's new head pointer, or 0 if count is greater than the
+ * number of bytes used in src.
+ */
+void *
+ringbuf_transfer(ringbuf_t dst, ringbuf_t src, size_t count);
+
+/*
+ * Like ringbuf_copy, but this function will *not* allow dst to
+ * overflow, whatever its mode: it copies at most
+ * ringbuf_bytes_free(dst) bytes, and only that many bytes are
+ * removed from src. Returns the number of bytes copied.
+ *
+ * As with ringbuf_copy, if count is greater than the number of bytes
+ * used in src, no bytes are copied, and the function returns 0.
+ */
+size_t
+ringbuf_copy_nooverwrite(ringbuf_t dst, ringbuf_t src, size_t count);
+
+/*
+ * Framed records.
+ *
+ * These functions treat a ring buffer as a FIFO of variable-length
+ * records, rather than of bytes. Each record is stored with a small
+ * header, and records are never split across the end of the ring
+ * buffer's internal buffer, so that the consumer can always access a
+ * whole record in place. (When a record wouldn't fit before the end
+ * of the buffer, the remaining bytes are skipped as padding, which
+ * counts against the ring buffer's free space.) A ring buffer used
+ * for records must *only* be accessed with these functions and
+ * ringbuf_reset, ringbuf_free, and the size query functions.
+ *
+ * In SPSC mode, the producer may call ringbuf_record_push, and the
+ * consumer may call ringbuf_record_peek, ringbuf_record_consume and
+ * ringbuf_record_pop.
+ */
+
+/*
+ * Add the len-byte record src to rb. Returns the ring buffer's new
+ * head pointer.
+ *
+ * This function will *not* allow the ring buffer to overflow. If
+ * there is not enough free space for the record, its header, and any
+ * padding it needs, nothing is added to the ring buffer, and the
+ * function returns 0. (A record can be no larger than the ring
+ * buffer's capacity less the size of the header.)
+ */
+void *
+ringbuf_record_push(ringbuf_t rb, const void *src, size_t len);
+
+/*
+ * Returns a pointer to the first record in rb, and sets *len to its
+ * length, without removing it from the ring buffer. The record is
+ * contiguous in memory, but note that it is not necessarily aligned.
+ *
+ * If rb contains no records, the function returns 0.
+ */
+const void *
+ringbuf_record_peek(const struct ringbuf_t *rb, size_t *len);
+
+/*
+ * Remove the first record in rb (e.g., after inspecting it with
+ * ringbuf_record_peek). Returns the ring buffer's new tail pointer,
+ * or 0 if rb contains no records.
+ */
+void *
+ringbuf_record_consume(ringbuf_t rb);
+
+/*
+ * Copy the first record in rb into the memory area dst, which is *len
+ * bytes long, and remove it from the ring buffer. Sets *len to the
+ * length of the record and returns the ring buffer's new tail
+ * pointer.
+ *
+ * If rb contains no records, sets *len to 0 and returns 0. If the
+ * record is longer than the original value of *len, the record is
+ * not removed, *len is set to its length, and the function returns
+ * 0.
+ */
+void *
+ringbuf_record_pop(void *dst, ringbuf_t rb, size_t *len);
+
+/*
+ * Fixed-size elements.
+ *
+ * ringbuf_elems_push copies up to nelems elements, each elemsize
+ * bytes long, from the memory area src into rb, and returns the
+ * number of elements copied. Only whole elements are copied, and the
+ * ring buffer will *not* overflow: the function copies no more
+ * elements than will fit in the ring buffer's free space.
+ *
+ * ringbuf_elems_pop copies up to nelems whole elements, each elemsize
+ * bytes long, from rb into the memory area dst, removes them from
+ * the ring buffer, and returns the number of elements copied.
+ *
+ * If a ring buffer is only ever accessed with elements of one size,
+ * and its buffer size is a multiple of that size (for example, a
+ * RINGBUF_POW2 ring buffer of power-of-two-sized elements), no
+ * element is ever split across the end of the internal buffer, and
+ * ringbuf_peek always returns a whole number of elements.
+ */
+size_t
+ringbuf_elems_push(ringbuf_t rb, const void *src, size_t nelems,
+                   size_t elemsize);
+
+size_t
+ringbuf_elems_pop(void *dst, ringbuf_t rb, size_t nelems, size_t elemsize);
+
+/*
+ * MPMC queues.
+ *
+ * A ringbuf_mpmc_t is a bounded multi-producer/multi-consumer queue
+ * of messages, each of which may be up to a fixed slot size in
+ * length. Any number of threads may call ringbuf_mpmc_try_push and
+ * ringbuf_mpmc_try_pop concurrently, without locking; neither
+ * function ever blocks.
+ *
+ * An MPMC queue is message-oriented rather than byte-oriented: it is a
+ * distinct type, and none of the ringbuf_t functions (e.g.,
+ * ringbuf_findchr, ringbuf_copy, ringbuf_read) can be used with it.
+ * Messages must be copied in and out with the functions below.
+ */
+typedef struct ringbuf_mpmc_t *ringbuf_mpmc_t;
+
+/*
+ * Create a new MPMC queue with room for nslots messages (rounded up
+ * to the next power of two), each of up to slot_size bytes.
+ *
+ * Returns the new queue, or 0 if there's not enough memory to
+ * fulfill the request.
+ */
+ringbuf_mpmc_t
+ringbuf_mpmc_new(size_t nslots, size_t slot_size);
+
+/*
+ * Deallocate an MPMC queue, and, as a side effect, set the pointer to
+ * 0. No other thread may be using the queue.
+ */
+void
+ringbuf_mpmc_free(ringbuf_mpmc_t *q);
+
+/*
+ * Reset an MPMC queue to its initial state (empty). No other thread
+ * may be using the queue.
+ */
+void
+ringbuf_mpmc_reset(ringbuf_mpmc_t q);
+
+/*
+ * The number of message slots in the queue.
+ */
+size_t
+ringbuf_mpmc_capacity(const struct ringbuf_mpmc_t *q);
+
+/*
+ * The maximum length of a message in the queue, in bytes.
+ */
+size_t
+ringbuf_mpmc_slot_size(const struct ringbuf_mpmc_t *q);
+
+/*
+ * The number of messages in the queue. When other threads are using
+ * the queue, this is only an approximation.
+ */
+size_t
+ringbuf_mpmc_size(const struct ringbuf_mpmc_t *q);
+
+/*
+ * Copy the len-byte message src into the queue. Returns non-zero on
+ * success, or 0 if the queue is full or len is greater than the
+ * queue's slot size.
+ */
+int
+ringbuf_mpmc_try_push(ringbuf_mpmc_t q, const void *src, size_t len);
+
+/*
+ * Copy the oldest message in the queue into dst, which must have room
+ * for at least ringbuf_mpmc_slot_size(q) bytes, remove it from the
+ * queue, and set *len to its length. Returns non-zero on success, or
+ * 0 if the queue is empty.
+ */
+int
+ringbuf_mpmc_try_pop(void *dst, ringbuf_mpmc_t q, size_t *len);
+
+/*
+ * Ring buffer pools.
+ *
+ * A ringbuf_pool_t preallocates a fixed number of ring buffers in
+ * each of a few size classes, all from a single region of memory, so
+ * that ring buffers can be handed out and returned at a high rate
+ * (e.g., one per connection) without touching the heap, and so that
+ * the memory used by idle ring buffers is bounded and known up front.
+ * Pooled buffers are aligned just as RINGBUF_POW2 describes: a
+ * power-of-two buffer of at least a page is page-aligned, at the cost
+ * of up to a page of padding per ring buffer in the region.
+ *
+ * A pool belongs to the thread that creates it, which is the only
+ * thread that may call ringbuf_pool_get. Any thread may return a ring
+ * buffer to the pool, with ringbuf_free: on the owner thread, this
+ * pushes it onto a private free list; on any other thread, it pushes
+ * it onto a lock-free list, which the owner takes over when its
+ * private list runs dry. Both operations take constant time.
+ */
+typedef struct ringbuf_pool_t *ringbuf_pool_t;
+
+/*
+ * Create a new pool with nclasses size classes: counts[i] ring
+ * buffers with capacity capacities[i] (usable bytes), for each i, all
+ * created with the given flags, as for ringbuf_new_ex
+ * (RINGBUF_MIRRORED isn't supported).
+ *
+ * If lazy_reset is zero, a ring buffer is reset when it's returned to
+ * the pool. Otherwise, it's reset when it's handed out again, on the
+ * owner thread, so that a thread returning it doesn't touch the ring
+ * buffer's indices (which may be on another core's cache lines), and
+ * ring buffers that are never reused are never reset.
+ *
+ * Returns the new pool, or 0 if there's not enough memory to fulfill
+ * the request.
+ */
+ringbuf_pool_t
+ringbuf_pool_new(const size_t *capacities, const size_t *counts,
+                 size_t nclasses, int flags, int lazy_reset);
+
+/*
+ * Deallocate a pool and all of its ring buffers, and, as a side
+ * effect, set the pointer to 0. The ring buffers handed out by the
+ * pool must no longer be in use.
+ */
+void
+ringbuf_pool_free(ringbuf_pool_t *pool);
+
+/*
+ * Take an empty ring buffer with at least the given capacity from
+ * the pool, from the smallest size class that has one free. Only the
+ * thread that created the pool may call this function.
+ *
+ * Returns the ring buffer, or 0 if every ring buffer big enough is in
+ * use.
+ */
+ringbuf_t
+ringbuf_pool_get(ringbuf_pool_t pool, size_t capacity);
+
+/*
+ * Chained ring buffers.
+ *
+ * A ringbuf_chain_t is a byte FIFO with no fixed capacity, made of a
+ * linked list of fixed-size segments. The producer links a new
+ * segment when the last one fills up, and the consumer unlinks each
+ * segment once it has consumed all of it, so the chain grows and
+ * shrinks with its contents and never has to reallocate or move
+ * them. A few emptied segments are kept for reuse.
+ *
+ * Segments can be handed from one chain to another by pointer, so
+ * ringbuf_chain_copy between chains with the same segment size only
+ * copies the bytes of partly-used segments.
+ *
+ * Like an MPMC queue, a chain is a distinct type, which can't be used
+ * with the ringbuf_t functions. It's not safe to use from more than
+ * one thread at a time without external locking.
+ */
+typedef struct ringbuf_chain_t *ringbuf_chain_t;
+
+/*
+ * Create a new, empty chain of segments of segment_size bytes each.
+ *
+ * Returns the new chain, or 0 if there's not enough memory.
+ */
+ringbuf_chain_t
+ringbuf_chain_new(size_t segment_size);
+
+/*
+ * Deallocate a chain and all of its segments, and, as a side effect,
+ * set the pointer to 0.
+ */
+void
+ringbuf_chain_free(ringbuf_chain_t *c);
+
+/*
+ * Discard the contents of a chain.
+ */
+void
+ringbuf_chain_reset(ringbuf_chain_t c);
+
+size_t
+ringbuf_chain_segment_size(const struct ringbuf_chain_t *c);
+
+size_t
+ringbuf_chain_bytes_used(const struct ringbuf_chain_t *c);
+
+int
+ringbuf_chain_is_empty(const struct ringbuf_chain_t *c);
+
+/*
+ * Append count bytes from the contiguous memory area src to the
+ * chain dst. Returns the number of bytes appended, which is less than
+ * count only if a new segment couldn't be allocated.
+ */
+size_t
+ringbuf_chain_memcpy_into(ringbuf_chain_t dst, const void *src, size_t count);
+
+/*
+ * Copy count bytes from the front of the chain src into the
+ * contiguous memory area dst, and remove them from the chain.
+ *
+ * This function will *not* allow the chain to underflow. If count is
+ * greater than the number of bytes in the chain, no bytes are copied,
+ * and the function returns 0. Otherwise, it returns non-zero.
+ */
+int
+ringbuf_chain_memcpy_from(void *dst, ringbuf_chain_t src, size_t count);
+
+/*
+ * Remove count bytes from the front of the chain. Returns count, or 0
+ * (and removes nothing) if count is greater than the number of bytes
+ * in the chain.
+ */
+size_t
+ringbuf_chain_consume(ringbuf_chain_t c, size_t count);
+
+/*
+ * Locate the first occurrence of character ch (converted to an
+ * unsigned char) in the chain, beginning the search at offset bytes
+ * from its front, as ringbuf_findchr does. Returns the offset of the
+ * character from the front of the chain, or, if it's not found, the
+ * number of bytes in the chain.
+ */
+size_t
+ringbuf_chain_findchr(const struct ringbuf_chain_t *c, int ch, size_t offset);
+
+/*
+ * Call readv(2) on the file descriptor fd, to read up to count bytes
+ * into the end of the chain, filling the last segment and as many new
+ * segments as are needed (up to 16 segments per call). Returns the
+ * value returned by readv(2), or -1, with errno set to ENOMEM, if no
+ * segment could be allocated.
+ */
+ssize_t
+ringbuf_chain_read(int fd, ringbuf_chain_t c, size_t count);
+
+/*
+ * Call writev(2) on the file descriptor fd, to write up to count
+ * bytes from the front of the chain, with one iovec per segment (up
+ * to 16 segments per call), and remove the bytes written from the
+ * chain. Returns the value returned by writev(2).
+ */
+ssize_t
+ringbuf_chain_write(int fd, ringbuf_chain_t c, size_t count);
+
+/*
+ * Move count bytes from the front of the chain src to the end of the
+ * chain dst. When the two chains have the same segment size, each
+ * segment at the front of src whose contents all fall within the
+ * count bytes is unlinked from src and linked onto dst by pointer,
+ * however full it is: its bytes aren't copied, and the segment's
+ * memory now belongs to dst, and is freed or reused with dst's. Only
+ * a segment of which just the first part falls within the count
+ * bytes has that part copied into dst, and it stays in src, with the
+ * rest of its contents. When the segment sizes differ, all count
+ * bytes are copied.
+ *
+ * This function will *not* allow src to underflow. Returns the number
+ * of bytes moved: 0 if count is greater than the number of bytes in
+ * src (or dst is src), and less than count only if a new segment
+ * couldn't be allocated.
+ */
+size_t
+ringbuf_chain_copy(ringbuf_chain_t dst, ringbuf_chain_t src, size_t count);
+
 #endif /* INCLUDED_RINGBUF_H */
@@ -0,0 +1,786 @@
+#ifndef INCLUDED_RINGBUF_HPP
+#define INCLUDED_RINGBUF_HPP
+
+/*
+ * ringbuf.hpp - header-only C++ ring buffer (FIFO) templates.
+ *
+ * To the extent possible under law, the author(s) have dedicated all
+ * copyright and related and neighboring rights to this software to
+ * the public domain worldwide. This software is distributed without
+ * any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software. If not, see
+ * <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * ringbuf::RingBuffer<T, N> is a ring buffer of N elements of type T,
+ * where N is a power of two known at compile time, and the elements
+ * are stored inline, in the object itself. Because the capacity is a
+ * constant, the compiler reduces the index arithmetic to a mask with
+ * a constant, and because everything is in this header, the hot
+ * operations inline into the caller; neither is possible with the
+ * opaque ringbuf_t.
+ *
+ * Like a ring buffer created with ringbuf_new_spsc, a RingBuffer may
+ * be shared, without locking, by exactly one producer thread and
+ * exactly one consumer thread, and it never overflows. It uses the
+ * same scheme as ringbuf.c: free-running head and tail indices on
+ * separate cache lines, each published with release ordering, and a
+ * cached copy of the other side's index on each side's line.
+ *
+ * The producer may call push, emplace and read_from; the consumer may
+ * call pop, peek, front and write_to. Either side may call the
+ * size queries. The other members may only be called while no other
+ * thread is using the ring buffer.
+ *
+ * Elements are copied in and out with memcpy, so T must be trivially
+ * copyable. RingBuffers can be moved, which copies the elements, but
+ * not copied.
+ *
+ * ringbuf::Queue<T, N> is the same thing for any T that can be moved
+ * without throwing (e.g., std::unique_ptr, std::string): elements are
+ * constructed in place by emplace or push, moved out by pop, and
+ * destroyed by pop, clear, or the queue's destructor. A Queue can be
+ * neither copied nor moved.
+ *
+ * Either template can be instantiated with Awaitable set to true, for
+ * use by coroutines. This is the counterpart of RINGBUF_BLOCKING:
+ * instead of blocking a thread, the consumer can co_await
+ * readable(n), and the producer writable(n), and the coroutine is
+ * suspended until there are at least n elements, or n free slots, and
+ * is then resumed by the other side, as soon as it publishes the push
+ * or pop that made room. By default the other side resumes the
+ * coroutine itself, before push or pop returns, so that when both
+ * stages of a pipeline run on the same event loop, data passes from
+ * one to the other with no handoff to another thread. Either call may
+ * instead be given an executor, anything with a post(handle) member,
+ * to which the other side hands the coroutine. As with the C
+ * blocking functions, at most one coroutine may wait on each side at
+ * a time, and only an awaitable ring buffer pays for the notification
+ * (a fence and a load) on each push and pop.
+ *
+ * C++20 is required.
+ *
+ * ringbuf.h can't be included from C++, because its typedef of
+ * ringbuf_t to a pointer to struct ringbuf_t is not valid C++, so
+ * this header declares the C functions that C++ code most often needs
+ * to work with byte ring buffers, in terms of struct ringbuf_t *
+ * (which is the same type in both languages). Link with ringbuf.o to
+ * use them.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+
+struct ringbuf_t;
+
+ringbuf_t *
+ringbuf_new(std::size_t capacity);
+
+void
+ringbuf_free(ringbuf_t **rb);
+
+void
+ringbuf_reset(ringbuf_t *rb);
+
+std::size_t
+ringbuf_capacity(const ringbuf_t *rb);
+
+std::size_t
+ringbuf_bytes_free(const ringbuf_t *rb);
+
+std::size_t
+ringbuf_bytes_used(const ringbuf_t *rb);
+
+int
+ringbuf_is_full(const ringbuf_t *rb);
+
+int
+ringbuf_is_empty(const ringbuf_t *rb);
+
+void *
+ringbuf_memcpy_into(ringbuf_t *dst, const void *src, std::size_t count);
+
+std::size_t
+ringbuf_memcpy_into_nooverwrite(ringbuf_t *dst, const void *src,
+                                std::size_t count);
+
+void *
+ringbuf_memcpy_from(void *dst, ringbuf_t *src, std::size_t count);
+
+}
+
+namespace ringbuf {
+
+#if defined(__APPLE__) && defined(__aarch64__)
+inline constexpr std::size_t cacheline_size = 128;
+#else
+inline constexpr std::size_t cacheline_size = 64;
+#endif
+
+template <typename T>
+concept TriviallyCopyable = std::is_trivially_copyable_v<T>;
+
+template <typename T>
+concept NothrowMovable = std::is_nothrow_move_constructible_v<T> &&
+    std::is_nothrow_destructible_v<T>;
+
+template <std::size_t N>
+concept PowerOfTwo = N > 0 && (N & (N - 1)) == 0;
+
+template <typename E>
+concept Executor = requires(E &e, std::coroutine_handle<> h) {
+    e.post(h);
+};
+
+namespace detail {
+
+/*
+ * The SPSC head and tail indices shared by RingBuffer and Queue, the
+ * size queries that depend only on them, and, if Awaitable, the
+ * coroutine waiters.
+ */
+template <std::size_t N, bool Awaitable>
+class SpscIndices
+{
+    struct waiter;
+
+public:
+    using size_type = std::size_t;
+
+    /*
+     * The awaiter returned by readable and writable. co_await yields
+     * false, without suspending, if n is larger than the capacity,
+     * and otherwise true once the condition holds.
+     */
+    class awaiter
+    {
+    public:
+        bool
+        await_ready() const noexcept
+        {
+            return n_ > N || rb_.ready(readable_, n_);
+        }
+
+        bool
+        await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            return rb_.suspend(readable_, n_, h, post_, ctx_);
+        }
+
+        bool
+        await_resume() const noexcept
+        {
+            return n_ <= N;
+        }
+
+    private:
+        friend class SpscIndices;
+
+        awaiter(SpscIndices &rb, bool readable, size_type n,
+                void (*post)(void *, std::coroutine_handle<>),
+                void *ctx) noexcept
+            : rb_(rb), readable_(readable), n_(n), post_(post), ctx_(ctx)
+        {
+        }
+
+        SpscIndices &rb_;
+        bool readable_;
+        size_type n_;
+        void (*post_)(void *, std::coroutine_handle<>);
+        void *ctx_;
+    };
+
+    static constexpr size_type
+    capacity() noexcept
+    {
+        return N;
+    }
+
+    /*
+     * The number of elements in the ring buffer. The tail is loaded
+     * first, so that the difference is never negative.
+     */
+    size_type
+    size() const noexcept
+    {
+        size_type tail = tail_.load(std::memory_order_acquire);
+        size_type head = head_.load(std::memory_order_acquire);
+        return std::min(head - tail, N);
+    }
+
+    size_type
+    free_space() const noexcept
+    {
+        return N - size();
+    }
+
+    bool
+    empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    bool
+    full() const noexcept
+    {
+        return size() == N;
+    }
+
+    /*
+     * co_await readable(n), on the consumer side, suspends the calling
+     * coroutine until the ring buffer holds at least n elements;
+     * co_await writable(n), on the producer side, until it has at
+     * least n free slots. Neither removes or reserves anything: the
+     * coroutine must still pop or push. If ex is given, ex.post(h) is
+     * called to resume the coroutine; otherwise the other side resumes
+     * it directly, from the push or pop that satisfied it.
+     */
+    awaiter
+    readable(size_type n = 1) noexcept
+        requires Awaitable
+    {
+        return awaiter(*this, true, n, nullptr, nullptr);
+    }
+
+    template <Executor E>
+    awaiter
+    readable(size_type n, E &ex) noexcept
+        requires Awaitable
+    {
+        return awaiter(*this, true, n, &post_to<E>, &ex);
+    }
+
+    awaiter
+    writable(size_type n = 1) noexcept
+        requires Awaitable
+    {
+        return awaiter(*this, false, n, nullptr, nullptr);
+    }
+
+    template <Executor E>
+    awaiter
+    writable(size_type n, E &ex) noexcept
+        requires Awaitable
+    {
+        return awaiter(*this, false, n, &post_to<E>, &ex);
+    }
+
+protected:
+    static constexpr size_type mask = N - 1;
+
+    /*
+     * The number of the n slots starting at index idx that come
+     * before the end of the storage.
+     */
+    static constexpr size_type
+    contiguous(size_type idx, size_type n) noexcept
+    {
+        return std::min(n, N - (idx & mask));
+    }
+
+    /*
+     * The number of free slots, as seen by the producer, whose head
+     * index is head. The cached tail is only reloaded if it shows
+     * fewer than want free.
+     */
+    size_type
+    producer_free(size_type head, size_type want) noexcept
+    {
+        if (N - (head - tail_cache_) < want)
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+        return N - (head - tail_cache_);
+    }
+
+    size_type
+    consumer_used(size_type tail, size_type want) noexcept
+    {
+        if (head_cache_ - tail < want)
+            head_cache_ = head_.load(std::memory_order_acquire);
+        return head_cache_ - tail;
+    }
+
+    void
+    reset_indices(size_type head = 0) noexcept
+    {
+        head_.store(head, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+        tail_cache_ = 0;
+        head_cache_ = head;
+    }
+
+    /*
+     * Called by the producer after it publishes a new head, and by the
+     * consumer after it publishes a new tail, to resume the other
+     * side's coroutine if it is waiting for what was just published.
+     */
+    void
+    wake_consumer() noexcept
+    {
+        if constexpr (Awaitable)
+            wake(consumer_waiter_, true);
+    }
+
+    void
+    wake_producer() noexcept
+    {
+        if constexpr (Awaitable)
+            wake(producer_waiter_, false);
+    }
+
+    /* Written by the producer. */
+    alignas(cacheline_size) std::atomic<size_type> head_{0};
+    size_type tail_cache_ = 0;
+
+    /* Written by the consumer. */
+    alignas(cacheline_size) std::atomic<size_type> tail_{0};
+    size_type head_cache_ = 0;
+
+private:
+    /*
+     * A suspended coroutine, and what it's waiting for. The waiting
+     * side fills in the rest and then sets waiting; the side that
+     * clears waiting, with an exchange, owns the coroutine, and is the
+     * one that resumes it (or, on the waiting side, declines to
+     * suspend it). Each side's waiter is on that side's cache line, as
+     * the C implementation does with its waiting flags.
+     */
+    struct waiter
+    {
+        std::atomic<bool> waiting{false};
+        std::atomic<size_type> want{0};
+        std::coroutine_handle<> handle;
+        void (*post)(void *, std::coroutine_handle<>) = nullptr;
+        void *ctx = nullptr;
+    };
+
+    template <typename E>
+    static void
+    post_to(void *ex, std::coroutine_handle<> h)
+    {
+        static_cast<E *>(ex)->post(h);
+    }
+
+    bool
+    ready(bool readable, size_type n) const noexcept
+    {
+        return readable ? size() >= n : free_space() >= n;
+    }
+
+    /*
+     * Publish the waiter, then check the condition again, so that a
+     * push or pop that the other side published just before it could
+     * see the waiter isn't missed. The fence here and the one in wake
+     * ensure that at least one side sees the other's store. Nothing in
+     * the awaiter is touched once the waiter is published, because the
+     * coroutine, and the awaiter with it, may already be running again.
+     */
+    bool
+    suspend(bool readable, size_type n, std::coroutine_handle<> h,
+            void (*post)(void *, std::coroutine_handle<>), void *ctx) noexcept
+    {
+        waiter &w = readable ? consumer_waiter_ : producer_waiter_;
+        w.handle = h;
+        w.post = post;
+        w.ctx = ctx;
+        w.want.store(n, std::memory_order_relaxed);
+        w.waiting.store(true, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready(readable, n))
+            return true;
+        return !w.waiting.exchange(false, std::memory_order_acq_rel);
+    }
+
+    void
+    wake(waiter &w, bool readable) noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!w.waiting.load(std::memory_order_acquire))
+            return;
+        if (!ready(readable, w.want.load(std::memory_order_relaxed)))
+            return;
+        if (!w.waiting.exchange(false, std::memory_order_acq_rel))
+            return;
+        if (w.post)
+            w.post(w.ctx, w.handle);
+        else
+            w.handle.resume();
+    }
+
+    /* Waited on by the producer, woken by the consumer. */
+    alignas(cacheline_size) waiter producer_waiter_;
+
+    /* Waited on by the consumer, woken by the producer. */
+    alignas(cacheline_size) waiter consumer_waiter_;
+};
+
+} // namespace detail
+
+template <TriviallyCopyable T, std::size_t N, bool Awaitable = false>
+    requires PowerOfTwo<N>
+class RingBuffer : public detail::SpscIndices<N, Awaitable>
+{
+    using base = detail::SpscIndices<N, Awaitable>;
+    using base::contiguous;
+    using base::producer_free;
+    using base::consumer_used;
+    using base::reset_indices;
+    using base::wake_consumer;
+    using base::wake_producer;
+    using base::head_;
+    using base::tail_;
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    RingBuffer() noexcept = default;
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    /*
+     * Moving a ring buffer copies its elements, and leaves the
+     * source empty.
+     */
+    RingBuffer(RingBuffer &&other) noexcept
+    {
+        take(other);
+    }
+
+    RingBuffer &
+    operator=(RingBuffer &&other) noexcept
+    {
+        if (this != &other) {
+            clear();
+            take(other);
+        }
+        return *this;
+    }
+
+    /*
+     * Discard the contents of the ring buffer.
+     */
+    void
+    clear() noexcept
+    {
+        reset_indices();
+    }
+
+    /*
+     * Append v. Returns false, and appends nothing, if the ring
+     * buffer is full.
+     */
+    bool
+    push(const T &v) noexcept
+    {
+        size_type head = head_.load(std::memory_order_relaxed);
+        if (producer_free(head, 1) == 0)
+            return false;
+        std::memcpy(slot(head), &v, sizeof(T));
+        head_.store(head + 1, std::memory_order_release);
+        wake_consumer();
+        return true;
+    }
+
+    /*
+     * Append up to n elements from src, and return the number
+     * appended, which is less than n only if the ring buffer fills
+     * up.
+     */
+    size_type
+    push(const T *src, size_type n) noexcept
+    {
+        size_type head = head_.load(std::memory_order_relaxed);
+        n = std::min(n, producer_free(head, n));
+        copy_in(head, reinterpret_cast<const unsigned char *>(src), n);
+        head_.store(head + n, std::memory_order_release);
+        wake_consumer();
+        return n;
+    }
+
+    /*
+     * Remove the first element into v. Returns false, and leaves v
+     * alone, if the ring buffer is empty.
+     */
+    bool
+    pop(T &v) noexcept
+    {
+        size_type tail = tail_.load(std::memory_order_relaxed);
+        if (consumer_used(tail, 1) == 0)
+            return false;
+        std::memcpy(&v, slot(tail), sizeof(T));
+        tail_.store(tail + 1, std::memory_order_release);
+        wake_producer();
+        return true;
+    }
+
+    /*
+     * Remove up to n elements into dst, and return the number removed.
+     */
+    size_type
+    pop(T *dst, size_type n) noexcept
+    {
+        size_type tail = tail_.load(std::memory_order_relaxed);
+        n = std::min(n, consumer_used(tail, n));
+        copy_out(reinterpret_cast<unsigned char *>(dst), tail, n);
+        tail_.store(tail + n, std::memory_order_release);
+        wake_producer();
+        return n;
+    }
+
+    /*
+     * Copy the first element into v, without removing it. Returns
+     * false if the ring buffer is empty.
+     */
+    bool
+    peek(T &v) const noexcept
+    {
+        size_type tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+            return false;
+        std::memcpy(&v, slot(tail), sizeof(T));
+        return true;
+    }
+
+    /*
+     * Interoperate with C byte ring buffers. write_to
+     * moves up to n whole elements from this ring buffer into the
+     * byte ring buffer dst, as raw bytes, and read_from moves up to n
+     * whole elements' worth of bytes from the byte ring buffer src
+     * into this one. Neither overflows dst, nor underflows src. Both
+     * return the number of elements moved.
+     *
+     * write_to is a consumer function of this ring buffer and a
+     * producer function of dst; read_from is a producer function of
+     * this ring buffer and a consumer function of src.
+     */
+    size_type
+    write_to(ringbuf_t *dst, size_type n) noexcept
+    {
+        size_type tail = tail_.load(std::memory_order_relaxed);
+        n = std::min(n, ringbuf_bytes_free(dst) / sizeof(T));
+        n = std::min(n, consumer_used(tail, n));
+        size_type n1 = contiguous(tail, n);
+        ringbuf_memcpy_into_nooverwrite(dst, slot(tail), n1 * sizeof(T));
+        ringbuf_memcpy_into_nooverwrite(dst, slot(tail + n1),
+                                        (n - n1) * sizeof(T));
+        tail_.store(tail + n, std::memory_order_release);
+        wake_producer();
+        return n;
+    }
+
+    size_type
+    read_from(ringbuf_t *src, size_type n) noexcept
+    {
+        size_type head = head_.load(std::memory_order_relaxed);
+        n = std::min(n, ringbuf_bytes_used(src) / sizeof(T));
+        n = std::min(n, producer_free(head, n));
+        size_type n1 = contiguous(head, n);
+        ringbuf_memcpy_from(slot(head), src, n1 * sizeof(T));
+        ringbuf_memcpy_from(slot(head + n1), src, (n - n1) * sizeof(T));
+        head_.store(head + n, std::memory_order_release);
+        wake_consumer();
+        return n;
+    }
+
+private:
+    static constexpr size_type mask = N - 1;
+
+    unsigned char *
+    slot(size_type idx) noexcept
+    {
+        return storage_ + (idx & mask) * sizeof(T);
+    }
+
+    const unsigned char *
+    slot(size_type idx) const noexcept
+    {
+        return storage_ + (idx & mask) * sizeof(T);
+    }
+
+    void
+    copy_in(size_type head, const unsigned char *src, size_type n) noexcept
+    {
+        size_type n1 = contiguous(head, n);
+        std::memcpy(slot(head), src, n1 * sizeof(T));
+        std::memcpy(storage_, src + n1 * sizeof(T), (n - n1) * sizeof(T));
+    }
+
+    void
+    copy_out(unsigned char *dst, size_type tail, size_type n) const noexcept
+    {
+        size_type n1 = contiguous(tail, n);
+        std::memcpy(dst, slot(tail), n1 * sizeof(T));
+        std::memcpy(dst + n1 * sizeof(T), storage_, (n - n1) * sizeof(T));
+    }
+
+    void
+    take(RingBuffer &other) noexcept
+    {
+        size_type tail = other.tail_.load(std::memory_order_relaxed);
+        size_type n = other.head_.load(std::memory_order_relaxed) - tail;
+        other.copy_out(storage_, tail, n);
+        reset_indices(n);
+        other.clear();
+    }
+
+    alignas(cacheline_size) alignas(T) unsigned char storage_[N * sizeof(T)];
+};
+
+template <NothrowMovable T, std::size_t N, bool Awaitable = false>
+    requires PowerOfTwo<N>
+class Queue : public detail::SpscIndices<N, Awaitable>
+{
+    using base = detail::SpscIndices<N, Awaitable>;
+    using base::producer_free;
+    using base::consumer_used;
+    using base::reset_indices;
+    using base::wake_consumer;
+    using base::wake_producer;
+    using base::head_;
+    using base::tail_;
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    Queue() noexcept = default;
+    Queue(const Queue &) = delete;
+    Queue &operator=(const Queue &) = delete;
+
+    ~Queue()
+    {
+        clear();
+    }
+
+    /*
+     * Construct an element in place at the end of the queue, from
+     * args. Returns false, and constructs nothing, if the queue is
+     * full. If the constructor throws, the queue is unchanged.
+     */
+    template <typename... Args>
+        requires std::constructible_from<T, Args...>
+    bool
+    emplace(Args &&...args)
+        noexcept(std::is_nothrow_constructible_v<T, Args...>)
+    {
+        size_type head = head_.load(std::memory_order_relaxed);
+        if (producer_free(head, 1) == 0)
+            return false;
+        std::construct_at(raw(head), std::forward<Args>(args)...);
+        head_.store(head + 1, std::memory_order_release);
+        wake_consumer();
+        return true;
+    }
+
+    bool
+    push(T &&v) noexcept
+    {
+        return emplace(std::move(v));
+    }
+
+    bool
+    push(const T &v) noexcept(std::is_nothrow_copy_constructible_v<T>)
+        requires std::copy_constructible<T>
+    {
+        return emplace(v);
+    }
+
+    /*
+     * Move the first element out of the queue, and destroy it in the
+     * queue. Returns an empty optional if the queue is empty.
+     */
+    std::optional<T>
+    pop() noexcept
+    {
+        size_type tail = tail_.load(std::memory_order_relaxed);
+        if (consumer_used(tail, 1) == 0)
+            return std::nullopt;
+        T *p = element(tail);
+        std::optional<T> v(std::move(*p));
+        std::destroy_at(p);
+        tail_.store(tail + 1, std::memory_order_release);
+        wake_producer();
+        return v;
+    }
+
+    /*
+     * Move-assign the first element to v, and remove it. Returns false
+     * if the queue is empty. If the assignment throws, the element
+     * stays in the queue.
+     */
+    bool
+    pop(T &v) noexcept(std::is_nothrow_move_assignable_v<T>)
+    {
+        size_type tail = tail_.load(std::memory_order_relaxed);
+        if (consumer_used(tail, 1) == 0)
+            return false;
+        T *p = element(tail);
+        v = std::move(*p);
+        std::destroy_at(p);
+        tail_.store(tail + 1, std::memory_order_release);
+        wake_producer();
+        return true;
+    }
+
+    /*
+     * The first element, which stays in the queue, or nullptr if the
+     * queue is empty. The pointer is valid until the consumer pops
+     * the element.
+     */
+    T *
+    front() noexcept
+    {
+        size_type tail = tail_.load(std::memory_order_relaxed);
+        if (consumer_used(tail, 1) == 0)
+            return nullptr;
+        return element(tail);
+    }
+
+    /*
+     * Destroy the elements still in the queue.
+     */
+    void
+    clear() noexcept
+    {
+        size_type tail = tail_.load(std::memory_order_relaxed);
+        size_type head = head_.load(std::memory_order_acquire);
+        for (; tail != head; ++tail)
+            std::destroy_at(element(tail));
+        reset_indices();
+    }
+
+private:
+    static constexpr size_type mask = N - 1;
+
+    T *
+    raw(size_type idx) noexcept
+    {
+        return reinterpret_cast<T *>(storage_ + (idx & mask) * sizeof(T));
+    }
+
+    T *
+    element(size_type idx) noexcept
+    {
+        return std::launder(raw(idx));
+    }
+
+    alignas(cacheline_size) alignas(T) unsigned char storage_[N * sizeof(T)];
+};
+
+} // namespace ringbuf
+
+#endif /* INCLUDED_RINGBUF_HPP */